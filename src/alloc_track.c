@@ -0,0 +1,49 @@
+#include "alloc_track.h"
+
+#ifdef ALLOC_TRACK
+
+#include <stddef.h>
+
+/* The allocator proper of glibc, the wrappers below take the place of the public names */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+// Initial exec keeps the TLS access from allocating on the first call of a thread
+static __thread alloc_count_t counts __attribute__((tls_model("initial-exec")));
+
+void alloc_track_get(alloc_count_t *count)
+{
+	*count = counts;
+}
+
+void *malloc(size_t size)
+{
+	counts.allocs++;
+	counts.bytes += size;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	counts.allocs++;
+	counts.bytes += nmemb * size;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	counts.allocs++;
+	counts.bytes += size;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	if (ptr)
+		counts.frees++;
+	__libc_free(ptr);
+}
+
+#endif
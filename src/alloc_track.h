@@ -0,0 +1,35 @@
+#ifndef DISKSURVEY_ALLOC_TRACK_H
+#define DISKSURVEY_ALLOC_TRACK_H
+
+#include <stdint.h>
+#include <string.h>
+
+/** Counting of the heap allocations, built in by ./configure --alloc-track.
+ * malloc, calloc, realloc and free are then replaced by wrappers that count
+ * the calls of each thread before handing them to glibc. The self_cpu
+ * sections of self_stats charge what the wire thread allocated to their task,
+ * the paths that run per probe and per tick are expected not to allocate at
+ * all and the tests check it. Without the build flag the counts stay at zero.
+ */
+
+typedef struct alloc_count_t {
+	uint64_t allocs; /* including the reallocs */
+	uint64_t bytes; /* requested */
+	uint64_t frees;
+} alloc_count_t;
+
+#ifdef ALLOC_TRACK
+#define ALLOC_TRACK_ENABLED 1
+
+/* Of the calling thread */
+void alloc_track_get(alloc_count_t *count);
+#else
+#define ALLOC_TRACK_ENABLED 0
+
+static inline void alloc_track_get(alloc_count_t *count)
+{
+	memset(count, 0, sizeof(*count));
+}
+#endif
+
+#endif
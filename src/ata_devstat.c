@@ -0,0 +1,120 @@
+#include "ata_devstat.h"
+#include "util.h"
+
+#include <memory.h>
+
+#define ATA_PASS_THROUGH_16 0x85
+#define ATA_PROTOCOL_PIO_DATA_IN 4
+#define ATA_CMD_READ_LOG_EXT 0x2F
+
+#define STAT_SUPPORTED (1ULL << 63)
+#define STAT_VALID (1ULL << 62)
+#define STAT_VALUE_MASK 0xFFFFFFFFFFFFULL
+
+const ata_devstat_desc_t ata_devstat_tracked[ATA_DEVSTAT_TRACKED_COUNT] = {
+	{ 0x01, 1, false, "power_on_resets" },
+	{ 0x03, 4, false, "reallocated_sectors" },
+	{ 0x03, 5, false, "read_recovery_attempts" },
+	{ 0x03, 6, false, "mechanical_start_failures" },
+	{ 0x03, 7, false, "reallocation_candidates" },
+	{ 0x04, 1, false, "reported_uncorrectable_errors" },
+	{ 0x04, 2, false, "command_resets" },
+	{ 0x05, 4, true, "highest_temperature" },
+	{ 0x05, 5, true, "lowest_temperature" },
+	{ 0x05, 10, false, "time_over_temperature" },
+	{ 0x05, 12, false, "time_under_temperature" },
+	{ 0x06, 1, false, "hardware_resets" },
+	{ 0x06, 3, false, "interface_crc_errors" },
+	{ 0x07, 1, false, "endurance_used" },
+};
+
+static inline uint64_t get_le64(const unsigned char *buf)
+{
+	uint64_t val = 0;
+	int i;
+
+	for (i = 7; i >= 0; i--)
+		val = (val << 8) | buf[i];
+	return val;
+}
+
+int ata_devstat_cdb(unsigned char *cdb, uint8_t page)
+{
+	memset(cdb, 0, 16);
+	cdb[0] = ATA_PASS_THROUGH_16;
+	cdb[1] = (ATA_PROTOCOL_PIO_DATA_IN << 1) | 1; // extend
+	cdb[2] = 0x0E; // t_dir from device, byte_block, length in sector count
+	cdb[6] = 1; // sector count
+	cdb[8] = ATA_DEVSTAT_LOG;
+	cdb[10] = page;
+	cdb[14] = ATA_CMD_READ_LOG_EXT;
+	return 16;
+}
+
+uint64_t ata_devstat_parse_supported(const unsigned char *buf, unsigned buf_len)
+{
+	uint64_t pages = 0;
+	unsigned i;
+
+	if (buf_len < ATA_DEVSTAT_PAGE_SIZE || buf[2] != ATA_DEVSTAT_PAGE_LIST)
+		return 0;
+
+	unsigned num_entries = buf[8];
+	for (i = 0; i < num_entries && 9 + i < ATA_DEVSTAT_PAGE_SIZE; i++) {
+		uint8_t page = buf[9 + i];
+		if (page < 64)
+			pages |= 1ULL << page;
+	}
+
+	return pages;
+}
+
+bool ata_devstat_parse_page(const unsigned char *buf, unsigned buf_len, ata_devstat_t *stats)
+{
+	int i;
+
+	if (buf_len < ATA_DEVSTAT_PAGE_SIZE)
+		return false;
+
+	uint8_t page = buf[2];
+	for (i = 0; i < ATA_DEVSTAT_TRACKED_COUNT; i++) {
+		const ata_devstat_desc_t *desc = &ata_devstat_tracked[i];
+		if (desc->page != page)
+			continue;
+
+		uint64_t qword = get_le64(buf + desc->index * 8);
+		if ((qword & (STAT_SUPPORTED|STAT_VALID)) != (STAT_SUPPORTED|STAT_VALID)) {
+			stats->valid &= ~(1 << i);
+			continue;
+		}
+
+		if (desc->is_signed)
+			stats->value[i] = (int8_t)(qword & 0xFF);
+		else
+			stats->value[i] = qword & STAT_VALUE_MASK;
+		stats->valid |= 1 << i;
+	}
+
+	return true;
+}
+
+uint64_t ata_devstat_wanted_pages(void)
+{
+	uint64_t pages = 0;
+	int i;
+
+	for (i = 0; i < ATA_DEVSTAT_TRACKED_COUNT; i++)
+		pages |= 1ULL << ata_devstat_tracked[i].page;
+	return pages;
+}
+
+void ata_devstat_update_series(const ata_devstat_t *stats, series_set_t *set, uint32_t ts)
+{
+	int i;
+
+	for (i = 0; i < ATA_DEVSTAT_TRACKED_COUNT; i++) {
+		const ata_devstat_desc_t *desc = &ata_devstat_tracked[i];
+		if (stats->valid & (1 << i))
+			series_set_add(set, ATA_DEVSTAT_SERIES_ID(desc->page, desc->index), ts, stats->value[i]);
+	}
+}
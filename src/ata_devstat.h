@@ -0,0 +1,50 @@
+#ifndef DISKSURVEY_ATA_DEVSTAT_H
+#define DISKSURVEY_ATA_DEVSTAT_H
+
+#include "series.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** The ATA Device Statistics log (GPL log 0x04) holds one 512 byte page per
+ * group of statistics, page 0 lists the supported pages. We track a handful
+ * of the statistics that carry failure and workload context.
+ */
+
+#define ATA_DEVSTAT_LOG 0x04
+#define ATA_DEVSTAT_PAGE_LIST 0x00
+#define ATA_DEVSTAT_PAGE_SIZE 512
+
+/* Series ids of the device statistics, above the ATA attribute and SAS log page ids */
+#define ATA_DEVSTAT_SERIES_ID(page, index) (0x4000 | ((page) << 6) | (index))
+
+typedef struct ata_devstat_desc_t {
+	uint8_t page;
+	uint8_t index;
+	bool is_signed;
+	const char *name;
+} ata_devstat_desc_t;
+
+extern const ata_devstat_desc_t ata_devstat_tracked[];
+#define ATA_DEVSTAT_TRACKED_COUNT 14
+
+typedef struct ata_devstat_t {
+	uint32_t valid; /* bit per tracked statistic */
+	int64_t value[ATA_DEVSTAT_TRACKED_COUNT];
+} ata_devstat_t;
+
+/* READ LOG EXT of a single page of the device statistics log through ATA PASS-THROUGH(16) */
+int ata_devstat_cdb(unsigned char *cdb, uint8_t page);
+
+/* Parse the list of supported pages (page 0) into a bitmap */
+uint64_t ata_devstat_parse_supported(const unsigned char *buf, unsigned buf_len);
+
+/* Parse a statistics page, the page number is taken from the page header */
+bool ata_devstat_parse_page(const unsigned char *buf, unsigned buf_len, ata_devstat_t *stats);
+
+/* Bitmap of the pages that hold tracked statistics */
+uint64_t ata_devstat_wanted_pages(void);
+
+void ata_devstat_update_series(const ata_devstat_t *stats, series_set_t *set, uint32_t ts);
+
+#endif
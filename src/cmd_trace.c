@@ -0,0 +1,61 @@
+#include "cmd_trace.h"
+#include "monoclock.h"
+
+#include <string.h>
+#include <time.h>
+
+cmd_trace_entry_t *cmd_trace_add(cmd_trace_t *trace, uint8_t opcode)
+{
+	cmd_trace_entry_t *entry = &trace->entries[trace->count++ % CMD_TRACE_ENTRIES];
+
+	memset(entry, 0, sizeof(*entry));
+	entry->opcode = opcode;
+	entry->result = CMD_TRACE_PENDING;
+	entry->outcome.sense_key = SENSE_STATS_NO_SENSE;
+	return entry;
+}
+
+const char *cmd_trace_result_name(cmd_trace_result_e result)
+{
+	switch (result) {
+		case CMD_TRACE_PENDING: return "pending";
+		case CMD_TRACE_DONE: return "done";
+		case CMD_TRACE_SUBMIT_FAILED: return "submit failed";
+		case CMD_TRACE_LOST: return "lost";
+	}
+	return "unknown";
+}
+
+/* Monoclock times are shown as wall clock times */
+static double trace_wall_offset(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return now.tv_sec + now.tv_nsec / 1000000000.0 - monoclock_get();
+}
+
+int cmd_trace_json(const cmd_trace_t *trace, json_t *json)
+{
+	double offset = trace_wall_offset();
+	const cmd_trace_entry_t *entry;
+	uint32_t i;
+
+	json_uint(json, "commands", trace->count);
+
+	json_array_start(json, "trace");
+	for_each_cmd_trace(trace, i, entry) {
+		json_object_start(json, NULL);
+		json_uint(json, "opcode", entry->opcode);
+		json_str(json, "result", cmd_trace_result_name(entry->result));
+		json_double_fixed(json, "submit", entry->submit_ts + offset, 6);
+
+		if (entry->result == CMD_TRACE_DONE) {
+			json_double_fixed(json, "complete", entry->complete_ts + offset, 6);
+			json_double_fixed(json, "latency", cmd_trace_latency_msecs(entry), 3);
+			json_uint(json, "kernel", entry->kernel_msecs);
+			sense_outcome_json(json, &entry->outcome);
+		}
+		json_object_end(json);
+	}
+	return json_array_end(json);
+}
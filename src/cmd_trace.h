@@ -0,0 +1,53 @@
+#ifndef DISKSURVEY_CMD_TRACE_H
+#define DISKSURVEY_CMD_TRACE_H
+
+#include "sense_stats.h"
+
+#include <stdint.h>
+
+/** The last commands sent to a disk, kept in a fixed ring in the disk so that
+ * recording one never allocates. An entry is claimed when the command is sent
+ * and filled in as it completes, the command that was in flight when a disk
+ * went away stays pending.
+ */
+
+#define CMD_TRACE_ENTRIES 32
+
+typedef enum cmd_trace_result_e {
+	CMD_TRACE_PENDING,
+	CMD_TRACE_DONE,
+	CMD_TRACE_SUBMIT_FAILED,
+	CMD_TRACE_LOST, /* the completion couldn't be read */
+} cmd_trace_result_e;
+
+typedef struct cmd_trace_entry_t {
+	double submit_ts; /* monoclock */
+	double complete_ts; /* monoclock, 0 without a completion */
+	uint32_t kernel_msecs; /* the duration the SG layer measured */
+	uint8_t opcode;
+	uint8_t result;
+	sense_outcome_t outcome;
+} cmd_trace_entry_t;
+
+typedef struct cmd_trace_t {
+	uint32_t count; /* of all the commands, the ring holds the last ones */
+	cmd_trace_entry_t entries[CMD_TRACE_ENTRIES];
+} cmd_trace_t;
+
+static inline double cmd_trace_latency_msecs(const cmd_trace_entry_t *entry)
+{
+	return (entry->complete_ts - entry->submit_ts) * 1000.0;
+}
+
+/* Reuses the slot of the oldest entry, the new entry is pending */
+cmd_trace_entry_t *cmd_trace_add(cmd_trace_t *trace, uint8_t opcode);
+const char *cmd_trace_result_name(cmd_trace_result_e result);
+/* The command count and the entries with wall clock times as members of the enclosing object */
+int cmd_trace_json(const cmd_trace_t *trace, json_t *json);
+
+/* Entries from the oldest to the newest */
+#define for_each_cmd_trace(_trace_, _i_, _entry_) \
+	for (_i_ = (_trace_)->count > CMD_TRACE_ENTRIES ? (_trace_)->count - CMD_TRACE_ENTRIES : 0; \
+	     _i_ < (_trace_)->count && ((_entry_) = &(_trace_)->entries[_i_ % CMD_TRACE_ENTRIES]); _i_++)
+
+#endif
@@ -0,0 +1,47 @@
+#include "ctl.h"
+#include "disk_mgr.h"
+#include "disk_pb.h"
+
+#include "logger.h"
+
+#include <string.h>
+
+static int ctl_dump_disk(const unsigned char *payload, unsigned len, stream_t *out)
+{
+	char serial[64];
+
+	if (len == 0 || len >= sizeof(serial))
+		return CTL_ERR_BAD_REQUEST;
+	memcpy(serial, payload, len);
+	serial[len] = 0;
+
+	int ret = disk_manager_disk_stream(serial, disk_status_pb, out);
+	if (ret == DISK_MGR_NOT_FOUND)
+		return CTL_ERR_NOT_FOUND;
+	return ret < 0 ? CTL_ERR_INTERNAL : CTL_OK;
+}
+
+int ctl_execute(uint8_t cmd, const unsigned char *payload, unsigned len, stream_t *out)
+{
+	switch ((ctl_cmd_e)cmd) {
+		case CTL_CMD_RESCAN:
+			disk_manager_rescan();
+			return CTL_OK;
+
+		case CTL_CMD_SAVE_STATE:
+			disk_manager_save_state();
+			return CTL_OK;
+
+		case CTL_CMD_DUMP_DISK:
+			return ctl_dump_disk(payload, len, out);
+
+		case CTL_CMD_SET_PROBE:
+			if (len != 4)
+				return CTL_ERR_BAD_REQUEST;
+			disk_manager_set_probe_interval((uint32_t)payload[0] << 24 | payload[1] << 16 | payload[2] << 8 | payload[3]);
+			return CTL_OK;
+	}
+
+	wire_log(WLOG_INFO, "Unknown control command %u", cmd);
+	return CTL_ERR_UNKNOWN_CMD;
+}
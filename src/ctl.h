@@ -0,0 +1,56 @@
+#ifndef DISKSURVEY_CTL_H
+#define DISKSURVEY_CTL_H
+
+#include "stream.h"
+
+#include <stdint.h>
+
+/** The binary command protocol of the local control socket, spoken by
+ * disksurvey-ctl. The socket serves HTTP as well, a connection whose first
+ * byte is CTL_MAGIC speaks this protocol instead.
+ *
+ * Requests and responses are frames of a 6 byte header followed by the
+ * payload: the magic byte, the command or the status, and the payload length
+ * as a big endian 32 bit number. Commands are answered in order, one
+ * response each.
+ */
+
+#define CTL_SOCKET_PATH "./disksurvey.sock"
+#define CTL_MAGIC 0xD5
+#define CTL_HDR_SIZE 6
+#define CTL_MAX_PAYLOAD 256 /* of a request, responses may be longer */
+
+typedef enum ctl_cmd_e {
+	CTL_CMD_RESCAN = 1,
+	CTL_CMD_SAVE_STATE = 2,
+	CTL_CMD_DUMP_DISK = 3, /* payload is the serial, the response a length delimited DiskStatus message */
+	CTL_CMD_SET_PROBE = 4, /* payload is the probe interval in seconds as a big endian uint32, 0 pauses */
+} ctl_cmd_e;
+
+typedef enum ctl_status_e {
+	CTL_OK = 0,
+	CTL_ERR_UNKNOWN_CMD = 1,
+	CTL_ERR_BAD_REQUEST = 2,
+	CTL_ERR_NOT_FOUND = 3,
+	CTL_ERR_INTERNAL = 4,
+} ctl_status_e;
+
+static inline void ctl_hdr_pack(unsigned char *hdr, uint8_t code, uint32_t len)
+{
+	hdr[0] = CTL_MAGIC;
+	hdr[1] = code;
+	hdr[2] = len >> 24;
+	hdr[3] = len >> 16;
+	hdr[4] = len >> 8;
+	hdr[5] = len;
+}
+
+static inline uint32_t ctl_hdr_len(const unsigned char *hdr)
+{
+	return (uint32_t)hdr[2] << 24 | hdr[3] << 16 | hdr[4] << 8 | hdr[5];
+}
+
+/* Run a command, the response payload goes to the stream. Returns a ctl_status_e. */
+int ctl_execute(uint8_t cmd, const unsigned char *payload, unsigned len, stream_t *out);
+
+#endif
@@ -1,7 +1,11 @@
 #include "disk.h"
 #include "util.h"
 #include "monoclock.h"
-#include "wire_log.h"
+#include "log_support.h"
+#include "shm_export.h"
+#include "startup_trace.h"
+#include "self_stats.h"
+#include "logger.h"
 
 #include "scsicmd.h"
 #include "ata.h"
@@ -17,6 +21,8 @@
 
 #define DEF_TIMEOUT 30*1000
 #define MONITOR_INTERVAL_SEC 3600
+#define LATENCY_CLASS_JSON_ENTRIES 24
+#define LATENCY_HISTORY_MAX_POINTS 1000
 
 inline const char *json_tribool(tribool_e state)
 {
@@ -28,59 +34,377 @@ inline const char *json_tribool(tribool_e state)
 		return "unknown";
 }
 
-inline const char *json_bool(bool is_true)
+static void latency_range_json(json_t *json, latency_range_t *range)
 {
-	return is_true ? "true" : "false";
+	int i;
+
+	json_uint(json, "count", range->count);
+	json_double(json, "max", range->max);
+	json_array_start(json, "histogram");
+	for (i = 0; i < LATENCY_RANGE_COUNT; i++)
+		json_uint(json, NULL, range->hist[i]);
+	json_array_end(json);
 }
 
-int disk_json(disk_t *disk, char *buf, int len)
+/* The top latencies and the histogram of a summary as two members of the enclosing object */
+static int latency_summary_json(json_t *json, latency_summary_t *entry, const char *top_key, const char *hist_key)
 {
-	int orig_len = len;
+	int i;
 
-	buf_add_char(buf, len, ' ');
-	buf_add_char(buf, len, '{');
-	buf_add_str(buf, len, " \"dev\": \"%s\" ", disk->sg_path);
-	buf_add_str(buf, len, ", \"vendor\": \"%s\"", disk->disk_info.vendor);
-	buf_add_str(buf, len, ", \"model\": \"%s\"", disk->disk_info.model);
-	buf_add_str(buf, len, ", \"serial\": \"%s\"", disk->disk_info.serial);
-	buf_add_str(buf, len, ", \"fw_rev\": \"%s\"", disk->disk_info.fw_rev);
+	json_array_start(json, top_key);
+	for (i = 0; i < NUM_TOP_LATENCIES; i++)
+		json_double(json, NULL, entry->top_latencies[i]);
+	json_array_end(json);
 
-	bool smart_ok = true;
+	json_array_start(json, hist_key);
+	for (i = 0; i < LATENCY_RANGE_COUNT; i++)
+		json_uint(json, NULL, entry->hist[i]);
+	return json_array_end(json);
+}
+
+/* Age in ticks of the entry that holds the time, clamped to the history that is kept */
+static int latency_age(disk_t *disk, time_t ts)
+{
+	int num_entries = ARRAY_SIZE(disk->latency.entries);
+
+	if (ts >= disk->latency_tick_ts)
+		return 0;
+	// Compared before subtracting, any time_t is a valid input
+	if (ts <= disk->latency_tick_ts - (time_t)(num_entries - 1) * DISK_TICK_SECS)
+		return num_entries - 1;
+
+	return (disk->latency_tick_ts - ts + DISK_TICK_SECS - 1) / DISK_TICK_SECS;
+}
+
+/* The entries were not ticked while the disk was away or the daemon was down,
+ * close one per tick interval that passed so the ages match the wall clock again */
+static void disk_latency_realign(disk_t *disk, time_t now)
+{
+	int num_entries = ARRAY_SIZE(disk->latency.entries);
+
+	if (disk->latency_tick_ts == 0 || now < disk->latency_tick_ts) {
+		disk->latency_tick_ts = now;
+		return;
+	}
 
+	time_t missed = (now - disk->latency_tick_ts) / DISK_TICK_SECS;
+	int i;
+	if (missed > 0)
+		latency_class_rollup(&disk->class_latency[LATENCY_CLASS_HEARTBEAT], &disk->latency.entries[disk->latency.cur_entry]);
+	for (i = 0; i < MIN(missed, num_entries); i++)
+		latency_tick(&disk->latency);
+	disk->latency_tick_ts += missed * DISK_TICK_SECS;
+}
+
+int disk_latency_history_json(disk_t *disk, json_t *json, time_t from, time_t to, unsigned step)
+{
+	int oldest = latency_age(disk, from);
+	int newest = latency_age(disk, to);
+	latency_range_t range;
+	int age, i;
+
+	// Whole entries per point and never more than the points limit, a point keeps the max of its entries so spikes survive
+	int step_entries = MAX(step / DISK_TICK_SECS, 1);
+	step_entries = MAX(step_entries, (oldest - newest) / LATENCY_HISTORY_MAX_POINTS + 1);
+
+	json_object_start(json, NULL);
+	json_str(json, "serial", disk->disk_info.serial);
+	json_int(json, "from", disk->latency_tick_ts - (time_t)oldest * DISK_TICK_SECS);
+	json_int(json, "to", disk->latency_tick_ts - (time_t)(newest - 1) * DISK_TICK_SECS);
+	json_uint(json, "step", step_entries * DISK_TICK_SECS);
+
+	json_array_start(json, "bounds");
+	for (i = 0; i < ARRAY_SIZE(latency_bucket_bounds); i++)
+		json_double(json, NULL, latency_bucket_bounds[i]);
+	json_array_end(json);
+
+	latency_range(&disk->latency, oldest, newest, &range);
+	json_object_start(json, "total");
+	latency_range_json(json, &range);
+	json_object_end(json);
+
+	json_array_start(json, "points");
+	for (age = oldest; age >= newest; age -= step_entries) {
+		latency_range(&disk->latency, age, MAX(age - step_entries + 1, newest), &range);
+
+		json_object_start(json, NULL);
+		json_int(json, "ts", disk->latency_tick_ts - (time_t)age * DISK_TICK_SECS);
+		latency_range_json(json, &range);
+		json_object_end(json);
+	}
+	json_array_end(json);
+
+	return json_object_end(json);
+}
+
+bool disk_smart_ok(disk_t *disk)
+{
 	switch (disk->disk_info.disk_type) {
 		case DISK_TYPE_ATA:
 			if (disk->disk_info.ata.smart_supported)
-				smart_ok = disk->disk_info.ata.smart_ok;
+				return disk->disk_info.ata.smart_ok;
 			break;
 
 		case DISK_TYPE_SAS:
-			smart_ok = disk->disk_info.sas.smart_asc == 0 && disk->disk_info.sas.smart_ascq == 0;
-			break;
+			return disk->disk_info.sas.smart_asc == 0 && disk->disk_info.sas.smart_ascq == 0;
 
 		case DISK_TYPE_UNKNOWN:
 			break;
 	}
 
-	buf_add_str(buf, len, ", \"smart_ok\": \"%s\"", json_bool(smart_ok));
+	return true;
+}
+
+int disk_json_fields(disk_t *disk, json_t *json)
+{
+	json_str(json, "dev", disk->sg_path);
+	json_str(json, "vendor", disk->disk_info.vendor);
+	json_str(json, "model", disk->disk_info.model);
+	json_str(json, "serial", disk->disk_info.serial);
+	json_str(json, "fw_rev", disk->disk_info.fw_rev);
+
+	// Kept as a string, that's what the clients always got
+	json_str(json, "smart_ok", disk_smart_ok(disk) ? "true" : "false");
+
+	// The current entry, the cached list is rendered again after each probe round
+	return latency_summary_json(json, &disk->latency.entries[disk->latency.cur_entry], "last_top_latency", "last_histogram");
+}
 
-	latency_summary_t *entry = &disk->latency.entries[disk->latency.cur_entry];
+int disk_json(disk_t *disk, json_t *json)
+{
+	json_object_start(json, NULL);
+	disk_json_fields(disk, json);
+	return json_object_end(json);
+}
+
+int disk_counters_json(disk_t *disk, json_t *json)
+{
+	int i;
+
+	json_object_start(json, NULL);
+	json_str(json, "serial", disk->disk_info.serial);
+
+	json_array_start(json, "smart_attributes");
+	for (i = 0; i < disk->num_smart_attrs; i++) {
+		smart_attr_t *attr = &disk->smart_attrs[i];
+
+		json_object_start(json, NULL);
+		json_uint(json, "id", attr->id);
+		json_uint(json, "flags", attr->flags);
+		json_uint(json, "value", attr->value);
+		json_uint(json, "worst", attr->worst);
+		json_uint(json, "threshold", attr->threshold);
+		json_uint(json, "raw", attr->raw);
+		json_object_end(json);
+	}
+	json_array_end(json);
+
+	// Series are given as their base value and the runs that follow it, all times are in seconds since the epoch
+	json_array_start(json, "series");
+	series_t *series;
+	for_each_series(&disk->series, series) {
+		if (series_empty(series))
+			continue;
+
+		json_object_start(json, NULL);
+		json_uint(json, "id", series->id);
+		json_uint(json, "start", (uint64_t)series->first_ts*60);
+		json_int(json, "value", series->first_val);
+		json_uint(json, "last_seen", (uint64_t)series->last_seen_ts*60);
+
+		series_run_t run;
+		unsigned offset = 0;
+		json_array_start(json, "runs");
+		while (series_next_run(series, &offset, &run)) {
+			json_array_start(json, NULL);
+			json_uint(json, NULL, run.count);
+			json_uint(json, NULL, (uint64_t)run.dt*60);
+			json_int(json, NULL, run.dv);
+			json_array_end(json);
+		}
+		json_array_end(json);
+		json_object_end(json);
+	}
+	json_array_end(json);
+
+	sas_log_t *log = &disk->sas_log;
+	if (log->pages_read) {
+		json_object_start(json, "sas_log");
+		json_uint(json, "ie_asc", log->ie_asc);
+		json_uint(json, "ie_ascq", log->ie_ascq);
+		json_uint(json, "temperature", log->temperature);
+		json_uint(json, "ref_temperature", log->ref_temperature);
+
+		static const struct { const char *name; size_t offset; } err_pages[] = {
+			{"write_errors", offsetof(sas_log_t, write_errors)},
+			{"read_errors", offsetof(sas_log_t, read_errors)},
+			{"verify_errors", offsetof(sas_log_t, verify_errors)},
+		};
+		for (i = 0; i < ARRAY_SIZE(err_pages); i++) {
+			sas_err_counters_t *counters = (sas_err_counters_t *)((char *)log + err_pages[i].offset);
+			int j;
+
+			json_array_start(json, err_pages[i].name);
+			for (j = 0; j < SAS_ERR_PARAM_COUNT; j++)
+				json_uint(json, NULL, counters->counter[j]);
+			json_array_end(json);
+		}
 
-	double *top_latencies = entry->top_latencies;
-	buf_add_str(buf, len, ", \"last_top_latency\": [%g,%g,%g,%g,%g]", top_latencies[0], top_latencies[1], top_latencies[2], top_latencies[3], top_latencies[4]);
+		json_uint(json, "non_medium_errors", log->non_medium_errors);
+		json_uint(json, "bms_status", log->bms_status);
+		json_uint(json, "bms_scans", log->bms_scans);
+		json_uint(json, "bms_medium_scans", log->bms_medium_scans);
+		json_uint(json, "bms_progress", log->bms_progress);
+		json_uint(json, "bms_results", log->bms_results);
+		json_uint(json, "read_cmds", log->read_cmds);
+		json_uint(json, "write_cmds", log->write_cmds);
+		json_uint(json, "read_proc_intervals", log->read_proc_intervals);
+		json_uint(json, "write_proc_intervals", log->write_proc_intervals);
+		json_uint(json, "workload_utilization", log->workload_utilization);
+		json_object_end(json);
+	}
 
-	buf_add_str(buf, len, ", \"last_histogram\": [%u,%u,%u,%u,%u,%u,%u]", entry->hist[0], entry->hist[1], entry->hist[2], entry->hist[3], entry->hist[4], entry->hist[5], entry->hist[6]);
+	if (disk->devstat.valid) {
+		json_object_start(json, "device_statistics");
+		for (i = 0; i < ATA_DEVSTAT_TRACKED_COUNT; i++) {
+			if (disk->devstat.valid & (1 << i))
+				json_int(json, ata_devstat_tracked[i].name, disk->devstat.value[i]);
+		}
+		json_object_end(json);
+	}
 
-	buf_add_char(buf, len, '}');
-	buf_add_char(buf, len, ' ');
+	return json_object_end(json);
+}
 
-	return orig_len - len;
+void disk_record_latency(disk_t *disk, latency_class_e latency_class, double msecs)
+{
+	// The heartbeats are the fine grained latency history, their class series is rolled up from it on each tick
+	if (latency_class == LATENCY_CLASS_HEARTBEAT)
+		latency_add_sample(&disk->latency, msecs);
+	else
+		latency_class_add_sample(&disk->class_latency[latency_class], msecs);
+	latency_totals_add(&disk->latency_totals[latency_class], msecs);
 }
 
-static bool sg_request_with_dir(disk_t *disk, unsigned char *cdb, int cdb_len, int xfer_dir)
+void disk_record_outcome(disk_t *disk, const sense_outcome_t *outcome)
 {
+	sense_stats_record(&disk->sense_stats, outcome, series_now());
+	disk->commands++;
+	if (!sense_outcome_ok(outcome))
+		disk->command_errors++;
+}
+
+int disk_sense_stats_json(disk_t *disk, json_t *json)
+{
+	sense_window_t *window;
+	int i;
+
+	json_object_start(json, NULL);
+	json_str(json, "serial", disk->disk_info.serial);
+	json_uint(json, "window", SENSE_STATS_WINDOW_MINUTES*60);
+
+	json_array_start(json, "windows");
+	for_each_sense_window(&disk->sense_stats, i, window) {
+		int j;
+
+		json_object_start(json, NULL);
+		json_uint(json, "start", (uint64_t)window->start_ts*60);
+		json_uint(json, "total", window->total);
+		json_uint(json, "overflow", window->overflow);
+
+		json_array_start(json, "outcomes");
+		for (j = 0; j < SENSE_STATS_SLOTS; j++) {
+			sense_count_t *count = &window->counts[j];
+			if (!count->used)
+				continue;
+
+			json_object_start(json, NULL);
+			sense_outcome_json(json, &count->outcome);
+			json_uint(json, "count", count->count);
+			json_uint(json, "last", (uint64_t)count->last_ts*60);
+			json_object_end(json);
+		}
+		json_array_end(json);
+		json_object_end(json);
+	}
+	json_array_end(json);
+
+	return json_object_end(json);
+}
+
+int disk_command_trace_json(disk_t *disk, json_t *json)
+{
+	json_object_start(json, NULL);
+	json_str(json, "serial", disk->disk_info.serial);
+	cmd_trace_json(&disk->trace, json);
+	return json_object_end(json);
+}
+
+void disk_command_trace_log(disk_t *disk)
+{
+	double now = monoclock_get();
+	cmd_trace_entry_t *entry;
+	uint32_t i;
+
+	// Each disk that dies gets its whole trace out, not only the first few lines a minute
+	if (disk->trace.count == 0)
+		return;
+
+	wire_log_unlimited(WLOG_NOTICE, "Disk %s: the last %u of %u commands", disk->disk_info.serial,
+			MIN(disk->trace.count, CMD_TRACE_ENTRIES), disk->trace.count);
+
+	for_each_cmd_trace(&disk->trace, i, entry) {
+		const sense_outcome_t *outcome = &entry->outcome;
+
+		if (entry->result != CMD_TRACE_DONE) {
+			wire_log_unlimited(WLOG_NOTICE, "Disk %s: cmd %u op=0x%02X sent %.3fs ago %s", disk->disk_info.serial,
+					i, entry->opcode, now - entry->submit_ts, cmd_trace_result_name(entry->result));
+		} else {
+			wire_log_unlimited(WLOG_NOTICE, "Disk %s: cmd %u op=0x%02X sent %.3fs ago took %.3fms (kernel %ums) status=0x%02X host=0x%02X driver=0x%02X sense=%02X/%02X/%02X",
+					disk->disk_info.serial, i, entry->opcode, now - entry->submit_ts,
+					cmd_trace_latency_msecs(entry), entry->kernel_msecs,
+					outcome->status, outcome->host_status, outcome->driver_status,
+					outcome->sense_key, outcome->asc, outcome->ascq);
+		}
+	}
+}
+
+int disk_latency_classes_json(disk_t *disk, json_t *json)
+{
+	int cls;
+
+	json_object_start(json, NULL);
+	json_str(json, "serial", disk->disk_info.serial);
+
+	// The last day of hourly summaries per command class, oldest first
+	for (cls = 0; cls < LATENCY_CLASS_COUNT; cls++) {
+		latency_class_series_t *series = &disk->class_latency[cls];
+		int num_entries = ARRAY_SIZE(series->entries);
+		int i;
+
+		json_array_start(json, latency_class_name(cls));
+		for (i = LATENCY_CLASS_JSON_ENTRIES-1; i >= 0; i--) {
+			json_object_start(json, NULL);
+			latency_summary_json(json, &series->entries[(series->cur_entry - i + num_entries) % num_entries], "top_latency", "histogram");
+			json_object_end(json);
+		}
+		json_array_end(json);
+	}
+
+	return json_object_end(json);
+}
+
+static bool sg_request_with_dir(disk_t *disk, latency_class_e latency_class, unsigned char *cdb, int cdb_len, int xfer_dir)
+{
+	self_task_e task = latency_class == LATENCY_CLASS_HEARTBEAT ? SELF_TASK_PROBE : SELF_TASK_MONITOR;
+	self_cpu_t cpu;
 	void *buf;
 	unsigned buf_len;
 
+	self_cpu_start(&cpu);
+
+	cmd_trace_entry_t *trace = cmd_trace_add(&disk->trace, cdb[0]);
+
 	if (xfer_dir == SG_DXFER_NONE) {
 		buf = NULL;
 		buf_len = 0;
@@ -89,34 +413,50 @@ static bool sg_request_with_dir(disk_t *disk, unsigned char *cdb, int cdb_len, i
 		buf_len = sizeof(disk->data_buf);
 	}
 
-	if (sg_request_submit(&disk->sg, &disk->request, cdb, cdb_len, xfer_dir, buf, buf_len, DEF_TIMEOUT) < 0) {
+	int ret = sg_request_submit(&disk->sg, &disk->request, cdb, cdb_len, xfer_dir, buf, buf_len, DEF_TIMEOUT);
+	self_cpu_stop(&cpu, task);
+	trace->submit_ts = disk->request.start;
+	if (ret < 0) {
+		trace->result = CMD_TRACE_SUBMIT_FAILED;
 		wire_log(WLOG_INFO, "Failed to submit request for disk");
+		disk->command_failures++;
 		return false;
 	}
 
-	if (sg_request_wait_response(&disk->sg, &disk->request) < 0) {
+	ret = sg_request_wait_response(&disk->sg, &disk->request);
+	self_cpu_start(&cpu);
+	if (ret < 0) {
+		trace->result = CMD_TRACE_LOST;
 		wire_log(WLOG_INFO, "Failed to read request for disk");
+		disk->command_failures++;
+		self_cpu_stop(&cpu, task);
 		return false;
 	}
 
-	/*
-	if (disk->request.hdr.status != 0) {
-		wire_log(WLOG_INFO, "Request failed, status=%d", disk->request.hdr.status);
-		return false;
-	}
-	*/
+	disk_record_latency(disk, latency_class, (disk->request.end - disk->request.start) * 1000.0);
+
+	// Failures are left for the caller to handle, some commands report their result in the sense data
+	sg_io_hdr_t *hdr = &disk->request.hdr;
+	sense_outcome_t outcome;
+	sense_outcome_classify(&outcome, hdr->status, hdr->host_status, hdr->driver_status, hdr->sbp, hdr->sb_len_wr);
+	disk_record_outcome(disk, &outcome);
+	trace->complete_ts = disk->request.end;
+	trace->kernel_msecs = hdr->duration;
+	trace->outcome = outcome;
+	trace->result = CMD_TRACE_DONE;
 
+	self_cpu_stop(&cpu, task);
 	return true;
 }
 
-static inline bool sg_request_nodata(disk_t *disk, unsigned char *cdb, int cdb_len)
+static inline bool sg_request_nodata(disk_t *disk, latency_class_e latency_class, unsigned char *cdb, int cdb_len)
 {
-	return sg_request_with_dir(disk, cdb, cdb_len, SG_DXFER_NONE);
+	return sg_request_with_dir(disk, latency_class, cdb, cdb_len, SG_DXFER_NONE);
 }
 
-static inline bool sg_request_data(disk_t *disk, unsigned char *cdb, int cdb_len)
+static inline bool sg_request_data(disk_t *disk, latency_class_e latency_class, unsigned char *cdb, int cdb_len)
 {
-	return sg_request_with_dir(disk, cdb, cdb_len, SG_DXFER_FROM_DEV);
+	return sg_request_with_dir(disk, latency_class, cdb, cdb_len, SG_DXFER_FROM_DEV);
 }
 
 static bool disk_do_tur(disk_t *disk)
@@ -129,7 +469,7 @@ static bool disk_do_tur(disk_t *disk)
 	else
 		cdb_len = cdb_tur(cdb);
 
-	bool alive = sg_request_nodata(disk, cdb, cdb_len);
+	bool alive = sg_request_nodata(disk, LATENCY_CLASS_HEARTBEAT, cdb, cdb_len);
 	if (!alive) {
 		wire_log(WLOG_NOTICE, "Disk %p died", disk);
 		return false;
@@ -138,11 +478,16 @@ static bool disk_do_tur(disk_t *disk)
 	}
 
 	sg_request_t *req = &disk->request;
-	double latency = req->end - req->start;
 
 	disk->last_reply_ts = req->end;
+	if (!disk->probed) {
+		disk->probed = 1;
+		startup_trace_mark("first probe", disk->sg_path);
+	}
 
-	latency_add_sample(&disk->latency, latency*1000.0);
+	shm_export_disk_update(disk, req->end);
+	self_stats_probe(req->syscalls);
+	self_stats_probe_delay(req->start - disk->tur_due, req->end - req->readable);
 	return true;
 }
 
@@ -151,7 +496,7 @@ static bool disk_ata_smart_result(disk_t *disk)
 	sg_request_t *req = &disk->request;
 	unsigned char cdb[32];
 	int cdb_len = cdb_ata_smart_return_status(cdb);
-	bool alive = sg_request_data(disk, cdb, cdb_len);
+	bool alive = sg_request_data(disk, LATENCY_CLASS_SMART, cdb, cdb_len);
 	wire_log(WLOG_INFO, "ATA SMART RETURN RESULT request sent, alive: %s", alive? "yes" : "no");
 	wire_log(WLOG_INFO, "Got ATA SMART RETURN RESULT reply in %f msecs (%d in sg)", 1000.0*(req->end-req->start), req->hdr.duration);
 	if (!alive)
@@ -171,30 +516,221 @@ static bool disk_ata_smart_result(disk_t *disk)
 	return true;
 }
 
+static bool disk_ata_smart_attributes(disk_t *disk)
+{
+	sg_request_t *req = &disk->request;
+	unsigned char cdb[32];
+	int cdb_len;
+	smart_attr_t attrs[SMART_MAX_ATTRS];
+
+	if (!disk->disk_info.ata.smart_supported)
+		return true;
+
+	cdb_len = cdb_ata_smart_read_data(cdb);
+	if (!sg_request_data(disk, LATENCY_CLASS_SMART, cdb, cdb_len))
+		return false;
+	wire_log(WLOG_INFO, "Got ATA SMART READ DATA reply in %f msecs (%d in sg)", 1000.0*(req->end-req->start), req->hdr.duration);
+	if (req->hdr.status != 0) {
+		wire_log(WLOG_INFO, "ATA SMART READ DATA failed, status=%d", req->hdr.status);
+		return true;
+	}
+
+	int num_attrs = smart_attr_parse_data((unsigned char *)disk->data_buf, sizeof(disk->data_buf) - req->hdr.resid, attrs, ARRAY_SIZE(attrs));
+	if (num_attrs < 0) {
+		wire_log(WLOG_INFO, "ATA SMART READ DATA returned an invalid sector");
+		return true;
+	}
+
+	cdb_len = cdb_ata_smart_read_threshold(cdb);
+	if (!sg_request_data(disk, LATENCY_CLASS_SMART, cdb, cdb_len))
+		return false;
+	if (req->hdr.status != 0 ||
+	    !smart_attr_parse_thresholds((unsigned char *)disk->data_buf, sizeof(disk->data_buf) - req->hdr.resid, attrs, num_attrs))
+	{
+		wire_log(WLOG_INFO, "ATA SMART READ THRESHOLDS failed, status=%d", req->hdr.status);
+	}
+
+	memcpy(disk->smart_attrs, attrs, sizeof(attrs[0]) * num_attrs);
+	disk->num_smart_attrs = num_attrs;
+
+	uint32_t now = series_now();
+	int i;
+	for (i = 0; i < num_attrs; i++) {
+		series_set_add(&disk->series, attrs[i].id, now, smart_attr_series_value(&attrs[i]));
+	}
+
+	return true;
+}
+
+/* Find out which log pages the disk supports, asking the disk only for a model we haven't seen yet */
+static bool disk_log_support(disk_t *disk)
+{
+	sg_request_t *req = &disk->request;
+	unsigned char cdb[32];
+	int cdb_len;
+	uint64_t pages;
+
+	if (disk->log_pages_known)
+		return true;
+
+	if (log_support_lookup(&disk->disk_info, &disk->log_pages)) {
+		disk->log_pages_known = 1;
+		return true;
+	}
+
+	if (disk->disk_info.disk_type == DISK_TYPE_ATA)
+		cdb_len = ata_devstat_cdb(cdb, ATA_DEVSTAT_PAGE_LIST);
+	else
+		cdb_len = cdb_log_sense(cdb, SAS_LOG_PAGE_SUPPORTED, 0, sizeof(disk->data_buf));
+
+	if (!sg_request_data(disk, LATENCY_CLASS_LOG_PAGE, cdb, cdb_len))
+		return false;
+
+	if (req->hdr.status != 0) {
+		wire_log(WLOG_INFO, "Supported log pages request failed, status=%d", req->hdr.status);
+		pages = 0;
+	} else if (disk->disk_info.disk_type == DISK_TYPE_ATA) {
+		pages = ata_devstat_parse_supported((unsigned char *)disk->data_buf, sizeof(disk->data_buf) - req->hdr.resid);
+	} else {
+		pages = sas_log_parse_supported((unsigned char *)disk->data_buf, sizeof(disk->data_buf) - req->hdr.resid);
+	}
+
+	if (pages == 0 && disk->disk_info.disk_type != DISK_TYPE_ATA) {
+		// Some disks don't list their pages, try them all and learn from failures
+		int i;
+		for (i = 0; i < sas_log_monitored_pages_count; i++)
+			pages |= 1ULL << sas_log_monitored_pages[i];
+	}
+
+	wire_log(WLOG_INFO, "Disk supports log pages 0x%016"PRIX64, pages);
+	log_support_store(&disk->disk_info, pages);
+	disk->log_pages = pages;
+	disk->log_pages_known = 1;
+	return true;
+}
+
+/* A page the disk rejected is not asked for again from any disk of the same model */
+static void disk_log_unsupported(disk_t *disk, uint8_t page)
+{
+	disk->log_pages &= ~(1ULL << page);
+	log_support_store(&disk->disk_info, disk->log_pages);
+}
+
+static bool disk_ata_devstat(disk_t *disk)
+{
+	sg_request_t *req = &disk->request;
+	unsigned char cdb[32];
+	uint8_t page;
+
+	uint64_t pages = disk->log_pages & ata_devstat_wanted_pages();
+	for (page = 1; page < 64; page++) {
+		if (!log_support_has(pages, page))
+			continue;
+
+		int cdb_len = ata_devstat_cdb(cdb, page);
+		if (!sg_request_data(disk, LATENCY_CLASS_LOG_PAGE, cdb, cdb_len))
+			return false;
+
+		if (req->hdr.status != 0) {
+			wire_log(WLOG_INFO, "Device statistics page 0x%02X failed, status=%d", page, req->hdr.status);
+			disk_log_unsupported(disk, page);
+			continue;
+		}
+
+		if (!ata_devstat_parse_page((unsigned char *)disk->data_buf, sizeof(disk->data_buf) - req->hdr.resid, &disk->devstat))
+			wire_log(WLOG_INFO, "Failed to parse device statistics page 0x%02X", page);
+	}
+
+	ata_devstat_update_series(&disk->devstat, &disk->series, series_now());
+	return true;
+}
+
+static bool disk_sas_log_pages(disk_t *disk)
+{
+	sg_request_t *req = &disk->request;
+	unsigned char cdb[32];
+	int i;
+
+	for (i = 0; i < sas_log_monitored_pages_count; i++) {
+		uint8_t page = sas_log_monitored_pages[i];
+		if (!log_support_has(disk->log_pages, page))
+			continue;
+
+		int cdb_len = cdb_log_sense(cdb, page, sas_log_subpage(page), sizeof(disk->data_buf));
+
+		if (!sg_request_data(disk, LATENCY_CLASS_LOG_PAGE, cdb, cdb_len))
+			return false;
+
+		if (req->hdr.status != 0) {
+			// Not all disks support all pages
+			wire_log(WLOG_DEBUG, "LOG SENSE page 0x%02X failed, status=%d", page, req->hdr.status);
+			disk_log_unsupported(disk, page);
+			continue;
+		}
+
+		if (!sas_log_parse((unsigned char *)disk->data_buf, sizeof(disk->data_buf) - req->hdr.resid, &disk->sas_log))
+			wire_log(WLOG_INFO, "Failed to parse LOG SENSE page 0x%02X", page);
+	}
+
+	if (sas_log_has_page(&disk->sas_log, SAS_LOG_PAGE_INFORMATIONAL_EXCEPTIONS)) {
+		disk->disk_info.sas.smart_asc = disk->sas_log.ie_asc;
+		disk->disk_info.sas.smart_ascq = disk->sas_log.ie_ascq;
+	}
+
+	sas_log_update_series(&disk->sas_log, &disk->series, series_now());
+	return true;
+}
+
 static bool disk_monitor(disk_t *disk)
 {
 	uint64_t now = monoclock_get_seconds();
 
-	wire_log(WLOG_INFO, "checking for monitoring last_monitor=%"PRIu64" now=%"PRIu64"", disk->last_monitor_ts, now);
+	wire_log(WLOG_DEBUG, "checking for monitoring last_monitor=%"PRIu64" now=%"PRIu64"", disk->last_monitor_ts, now);
 	if (disk->last_monitor_ts + MONITOR_INTERVAL_SEC < now) {
 		wire_log(WLOG_INFO, "Monitor initiated");
 		disk->last_monitor_ts = now;
+		if (!disk_log_support(disk))
+			return false;
+
 		if (disk->disk_info.disk_type == DISK_TYPE_ATA) {
-			return disk_ata_smart_result(disk);
-			//TODO: disk_ata_smart_attributes(disk);
+			if (!disk_ata_smart_result(disk))
+				return false;
+			if (!disk_ata_smart_attributes(disk))
+				return false;
+			return disk_ata_devstat(disk);
 		} else {
-			//TODO: disk_informational_exception(disk);
+			return disk_sas_log_pages(disk);
 		}
 	} else {
-		wire_log(WLOG_INFO, "Monitor skipped");
+		wire_log(WLOG_DEBUG, "Monitor skipped");
 	}
 	return true;
 }
 
 static bool disk_do_tick(disk_t *disk)
 {
+	self_cpu_t cpu;
+
+	self_cpu_start(&cpu);
+	latency_class_rollup(&disk->class_latency[LATENCY_CLASS_HEARTBEAT], &disk->latency.entries[disk->latency.cur_entry]);
 	latency_tick(&disk->latency);
-	return disk_monitor(disk);
+	disk->latency_tick_ts = time(NULL);
+
+	if (++disk->ticks % LATENCY_CLASS_TICKS == 0) {
+		int i;
+		for (i = 0; i < LATENCY_CLASS_COUNT; i++)
+			latency_class_tick(&disk->class_latency[i]);
+	}
+
+	self_cpu_stop(&cpu, SELF_TASK_TICK);
+
+	bool alive = disk_monitor(disk);
+
+	self_cpu_start(&cpu);
+	shm_export_disk_update(disk, 0);
+	disk->on_change(disk);
+	self_cpu_stop(&cpu, SELF_TASK_TICK);
+	return alive;
 }
 
 void disk_tick(disk_t *disk)
@@ -206,6 +742,9 @@ void disk_tick(disk_t *disk)
 
 void disk_tur(disk_t *disk)
 {
+	// A probe that is still pending keeps its original due time
+	if (!disk->request_tur)
+		disk->tur_due = monoclock_get();
 	disk->request_tur = 1;
 	if (disk->active)
 		wire_wait_resume(&disk->wait);
@@ -235,7 +774,7 @@ static void disk_wire(void *arg)
 	disk->active = 1;
 
 	while (disk->active) {
-		if (!disk->wait.triggered)
+		if (!disk->wait.triggered && !disk->request_tur && !disk->request_tick)
 			wire_list_wait(&wait_list);
 		wire_wait_reset(&disk->wait);
 
@@ -253,15 +792,21 @@ static void disk_wire(void *arg)
 	sg_close(&disk->sg);
 
 Exit:
+	shm_export_disk_update(disk, 0);
 	memset(disk->sg_path, 0, sizeof(disk->sg_path));
 	disk->on_death(disk);
 }
 
 bool disk_init(disk_t *disk, disk_info_t *disk_info, const char *dev, wire_pool_t *pool)
 {
-	memset(disk, 0, sizeof(*disk));
+	// Only reset the runtime state, the history is kept when a known disk is reattached
+	memset(disk, 0, offsetof(disk_t, disk_info));
 	strcpy(disk->sg_path, dev);
 	memcpy(&disk->disk_info, disk_info, sizeof(disk_info_t));
+	disk_latency_realign(disk, time(NULL));
+	// Probe as soon as the device is open rather than on the next round of the probe timer
+	disk->request_tur = 1;
+	disk->tur_due = monoclock_get();
 
 	char name[32];
 	snprintf(name, sizeof(name), "disk %s", disk->sg_path);
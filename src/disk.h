@@ -4,6 +4,13 @@
 #include "sg.h"
 #include "scsicmd.h"
 #include "latency.h"
+#include "series.h"
+#include "smart_attr.h"
+#include "sas_log.h"
+#include "ata_devstat.h"
+#include "sense_stats.h"
+#include "cmd_trace.h"
+#include "json.h"
 #include "util.h"
 #include "src/disk_def.h"
 #include "wire_pool.h"
@@ -11,6 +18,10 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <time.h>
+
+/* Every tick closes a latency entry */
+#define DISK_TICK_SECS (5*60)
 
 typedef struct disk_t {
 	wire_t *wire;
@@ -22,22 +33,61 @@ typedef struct disk_t {
 	unsigned active : 1;
 	unsigned request_tick : 1;
 	unsigned request_tur : 1;
+	unsigned log_pages_known : 1;
+	unsigned probed : 1; /* answered a probe since it was attached */
 
+	double tur_due; /* monoclock time the pending probe was asked for */
 	uint64_t last_ping_ts;
 	uint64_t last_reply_ts;
 	uint64_t last_monitor_ts;
+	unsigned ticks;
 
 	void (*on_death)(struct disk_t *disk);
+	void (*on_change)(struct disk_t *disk);
 
 	char data_buf[4096] __attribute__(( aligned(4096) ));
+	uint64_t log_pages;
+	sas_log_t sas_log;
+	ata_devstat_t devstat;
+
+	// Totals since the disk was attached
+	latency_totals_t latency_totals[LATENCY_CLASS_COUNT];
+	uint64_t commands;
+	uint64_t command_errors; /* completed with a bad status */
+	uint64_t command_failures; /* couldn't be submitted or completed */
+	cmd_trace_t trace; /* the last commands, kept after death until the disk is reattached */
+
+	struct shm_disk_record_t *shm; /* the shared memory export, NULL when off */
+
+	/* Everything below is history that is kept when a disk is reattached */
 	disk_info_t disk_info;
 	latency_t latency;
+	time_t latency_tick_ts; /* wall clock start of the current latency entry, 0 when unknown */
+	latency_class_series_t class_latency[LATENCY_CLASS_COUNT];
+	sense_stats_t sense_stats;
+	int num_smart_attrs;
+	smart_attr_t smart_attrs[SMART_MAX_ATTRS];
+	series_set_t series;
 } disk_t;
 
 bool disk_init(disk_t *disk, disk_info_t *disk_info, const char *dev, wire_pool_t *pool);
 void disk_stop(disk_t *disk);
 void disk_tick(disk_t *disk);
 void disk_tur(disk_t *disk);
-int disk_json(disk_t *disk, char *buf, int len);
+int disk_json(disk_t *disk, json_t *json);
+/* The members of disk_json() for callers that add their own */
+int disk_json_fields(disk_t *disk, json_t *json);
+bool disk_smart_ok(disk_t *disk);
+int disk_counters_json(disk_t *disk, json_t *json);
+int disk_latency_classes_json(disk_t *disk, json_t *json);
+int disk_command_trace_json(disk_t *disk, json_t *json);
+/* Write the command trace to the log, for when the disk is gone */
+void disk_command_trace_log(disk_t *disk);
+int disk_sense_stats_json(disk_t *disk, json_t *json);
+/* The latency history between two wall clock times merged into points of step seconds, 0 picks a step */
+int disk_latency_history_json(disk_t *disk, json_t *json, time_t from, time_t to, unsigned step);
+void disk_record_latency(disk_t *disk, latency_class_e latency_class, double msecs);
+/* Count a completed command and its outcome in the sense stats */
+void disk_record_outcome(disk_t *disk, const sense_outcome_t *outcome);
 
 #endif
@@ -1,21 +1,27 @@
 #include "disk_mgr.h"
 #include "disk.h"
+#include "disk_pb.h"
 #include "disk_scanner.h"
 #include "util.h"
 #include "system_id.h"
 #include "protocol.pb-c.h"
 #include "timer_bus.h"
+#include "shm_export.h"
+#include "startup_trace.h"
+#include "self_stats.h"
+#include "monoclock.h"
 
 #include "wire.h"
 #include "wire_fd.h"
 #include "wire_stack.h"
 #include "wire_wait.h"
-#include "wire_log.h"
+#include "logger.h"
 #include "wire_io.h"
 
 #include <arpa/inet.h>
 #include <sys/mman.h>
 #include <ctype.h>
+#include <errno.h>
 #include <glob.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,18 +30,40 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
 #include <fcntl.h>
+#include <time.h>
 
 #define MAX_DISKS 128
 #define MAX_SCAN_DISKS MAX_DISKS
+#define SCAN_CONCURRENCY 32
+#define SCAN_STACK_SIZE (32*1024) /* the scanner with its aligned data buffer lives on the stack */
+
+#define STATE_FILE_VERSION 3
 
 struct disk_state {
 	int prev;
 	int next;
+	// Entries ordered by their last change, the most recent at the tail
+	int change_prev;
+	int change_next;
+	uint64_t change_version;
 	bool died;
+	bool alive;
+	// Sort keys as of the last change, they must not move while the entry is in the sort index
+	bool indexed;
+	double top_latency;
+	double day_max_latency;
 	disk_t disk;
 };
 
+/* All the entries of the alive and dead lists, ordered by each of the sort keys */
+struct disk_sort_index {
+	int num;
+	int entries[DISK_SORT_COUNT][MAX_DISKS];
+};
+
 struct disk_mgr {
 	timer_bus_t timer_bus;
 	wire_wait_t wait_rescan;
@@ -44,13 +72,26 @@ struct disk_mgr {
 	wire_t task_five_min_timer;
 	wire_t task_stop;
 	wire_t task_dead_disk_reaper;
+	wire_t task_system_id;
+	wire_t task_save_reaper;
 	wire_pool_t wire_pool;
+	wire_pool_t scan_pool;
 
 	system_identifier_t system_id;
 	int active;
+	unsigned probe_interval; /* seconds between the TURs of a disk, 0 pauses them */
+	pid_t save_pid; /* of the child saving the state, 0 when none is running */
+	double save_start;
 	int alive_head;
 	int dead_head;
 	int first_unused_entry;
+	uint64_t data_version;
+	uint64_t list_version;
+	int change_head;
+	int change_tail;
+	uint64_t min_since_version; /* changes before it may have been lost by recycling an entry */
+	disk_event_cb_t event_cb;
+	struct disk_sort_index sort_index;
 	struct disk_state disk_list[MAX_DISKS];
 	char state_file_name[256];
 };
@@ -104,6 +145,168 @@ static void disk_list_append(int idx, int *new_head)
 	*disk_idx_ptr = idx;
 }
 
+static const char *sort_names[DISK_SORT_COUNT] = {
+	[DISK_SORT_SERIAL] = "serial",
+	[DISK_SORT_MODEL] = "model",
+	[DISK_SORT_DEV] = "dev",
+	[DISK_SORT_TOP_LATENCY] = "top_latency",
+	[DISK_SORT_DAY_MAX_LATENCY] = "day_max_latency",
+};
+
+static inline int double_cmp(double a, double b)
+{
+	return (a > b) - (a < b);
+}
+
+static int disk_sort_cmp(disk_sort_e key, int a, int b)
+{
+	struct disk_state *state_a = &mgr.disk_list[a];
+	struct disk_state *state_b = &mgr.disk_list[b];
+	int ret = 0;
+
+	switch (key) {
+		case DISK_SORT_SERIAL:
+			break;
+		case DISK_SORT_MODEL:
+			ret = strcmp(state_a->disk.disk_info.model, state_b->disk.disk_info.model);
+			break;
+		case DISK_SORT_DEV:
+			// sg2 before sg10
+			ret = strverscmp(state_a->disk.sg_path, state_b->disk.sg_path);
+			break;
+		case DISK_SORT_TOP_LATENCY:
+			ret = double_cmp(state_a->top_latency, state_b->top_latency);
+			break;
+		case DISK_SORT_DAY_MAX_LATENCY:
+			ret = double_cmp(state_a->day_max_latency, state_b->day_max_latency);
+			break;
+		case DISK_SORT_COUNT:
+			break;
+	}
+
+	// A total order so that pages don't overlap
+	if (ret == 0)
+		ret = strcmp(state_a->disk.disk_info.serial, state_b->disk.disk_info.serial);
+	if (ret == 0)
+		ret = a - b;
+	return ret;
+}
+
+static void disk_index_remove(int idx)
+{
+	struct disk_sort_index *index = &mgr.sort_index;
+	int key, i;
+
+	if (!mgr.disk_list[idx].indexed)
+		return;
+
+	// The dev changes on reattach before the entry is updated, a search by the keys might miss it
+	for (key = 0; key < DISK_SORT_COUNT; key++) {
+		for (i = 0; index->entries[key][i] != idx; i++)
+			;
+		memmove(&index->entries[key][i], &index->entries[key][i+1], (index->num - i - 1) * sizeof(int));
+	}
+
+	index->num--;
+	mgr.disk_list[idx].indexed = false;
+}
+
+/* Take the sort keys anew and put the entry in its place in every order */
+static void disk_index_update(int idx)
+{
+	struct disk_sort_index *index = &mgr.sort_index;
+	struct disk_state *entry = &mgr.disk_list[idx];
+	latency_t *latency = &entry->disk.latency;
+	int num_entries = ARRAY_SIZE(latency->entries);
+	latency_range_t range;
+	int key;
+
+	disk_index_remove(idx);
+
+	entry->top_latency = latency->entries[(latency->cur_entry + num_entries - 1) % num_entries].top_latencies[NUM_TOP_LATENCIES-1];
+	latency_range(latency, 24*60*60 / DISK_TICK_SECS, 1, &range);
+	entry->day_max_latency = range.max;
+
+	for (key = 0; key < DISK_SORT_COUNT; key++) {
+		int *order = index->entries[key];
+		int lo = 0, hi = index->num;
+
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if (disk_sort_cmp(key, order[mid], idx) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		memmove(&order[lo+1], &order[lo], (index->num - lo) * sizeof(int));
+		order[lo] = idx;
+	}
+
+	index->num++;
+	entry->indexed = true;
+}
+
+int disk_manager_sort_key(const char *name)
+{
+	int key;
+
+	for (key = 0; key < DISK_SORT_COUNT; key++) {
+		if (strcmp(sort_names[key], name) == 0)
+			return key;
+	}
+	return -1;
+}
+
+static bool disk_query_match(int idx, const disk_query_t *query)
+{
+	struct disk_state *entry = &mgr.disk_list[idx];
+	disk_info_t *disk_info = &entry->disk.disk_info;
+
+	if ((query->state == DISK_STATE_ALIVE && !entry->alive) || (query->state == DISK_STATE_DEAD && entry->alive))
+		return false;
+	if (query->smart_ok != -1 && disk_smart_ok(&entry->disk) != query->smart_ok)
+		return false;
+	if (query->vendor && !strcasestr(disk_info->vendor, query->vendor))
+		return false;
+	if (query->model && !strcasestr(disk_info->model, query->model))
+		return false;
+	if (query->fw_rev && !strcasestr(disk_info->fw_rev, query->fw_rev))
+		return false;
+	return true;
+}
+
+int disk_manager_disk_query_json(json_t *json, const disk_query_t *query)
+{
+	struct disk_sort_index *index = &mgr.sort_index;
+	int *order = index->entries[query->sort];
+	unsigned matches = 0;
+	int i;
+
+	json_object_start(json, NULL);
+	json_array_start(json, "disks");
+
+	// Walking the order stops being useful once the page is full, only the matches are still counted
+	for (i = 0; i < index->num; i++) {
+		int idx = order[query->descending ? index->num - 1 - i : i];
+		if (!disk_query_match(idx, query))
+			continue;
+
+		if (matches >= query->offset && (query->limit == 0 || matches < query->offset + query->limit)) {
+			json_object_start(json, NULL);
+			disk_json_fields(&mgr.disk_list[idx].disk, json);
+			json_bool(json, "alive", mgr.disk_list[idx].alive);
+			if (json_object_end(json) < 0)
+				return -1;
+		}
+		matches++;
+	}
+
+	json_array_end(json);
+	json_uint(json, "total", matches);
+	return json_object_end(json);
+}
+
 static int disk_list_get_unused(void)
 {
 	if (mgr.first_unused_entry < ARRAY_SIZE(mgr.disk_list)) {
@@ -112,39 +315,167 @@ static int disk_list_get_unused(void)
 
 	// No more never used entries, recycle old ones
 	int idx = mgr.dead_head;
-	if (idx != -1)
+	if (idx != -1) {
 		disk_list_remove(idx, &mgr.dead_head);
+		disk_index_remove(idx);
+		shm_export_release(idx);
+		// Its removal will not be reported anymore, older clients need to start over
+		if (mgr.disk_list[idx].change_version > mgr.min_since_version)
+			mgr.min_since_version = mgr.disk_list[idx].change_version;
+	}
 	return idx;
 }
 
-int disk_manager_disk_list_json(char *buf, int len)
+/* Stamp the entry with a new data version and move it to the tail of the change list */
+static void disk_changed(int idx, disk_event_e event)
+{
+	struct disk_state *entry = &mgr.disk_list[idx];
+
+	if (entry->change_version != 0) {
+		if (entry->change_prev != -1)
+			mgr.disk_list[entry->change_prev].change_next = entry->change_next;
+		else
+			mgr.change_head = entry->change_next;
+
+		if (entry->change_next != -1)
+			mgr.disk_list[entry->change_next].change_prev = entry->change_prev;
+		else
+			mgr.change_tail = entry->change_prev;
+	}
+
+	entry->change_prev = mgr.change_tail;
+	entry->change_next = -1;
+	if (mgr.change_tail != -1)
+		mgr.disk_list[mgr.change_tail].change_next = idx;
+	else
+		mgr.change_head = idx;
+	mgr.change_tail = idx;
+
+	entry->change_version = ++mgr.data_version;
+	mgr.list_version++;
+	disk_index_update(idx);
+
+	if (event != DISK_EVENT_NONE && mgr.event_cb)
+		mgr.event_cb(event, &entry->disk, entry->change_version);
+}
+
+void disk_manager_set_event_cb(disk_event_cb_t cb)
+{
+	mgr.event_cb = cb;
+}
+
+int disk_manager_for_each_disk(disk_visit_cb_t cb, void *arg)
 {
-	int orig_len = len;
 	int disk_idx;
-	bool first = true;
 
-	buf_add_char(buf, len, '[');
+	for_active_disks(disk_idx) {
+		int ret = cb(&mgr.disk_list[disk_idx].disk, arg);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
 
-	// TODO: Handle dead disks
+unsigned disk_manager_num_disks(void)
+{
+	unsigned count = 0;
+	int disk_idx;
+
+	for_active_disks(disk_idx)
+		count++;
+
+	return count;
+}
+
+int disk_manager_disk_list_json(json_t *json)
+{
+	int disk_idx;
+
+	json_array_start(json, NULL);
+
+	// Only the alive disks as it always was, the dead ones are there for a query
 	for_active_disks(disk_idx) {
-		if (!first)
-			buf_add_char(buf, len, ',');
-		else
-			first = false;
+		if (disk_json(&mgr.disk_list[disk_idx].disk, json) < 0)
+			return -1;
+	}
+
+	return json_array_end(json);
+}
+
+int disk_manager_disk_changes_json(json_t *json, uint64_t since)
+{
+	int disk_idx;
+	bool full = since < mgr.min_since_version || since > mgr.data_version;
+
+	json_object_start(json, NULL);
+	json_uint(json, "version", mgr.data_version);
+	json_bool(json, "full", full);
 
-		int written = disk_json(&mgr.disk_list[disk_idx].disk, buf, len);
-		if (written < 0)
+	if (full) {
+		// Unknown or too old a version, the client gets everything and replaces what it has
+		json_array_start(json, "disks");
+		for_active_disks(disk_idx) {
+			if (disk_json(&mgr.disk_list[disk_idx].disk, json) < 0)
+				return -1;
+		}
+		json_array_end(json);
+		json_array_start(json, "removed");
+		json_array_end(json);
+		return json_object_end(json);
+	}
+
+	// Walk back from the most recent change, only the changed entries are visited
+	json_array_start(json, "disks");
+	for (disk_idx = mgr.change_tail; disk_idx != -1 && mgr.disk_list[disk_idx].change_version > since; disk_idx = mgr.disk_list[disk_idx].change_prev) {
+		if (mgr.disk_list[disk_idx].alive && disk_json(&mgr.disk_list[disk_idx].disk, json) < 0)
 			return -1;
+	}
+	json_array_end(json);
 
-		buf += written;
-		len -= written;
+	json_array_start(json, "removed");
+	for (disk_idx = mgr.change_tail; disk_idx != -1 && mgr.disk_list[disk_idx].change_version > since; disk_idx = mgr.disk_list[disk_idx].change_prev) {
+		if (!mgr.disk_list[disk_idx].alive)
+			json_str(json, NULL, mgr.disk_list[disk_idx].disk.disk_info.serial);
 	}
+	json_array_end(json);
 
-	buf_add_char(buf, len, ']');
-	buf_add_char(buf, len, 0);
+	return json_object_end(json);
+}
 
-	// Return number of stored characters
-	return orig_len - len;
+static disk_t *disk_manager_find_serial(const char *serial)
+{
+	int disk_idx;
+
+	for_active_disks(disk_idx) {
+		if (strcmp(mgr.disk_list[disk_idx].disk.disk_info.serial, serial) == 0)
+			return &mgr.disk_list[disk_idx].disk;
+	}
+
+	for_dead_disks(disk_idx) {
+		if (strcmp(mgr.disk_list[disk_idx].disk.disk_info.serial, serial) == 0)
+			return &mgr.disk_list[disk_idx].disk;
+	}
+
+	return NULL;
+}
+
+int disk_manager_disk_visit(const char *serial, disk_visit_cb_t cb, void *arg)
+{
+	disk_t *disk = disk_manager_find_serial(serial);
+	if (!disk)
+		return DISK_MGR_NOT_FOUND;
+
+	return cb(disk, arg);
+}
+
+int disk_manager_disk_stream(const char *serial, disk_stream_cb_t cb, stream_t *stream)
+{
+	disk_t *disk = disk_manager_find_serial(serial);
+	if (!disk)
+		return DISK_MGR_NOT_FOUND;
+
+	return cb(disk, stream);
 }
 
 static void cleanup_dead_disks(struct disk_mgr *m)
@@ -169,6 +500,9 @@ static void cleanup_dead_disks(struct disk_mgr *m)
 
 			disk_list_remove(disk_idx, &m->alive_head);
 			disk_list_append(disk_idx, &m->dead_head);
+			m->disk_list[disk_idx].alive = false;
+			// The death was already announced
+			disk_changed(disk_idx, DISK_EVENT_NONE);
 		}
 	} while (found);
 	wire_log(WLOG_INFO, "Cleanup dead disks finished");
@@ -184,10 +518,28 @@ static void task_dead_disk_reaper(void *arg)
 	}
 }
 
+uint64_t disk_manager_data_version(void)
+{
+	return mgr.data_version;
+}
+
+uint64_t disk_manager_list_version(void)
+{
+	return mgr.list_version;
+}
+
+static void on_change(disk_t *disk)
+{
+	struct disk_state *state = container_of(disk, struct disk_state, disk);
+	disk_changed(state - mgr.disk_list, DISK_EVENT_UPDATE);
+}
+
 static void on_death(disk_t *disk)
 {
 	struct disk_state *state = container_of(disk, struct disk_state, disk);
+	disk_command_trace_log(disk);
 	state->died = true;
+	disk_changed(state - mgr.disk_list, DISK_EVENT_DEATH);
 	wire_log(WLOG_INFO, "Marking disk %p as dead for cleanup", disk);
 	wire_resume(&mgr.task_dead_disk_reaper);
 }
@@ -205,6 +557,15 @@ static bool disk_manager_is_active(const char *dev)
 	return false;
 }
 
+static void disk_record_scan_commands(disk_t *disk, disk_scanner_t *disk_scanner)
+{
+	int i;
+	for (i = 0; i < disk_scanner->num_commands; i++) {
+		disk_record_latency(disk, LATENCY_CLASS_SCAN, disk_scanner->latencies[i]);
+		disk_record_outcome(disk, &disk_scanner->outcomes[i]);
+	}
+}
+
 static void disk_mgr_scan_done(disk_scanner_t *disk_scanner)
 {
 	disk_info_t *new_disk_info = &disk_scanner->disk_info;
@@ -226,9 +587,14 @@ static void disk_mgr_scan_done(disk_scanner_t *disk_scanner)
 		{
             wire_log(WLOG_INFO, "Attaching to a previously seen disk");
 			disk_init(disk, new_disk_info, disk_scanner->sg_path, &mgr.wire_pool);
+			shm_export_disk_attach(disk, disk_idx);
+			disk_record_scan_commands(disk, disk_scanner);
 			disk->on_death = on_death;
+			disk->on_change = on_change;
 			disk_list_remove(disk_idx, &mgr.dead_head);
 			disk_list_append(disk_idx, &mgr.alive_head);
+			mgr.disk_list[disk_idx].alive = true;
+			disk_changed(disk_idx, DISK_EVENT_ATTACH);
 			return;
 		}
 	}
@@ -238,9 +604,16 @@ static void disk_mgr_scan_done(disk_scanner_t *disk_scanner)
 	if (new_disk_idx != -1) {
 		wire_log(WLOG_INFO, "Adding a new disk at idx=%d!", new_disk_idx);
 		disk_t *disk = &mgr.disk_list[new_disk_idx].disk;
+		// The entry may be recycled from an old dead disk, forget its history
+		memset(disk, 0, sizeof(*disk));
 		disk_init(disk, new_disk_info, disk_scanner->sg_path, &mgr.wire_pool);
+		shm_export_disk_attach(disk, new_disk_idx);
+		disk_record_scan_commands(disk, disk_scanner);
 		disk->on_death = on_death;
+		disk->on_change = on_change;
 		disk_list_append(new_disk_idx, &mgr.alive_head);
+		mgr.disk_list[new_disk_idx].alive = true;
+		disk_changed(new_disk_idx, DISK_EVENT_ATTACH);
 	} else {
 		wire_log(WLOG_INFO, "Want to add but no space!");
 	}
@@ -248,34 +621,14 @@ static void disk_mgr_scan_done(disk_scanner_t *disk_scanner)
 
 static bool disk_manager_save_disk_info(disk_info_t *disk_info, int fd)
 {
-    Disksurvey__DiskATA disk_ata_pb = DISKSURVEY__DISK_ATA__INIT;
-    Disksurvey__DiskSAS disk_sas_pb = DISKSURVEY__DISK_SAS__INIT;
-    Disksurvey__DiskInfo disk_info_pb = DISKSURVEY__DISK_INFO__INIT;
+    Disksurvey__DiskATA disk_ata_pb;
+    Disksurvey__DiskSAS disk_sas_pb;
+    Disksurvey__DiskInfo disk_info_pb;
     void *buf;
     uint32_t buf_size;
 
     // Fill the data
-    disk_info_pb.vendor = strdup(disk_info->vendor);
-    disk_info_pb.model = strdup(disk_info->model);
-    disk_info_pb.serial = strdup(disk_info->serial);
-    disk_info_pb.fw_rev = strdup(disk_info->fw_rev);
-    disk_info_pb.has_device_type = true;
-    disk_info_pb.device_type = disk_info->device_type;
-
-    switch (disk_info->disk_type) {
-        case DISK_TYPE_ATA:
-            disk_ata_pb.smart_supported = disk_info->ata.smart_supported;
-            disk_ata_pb.smart_ok = disk_info->ata.smart_ok;
-            disk_info_pb.ata = &disk_ata_pb;
-            break;
-        case DISK_TYPE_SAS:
-            disk_sas_pb.smart_asc = disk_info->sas.smart_asc;
-            disk_sas_pb.smart_ascq = disk_info->sas.smart_ascq;
-            disk_info_pb.sas = &disk_sas_pb;
-            break;
-        case DISK_TYPE_UNKNOWN:
-            break;
-    }
+    disk_info_to_pb(disk_info, &disk_info_pb, &disk_ata_pb, &disk_sas_pb);
 
     // Marshall it
     buf_size = disksurvey__disk_info__get_packed_size(&disk_info_pb);
@@ -300,26 +653,88 @@ static bool disk_manager_save_disk_info(disk_info_t *disk_info, int fd)
 	return true;
 }
 
-static bool disk_manager_save_disk_latency(latency_t *latency, int fd)
+/* Packs a message straight into the data file through a static chunk, the
+ * latency history of a disk alone is far larger than the stack of the child */
+struct pb_fd_buffer {
+    ProtobufCBuffer base;
+    int fd;
+    unsigned len;
+    bool failed;
+};
+
+static bool disk_manager_write_all(int fd, const void *data, size_t len)
 {
-    int i;
-    Disksurvey__LatencyEntry **entries_pb;
-    Disksurvey__Latency latency_pb = DISKSURVEY__LATENCY__INIT;
-    void *buf;
-    uint32_t buf_size;
+    while (len > 0) {
+        ssize_t ret = write(fd, data, len);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return false;
+        data = (const char *)data + ret;
+        len -= ret;
+    }
+    return true;
+}
 
+static uint8_t pb_fd_chunk[65536];
+
+static void pb_fd_flush(struct pb_fd_buffer *buf)
+{
+    if (!buf->failed && buf->len > 0 && !disk_manager_write_all(buf->fd, pb_fd_chunk, buf->len))
+        buf->failed = true;
+    buf->len = 0;
+}
+
+static void pb_fd_append(ProtobufCBuffer *buffer, size_t len, const uint8_t *data)
+{
+    struct pb_fd_buffer *buf = (struct pb_fd_buffer *)buffer;
+
+    while (len > 0) {
+        if (buf->len == sizeof(pb_fd_chunk))
+            pb_fd_flush(buf);
+        size_t part = MIN(len, sizeof(pb_fd_chunk) - buf->len);
+        memcpy(pb_fd_chunk + buf->len, data, part);
+        buf->len += part;
+        data += part;
+        len -= part;
+    }
+}
+
+/* The message is prefixed by its size in network order */
+static bool disk_manager_write_pb(int fd, const ProtobufCMessage *msg, const char *name)
+{
+    struct pb_fd_buffer buf = { { pb_fd_append }, fd, 0, false };
+    uint32_t buf_size_n = htonl(protobuf_c_message_get_packed_size(msg));
+
+    pb_fd_append(&buf.base, sizeof(buf_size_n), (const uint8_t *)&buf_size_n);
+    protobuf_c_message_pack_to_buffer(msg, &buf.base);
+    pb_fd_flush(&buf);
+    if (buf.failed) {
+        wire_log(WLOG_INFO, "Error writing to data file (%s): %m", name);
+        return false;
+    }
+    return true;
+}
+
+static bool disk_manager_save_disk_latency(latency_t *latency, time_t tick_ts, int fd)
+{
+    // Saving happens in the forked child on a small stack, keep the scratch space off it
+    static Disksurvey__LatencyEntry entries_pb[ARRAY_SIZE(((latency_t *)0)->entries)];
+    static Disksurvey__LatencyEntry *entries_pb_ptr[ARRAY_SIZE(((latency_t *)0)->entries)];
+    Disksurvey__Latency latency_pb = DISKSURVEY__LATENCY__INIT;
+    int i;
 
     // Fill the data
     latency_pb.current_entry = latency->cur_entry;
     latency_pb.has_current_entry = true;
+    latency_pb.current_entry_ts = tick_ts;
+    latency_pb.has_current_entry_ts = true;
     latency_pb.n_entries = ARRAY_SIZE(latency->entries);
-
-    entries_pb = calloc(latency_pb.n_entries, sizeof(Disksurvey__LatencyEntry*));
-    latency_pb.entries = entries_pb;
+    latency_pb.entries = entries_pb_ptr;
 
     for (i = 0; i < latency_pb.n_entries; i++) {
-        Disksurvey__LatencyEntry *entry = malloc(sizeof(Disksurvey__LatencyEntry));
-        entries_pb[i] = entry;
+        Disksurvey__LatencyEntry *entry = &entries_pb[i];
+        entries_pb_ptr[i] = entry;
 
         disksurvey__latency_entry__init(entry);
         entry->n_top_latencies = ARRAY_SIZE(latency->entries[0].top_latencies);
@@ -328,39 +743,151 @@ static bool disk_manager_save_disk_latency(latency_t *latency, int fd)
         entry->histogram = latency->entries[i].hist;
     }
 
-    // Marshall it
-    buf_size = disksurvey__latency__get_packed_size(&latency_pb);
-    buf = malloc(buf_size);
-    disksurvey__latency__pack(&latency_pb, buf);
+    return disk_manager_write_pb(fd, &latency_pb.base, "latency");
+}
 
-    // Write the size
-    uint32_t buf_size_n = htonl(buf_size);
-	ssize_t ret = write(fd, &buf_size_n, sizeof(buf_size_n));
-	if (ret != sizeof(buf_size_n)) {
-		wire_log(WLOG_INFO, "Error writing to data file buf_size: %m");
-		return false;
-	}
+static bool disk_manager_save_disk_counters(disk_t *disk, int fd)
+{
+    // Saving happens in the forked child on a small stack, keep the scratch space off it
+    static Disksurvey__SmartAttribute attrs_pb[SMART_MAX_ATTRS];
+    static Disksurvey__SmartAttribute *attrs_pb_ptr[SMART_MAX_ATTRS];
+    static Disksurvey__Series series_pb[SERIES_SET_SIZE];
+    static Disksurvey__Series *series_pb_ptr[SERIES_SET_SIZE];
+    static Disksurvey__LatencyClass classes_pb[LATENCY_CLASS_COUNT];
+    static Disksurvey__LatencyClass *classes_pb_ptr[LATENCY_CLASS_COUNT];
+    static Disksurvey__LatencyEntry class_entries_pb[LATENCY_CLASS_COUNT][LATENCY_CLASS_ENTRIES];
+    static Disksurvey__LatencyEntry *class_entries_pb_ptr[LATENCY_CLASS_COUNT][LATENCY_CLASS_ENTRIES];
+    static Disksurvey__SenseWindow windows_pb[SENSE_STATS_WINDOWS];
+    static Disksurvey__SenseWindow *windows_pb_ptr[SENSE_STATS_WINDOWS];
+    static Disksurvey__SenseCount sense_counts_pb[SENSE_STATS_WINDOWS][SENSE_STATS_SLOTS];
+    static Disksurvey__SenseCount *sense_counts_pb_ptr[SENSE_STATS_WINDOWS][SENSE_STATS_SLOTS];
+    Disksurvey__DiskCounters counters_pb = DISKSURVEY__DISK_COUNTERS__INIT;
+    int i;
 
-    // Write the data
-	ret = write(fd, buf, buf_size);
-	if (ret != buf_size) {
-		wire_log(WLOG_INFO, "Error writing to data file (latency): %m");
-		return false;
-	}
+    // Fill the data
+    for (i = 0; i < disk->num_smart_attrs; i++) {
+        smart_attr_t *attr = &disk->smart_attrs[i];
+        Disksurvey__SmartAttribute *attr_pb = &attrs_pb[i];
+
+        disksurvey__smart_attribute__init(attr_pb);
+        attr_pb->id = attr->id;
+        attr_pb->has_flags = true;
+        attr_pb->flags = attr->flags;
+        attr_pb->has_value = true;
+        attr_pb->value = attr->value;
+        attr_pb->has_worst = true;
+        attr_pb->worst = attr->worst;
+        attr_pb->has_threshold = true;
+        attr_pb->threshold = attr->threshold;
+        attr_pb->has_raw = true;
+        attr_pb->raw = attr->raw;
+        attrs_pb_ptr[i] = attr_pb;
+    }
+    counters_pb.n_smart_attributes = disk->num_smart_attrs;
+    counters_pb.smart_attributes = attrs_pb_ptr;
+
+    series_t *series;
+    int n_series = 0;
+    for_each_series(&disk->series, series) {
+        Disksurvey__Series *series_entry = &series_pb[n_series];
+
+        disksurvey__series__init(series_entry);
+        series_entry->id = series->id;
+        series_entry->first_ts = series->first_ts;
+        series_entry->first_value = series->first_val;
+        series_entry->last_ts = series->last_ts;
+        series_entry->last_value = series->last_val;
+        series_entry->last_seen_ts = series->last_seen_ts;
+        series_entry->last_rec_off = series->last_rec_off;
+        series_entry->has_data = true;
+        series_entry->data.len = series->len;
+        series_entry->data.data = series->data;
+        series_pb_ptr[n_series++] = series_entry;
+    }
+    counters_pb.n_series = n_series;
+    counters_pb.series = series_pb_ptr;
+
+    int cls;
+    for (cls = 0; cls < LATENCY_CLASS_COUNT; cls++) {
+        latency_class_series_t *class_latency = &disk->class_latency[cls];
+        Disksurvey__LatencyClass *class_pb = &classes_pb[cls];
+
+        disksurvey__latency_class__init(class_pb);
+        class_pb->latency_class = cls;
+        class_pb->has_current_entry = true;
+        class_pb->current_entry = class_latency->cur_entry;
+        class_pb->n_entries = LATENCY_CLASS_ENTRIES;
+        class_pb->entries = class_entries_pb_ptr[cls];
+
+        for (i = 0; i < LATENCY_CLASS_ENTRIES; i++) {
+            Disksurvey__LatencyEntry *entry = &class_entries_pb[cls][i];
+
+            disksurvey__latency_entry__init(entry);
+            entry->n_top_latencies = ARRAY_SIZE(class_latency->entries[0].top_latencies);
+            entry->top_latencies = class_latency->entries[i].top_latencies;
+            entry->n_histogram = ARRAY_SIZE(class_latency->entries[0].hist);
+            entry->histogram = class_latency->entries[i].hist;
+            class_entries_pb_ptr[cls][i] = entry;
+        }
+        classes_pb_ptr[cls] = class_pb;
+    }
+    counters_pb.n_latency_classes = LATENCY_CLASS_COUNT;
+    counters_pb.latency_classes = classes_pb_ptr;
+
+    // Windows are saved oldest first, the last one is the current window
+    sense_window_t *window;
+    int n_windows = 0;
+    for_each_sense_window(&disk->sense_stats, i, window) {
+        Disksurvey__SenseWindow *window_pb = &windows_pb[n_windows];
+        int j;
 
-	return true;
+        disksurvey__sense_window__init(window_pb);
+        window_pb->start_ts = window->start_ts;
+        window_pb->total = window->total;
+        window_pb->has_overflow = true;
+        window_pb->overflow = window->overflow;
+        window_pb->counts = sense_counts_pb_ptr[n_windows];
+
+        for (j = 0; j < SENSE_STATS_SLOTS; j++) {
+            sense_count_t *count = &window->counts[j];
+            if (!count->used)
+                continue;
+
+            Disksurvey__SenseCount *count_pb = &sense_counts_pb[n_windows][window_pb->n_counts];
+            disksurvey__sense_count__init(count_pb);
+            count_pb->status = count->outcome.status;
+            count_pb->host_status = count->outcome.host_status;
+            count_pb->driver_status = count->outcome.driver_status;
+            if (count->outcome.sense_key != SENSE_STATS_NO_SENSE) {
+                count_pb->has_sense_key = count_pb->has_asc = count_pb->has_ascq = true;
+                count_pb->sense_key = count->outcome.sense_key;
+                count_pb->asc = count->outcome.asc;
+                count_pb->ascq = count->outcome.ascq;
+            }
+            count_pb->count = count->count;
+            count_pb->last_ts = count->last_ts;
+            window_pb->counts[window_pb->n_counts++] = count_pb;
+        }
+        windows_pb_ptr[n_windows++] = window_pb;
+    }
+    counters_pb.n_sense_windows = n_windows;
+    counters_pb.sense_windows = windows_pb_ptr;
+
+    return disk_manager_write_pb(fd, &counters_pb.base, "counters");
 }
 
 static bool disk_manager_save_disk_state(disk_t *disk, int fd)
 {
     if (!disk_manager_save_disk_info(&disk->disk_info, fd))
         return false;
-    if (!disk_manager_save_disk_latency(&disk->latency, fd))
+    if (!disk_manager_save_disk_latency(&disk->latency, disk->latency_tick_ts, fd))
+        return false;
+    if (!disk_manager_save_disk_counters(disk, fd))
         return false;
     return true;
 }
 
-static void disk_manager_save_state_nofork(void)
+static bool disk_manager_save_state_nofork(void)
 {
 	int disk_idx;
 	bool error = true;
@@ -371,7 +898,7 @@ static void disk_manager_save_state_nofork(void)
 	snprintf(tmp_file_name, sizeof(tmp_file_name), "%s.XXXXXX", mgr.state_file_name);
 	int fd = mkstemp(tmp_file_name);
 
-	uint32_t version = htonl(2);
+	uint32_t version = htonl(STATE_FILE_VERSION);
 	ssize_t ret = write(fd, &version, sizeof(version));
 	if (ret != sizeof(version)) {
 		wire_log(WLOG_INFO, "Error writing to data file: %m");
@@ -406,6 +933,7 @@ Exit:
 		rename(tmp_file_name, mgr.state_file_name);
 	}
 	wire_log(WLOG_INFO, "Save state done, %s", error ? "with errors" : "successfully");
+	return !error;
 }
 
 /** To avoid any needless delays while writing the state to the disk and to
@@ -416,28 +944,122 @@ Exit:
  */
 void disk_manager_save_state(void)
 {
+	self_cpu_t cpu;
+
+	if (mgr.save_pid > 0) {
+		wire_log(WLOG_INFO, "The previous save is still running, skipping this one");
+		return;
+	}
+
 	wire_log(WLOG_INFO, "Forking to save state");
+	self_cpu_start(&cpu);
+	double start = monoclock_get();
 	pid_t pid = fork();
 	if (pid == 0) {
 		/* Child, saves information */
-		disk_manager_save_state_nofork();
-		_exit(0);
+		_exit(disk_manager_save_state_nofork() ? 0 : 1);
 	} else if (pid == -1) {
 		/* Parent, error */
+		self_cpu_stop(&cpu, SELF_TASK_SAVE);
 		wire_log(WLOG_INFO, "Error forking to save state: %m");
 	} else {
-		/* Parent, ok */
+		/* Parent, ok. The fork copies the page tables, it takes longer the more memory is resident */
+		self_cpu_stop(&cpu, SELF_TASK_SAVE);
+		mgr.save_pid = pid;
+		mgr.save_start = start;
+		self_stats_save_forked((monoclock_get() - start) * 1000.0);
+		wire_resume(&mgr.task_save_reaper);
+	}
+}
+
+/* Collect the saving child as it exits, it would be left a zombie otherwise */
+static void disk_manager_save_reap(struct disk_mgr *m)
+{
+	int status = 0;
+	int fd = -1;
+	pid_t ret;
+
+#ifdef SYS_pidfd_open
+	fd = syscall(SYS_pidfd_open, m->save_pid, 0);
+#endif
+	if (fd >= 0) {
+		wire_fd_state_t fd_state;
+
+		wire_fd_mode_init(&fd_state, fd);
+		wire_fd_mode_read(&fd_state);
+		wire_fd_wait(&fd_state);
+		wire_fd_mode_none(&fd_state);
+		close(fd);
+	}
+
+	// Without a pidfd (before Linux 5.3) poll for the exit
+	while ((ret = waitpid(m->save_pid, &status, WNOHANG)) == 0)
+		wire_fd_wait_msec(100);
+
+	bool ok = ret == m->save_pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+	self_stats_save_done((monoclock_get() - m->save_start) * 1000.0, ok);
+	m->save_pid = 0;
+}
+
+static void task_save_reaper(void *arg)
+{
+	struct disk_mgr *m = arg;
+
+	while (1) {
+		if (m->save_pid > 0)
+			disk_manager_save_reap(m);
+		wire_suspend();
+	}
+}
+
+/* The devices of a rescan, shared by the scan wires */
+struct scan_batch {
+	char *devs[MAX_SCAN_DISKS];
+	int num_devs;
+	int next;
+	int running;
+	wire_wait_t done;
+};
+
+static void task_scan(void *arg)
+{
+	struct scan_batch *batch = arg;
+	disk_scanner_t disk_scan;
+
+	// Each wire takes the next device until none are left, a slow device holds up only its own wire
+	while (batch->next < batch->num_devs) {
+		char *dev = batch->devs[batch->next++];
+
+		int span = startup_trace_begin("scan", dev);
+		bool success = disk_scanner_inquiry(&disk_scan, dev);
+		startup_trace_end(span);
+
+		if (!success) {
+			wire_log(WLOG_INFO, "Device: %s - Error while scanning device %s", dev, disk_scan.sg_path);
+		} else {
+			self_cpu_t cpu;
+			self_cpu_start(&cpu);
+			disk_mgr_scan_done(&disk_scan);
+			self_cpu_stop(&cpu, SELF_TASK_RESCAN);
+		}
 	}
+
+	if (--batch->running == 0)
+		wire_wait_resume(&batch->done);
 }
 
 void disk_manager_rescan_internal(struct disk_mgr *m)
 {
 	int ret;
 	glob_t globbuf = { 0, NULL, 0 };
+	struct scan_batch batch;
+	self_cpu_t cpu;
 
 	wire_log(WLOG_INFO, "Rescanning disks");
 
+	int span = startup_trace_begin("glob", NULL);
 	ret = wio_glob("/dev/sg*", GLOB_NOSORT, NULL, &globbuf);
+	startup_trace_end(span);
 	if (ret != 0) {
 		wire_log(WLOG_INFO, "Glob had an error finding scsi generic devices, ret=%d", ret);
 		return;
@@ -447,22 +1069,31 @@ void disk_manager_rescan_internal(struct disk_mgr *m)
 
 	int glob_idx;
 
-	for (glob_idx = 0; glob_idx < globbuf.gl_pathc; glob_idx++) {
+	self_cpu_start(&cpu);
+	batch.num_devs = 0;
+	for (glob_idx = 0; glob_idx < globbuf.gl_pathc && batch.num_devs < MAX_SCAN_DISKS; glob_idx++) {
 		char *dev = globbuf.gl_pathv[glob_idx];
 
 		if (disk_manager_is_active(dev)) {
-			wire_log(WLOG_INFO, "Device: %s - already known", dev);
+			wire_log(WLOG_DEBUG, "Device: %s - already known", dev);
 			continue;
 		}
 
-		disk_scanner_t disk_scan;
-		bool success = disk_scanner_inquiry(&disk_scan, dev);
-		if (!success) {
-			wire_log(WLOG_INFO, "Device: %s - Error while scanning device %s", dev, disk_scan.sg_path);
-		} else {
-			disk_mgr_scan_done(&disk_scan);
-		}
+		batch.devs[batch.num_devs++] = dev;
+	}
+	self_cpu_stop(&cpu, SELF_TASK_RESCAN);
+
+	// The inquiries wait on the devices, scan them side by side with this wire taking a share
+	batch.next = 0;
+	batch.running = 1;
+	wire_wait_init(&batch.done);
+	for (glob_idx = 1; glob_idx < SCAN_CONCURRENCY && glob_idx < batch.num_devs; glob_idx++) {
+		if (wire_pool_alloc(&mgr.scan_pool, "disk scan", task_scan, &batch))
+			batch.running++;
 	}
+	task_scan(&batch);
+	if (batch.running > 0)
+		wire_wait_single(&batch.done);
 
 	wio_globfree(&globbuf);
 }
@@ -493,12 +1124,18 @@ static void task_rescan(void *arg)
 static void task_tur(void *arg)
 {
 	struct disk_mgr *m = arg;
+	unsigned elapsed = 0;
 
 	while (timer_bus_sleep(&m->timer_bus, 1) >= 0) {
+		if (m->probe_interval == 0 || ++elapsed < m->probe_interval)
+			continue;
+		elapsed = 0;
+
 		int disk_idx;
 		for_active_disks(disk_idx) {
 			disk_tur(&mgr.disk_list[disk_idx].disk);
 		}
+		mgr.list_version++;
 	}
 }
 
@@ -506,7 +1143,7 @@ static void task_five_min_timer(void *arg)
 {
 	struct disk_mgr *m = arg;
 
-	while (timer_bus_sleep(&m->timer_bus, 5*60)) {
+	while (timer_bus_sleep(&m->timer_bus, DISK_TICK_SECS)) {
 		int disk_idx;
 		for_active_disks(disk_idx) {
 			disk_tick(&mgr.disk_list[disk_idx].disk);
@@ -519,11 +1156,13 @@ static void task_five_min_timer(void *arg)
 		// Save state after they did their work
 		disk_manager_save_state();
 
+		self_stats_tick();
+
 		disk_manager_rescan();
 	}
 }
 
-static bool disk_manager_load_latency(latency_t *latency, unsigned char *buf, uint32_t *offset, uint32_t buf_size)
+static bool disk_manager_load_latency(latency_t *latency, time_t *tick_ts, unsigned char *buf, uint32_t *offset, uint32_t buf_size)
 {
     Disksurvey__Latency *latency_pb = NULL;
     uint32_t item_size;
@@ -552,6 +1191,7 @@ static bool disk_manager_load_latency(latency_t *latency, unsigned char *buf, ui
         latency->cur_entry = latency_pb->current_entry;
     else
         latency->cur_entry = 0;
+    *tick_ts = latency_pb->has_current_entry_ts ? latency_pb->current_entry_ts : 0;
 
     int k;
     for (k = 0; k < latency_pb->n_entries; k++) {
@@ -573,10 +1213,125 @@ static bool disk_manager_load_latency(latency_t *latency, unsigned char *buf, ui
         }
     }
 
+    latency_reindex(latency);
     disksurvey__latency__free_unpacked(latency_pb, NULL);
     return true;
 }
 
+static bool disk_manager_load_counters(disk_t *disk, unsigned char *buf, uint32_t *offset, uint32_t buf_size)
+{
+    Disksurvey__DiskCounters *counters_pb = NULL;
+    uint32_t item_size;
+
+    /* Read the counters part */
+    if (*offset+4 > buf_size) {
+        wire_log(WLOG_INFO, "Not enough data in the file to read the counters size, offset=%u size=%u", *offset, buf_size);
+        return false;
+    }
+
+    item_size = ntohl(*(uint32_t*)(buf + *offset));
+    *offset += 4;
+    if (*offset + item_size > buf_size) {
+        wire_log(WLOG_INFO, "Not enough data in the file to finish reading, offset=%u item_size=%u size=%u", *offset, item_size, buf_size);
+        return false;
+    }
+    counters_pb = disksurvey__disk_counters__unpack(NULL, item_size, buf + *offset);
+    if (!counters_pb) {
+        wire_log(WLOG_INFO, "Failed to unpack disk survey counters data");
+        return false;
+    }
+    *offset += item_size;
+
+    // convert the counters part
+    int k;
+    int n_attrs = counters_pb->n_smart_attributes;
+    if (n_attrs > ARRAY_SIZE(disk->smart_attrs))
+        n_attrs = ARRAY_SIZE(disk->smart_attrs);
+    for (k = 0; k < n_attrs; k++) {
+        Disksurvey__SmartAttribute *attr_pb = counters_pb->smart_attributes[k];
+        smart_attr_t *attr = &disk->smart_attrs[k];
+
+        attr->id = attr_pb->id;
+        attr->flags = attr_pb->flags;
+        attr->value = attr_pb->value;
+        attr->worst = attr_pb->worst;
+        attr->threshold = attr_pb->threshold;
+        attr->raw = attr_pb->raw;
+    }
+    disk->num_smart_attrs = n_attrs;
+
+    for (k = 0; k < counters_pb->n_series; k++) {
+        Disksurvey__Series *series_pb = counters_pb->series[k];
+        series_t *series = series_set_get(&disk->series, series_pb->id);
+        if (!series || series_pb->data.len > sizeof(series->data))
+            continue;
+
+        series->first_ts = series_pb->first_ts;
+        series->first_val = series_pb->first_value;
+        series->last_ts = series_pb->last_ts;
+        series->last_val = series_pb->last_value;
+        series->last_seen_ts = series_pb->last_seen_ts;
+        series->last_rec_off = series_pb->last_rec_off;
+        series->len = series_pb->data.len;
+        memcpy(series->data, series_pb->data.data, series_pb->data.len);
+    }
+
+    for (k = 0; k < counters_pb->n_latency_classes; k++) {
+        Disksurvey__LatencyClass *class_pb = counters_pb->latency_classes[k];
+        if (class_pb->latency_class >= LATENCY_CLASS_COUNT)
+            continue;
+
+        latency_class_series_t *class_latency = &disk->class_latency[class_pb->latency_class];
+        int n_entries = class_pb->n_entries;
+        if (n_entries > ARRAY_SIZE(class_latency->entries))
+            n_entries = ARRAY_SIZE(class_latency->entries);
+        if (class_pb->has_current_entry && class_pb->current_entry < ARRAY_SIZE(class_latency->entries))
+            class_latency->cur_entry = class_pb->current_entry;
+
+        int i;
+        for (i = 0; i < n_entries; i++) {
+            Disksurvey__LatencyEntry *entry = class_pb->entries[i];
+            int j;
+
+            for (j = 0; j < entry->n_top_latencies && j < ARRAY_SIZE(class_latency->entries[0].top_latencies); j++)
+                class_latency->entries[i].top_latencies[j] = entry->top_latencies[j];
+            for (j = 0; j < entry->n_histogram && j < ARRAY_SIZE(class_latency->entries[0].hist); j++)
+                class_latency->entries[i].hist[j] = entry->histogram[j];
+        }
+    }
+
+    int n_windows = counters_pb->n_sense_windows;
+    if (n_windows > SENSE_STATS_WINDOWS)
+        n_windows = SENSE_STATS_WINDOWS;
+    for (k = 0; k < n_windows; k++) {
+        Disksurvey__SenseWindow *window_pb = counters_pb->sense_windows[counters_pb->n_sense_windows - n_windows + k];
+        sense_window_t *window = &disk->sense_stats.windows[k];
+        int j;
+
+        window->start_ts = window_pb->start_ts;
+        window->total = window_pb->total;
+        window->overflow = window_pb->overflow;
+        for (j = 0; j < window_pb->n_counts; j++) {
+            Disksurvey__SenseCount *count_pb = window_pb->counts[j];
+            sense_outcome_t outcome = {
+                .status = count_pb->status,
+                .host_status = count_pb->host_status,
+                .driver_status = count_pb->driver_status,
+                .sense_key = count_pb->has_sense_key ? count_pb->sense_key : SENSE_STATS_NO_SENSE,
+                .asc = count_pb->asc,
+                .ascq = count_pb->ascq,
+            };
+            if (!sense_stats_restore(window, &outcome, count_pb->count, count_pb->last_ts))
+                window->overflow += count_pb->count;
+        }
+    }
+    if (n_windows > 0)
+        disk->sense_stats.cur_window = n_windows - 1;
+
+    disksurvey__disk_counters__free_unpacked(counters_pb, NULL);
+    return true;
+}
+
 static bool disk_manager_load_disk_info(disk_info_t *disk_info, unsigned char *buf, uint32_t *offset, uint32_t buf_size)
 {
     bool bad_disk = false;
@@ -652,8 +1407,8 @@ static void disk_manager_load_fd(int fd)
     }
 
 	uint32_t version = ntohl(*(uint32_t*)buf);
-	if (version != 2) {
-		wire_log(WLOG_INFO, "Unknown version of state file, got: %d expected: %d", version, 1);
+	if (version < 2 || version > STATE_FILE_VERSION) {
+		wire_log(WLOG_INFO, "Unknown version of state file, got: %d expected: %d", version, STATE_FILE_VERSION);
 		goto Exit;
 	}
 
@@ -662,23 +1417,34 @@ static void disk_manager_load_fd(int fd)
     uint32_t offset = sizeof(version);
 	int i;
 	for (i = 0; i < MAX_DISKS && offset < statbuf.st_size; i++) {
-		disk_info_t *disk_info = &mgr.disk_list[i].disk.disk_info;
-		latency_t *latency = &mgr.disk_list[i].disk.latency;
+		disk_t *disk = &mgr.disk_list[i].disk;
+		disk_info_t *disk_info = &disk->disk_info;
+		latency_t *latency = &disk->latency;
 
         if (!disk_manager_load_disk_info(disk_info, buf, &offset, statbuf.st_size)) {
 			memset(disk_info, 0, sizeof(*disk_info));
             goto Exit;
 		}
 
-        if (!disk_manager_load_latency(latency, buf, &offset, statbuf.st_size)) {
+        if (!disk_manager_load_latency(latency, &disk->latency_tick_ts, buf, &offset, statbuf.st_size)) {
 			memset(disk_info, 0, sizeof(*disk_info));
 			memset(latency, 0, sizeof(*latency));
             goto Exit;
 		}
+		// Older files don't have the tick time, the time of the save is the nearest guess
+		if (!disk->latency_tick_ts)
+			disk->latency_tick_ts = statbuf.st_mtime;
 
-        /* Both parts loaded, add the disk */
+        // Version 2 files predate the counters
+        if (version >= 3 && !disk_manager_load_counters(disk, buf, &offset, statbuf.st_size)) {
+			memset(disk, 0, sizeof(*disk));
+            goto Exit;
+		}
+
+        /* All parts loaded, add the disk */
 		wire_log(WLOG_INFO, "Loaded disk data");
 		disk_list_append(i, &mgr.dead_head);
+		disk_index_update(i);
 		mgr.first_unused_entry = i+1;
 	}
 
@@ -699,21 +1465,55 @@ static void disk_manager_load(void)
 	wio_close(fd);
 }
 
+static void task_system_id(void *arg)
+{
+	struct disk_mgr *m = arg;
+
+	int span = startup_trace_begin("system id", NULL);
+	system_identifier_read(&m->system_id);
+	startup_trace_end(span);
+}
+
 static void disk_manager_init_wire(void *arg)
 {
 	UNUSED(arg);
 
+	// The system id is not needed for the disks, it is read while the state loads
+	wire_init(&mgr.task_system_id, "system id", task_system_id, &mgr, WIRE_STACK_ALLOC(16*1024));
+
+	int span = startup_trace_begin("state load", NULL);
 	disk_manager_load();
-	system_identifier_read(&mgr.system_id);
+	startup_trace_end(span);
 
 	timer_bus_init(&mgr.timer_bus, 1000);
+	self_stats_timer_bus("disk manager", &mgr.timer_bus);
 	wire_init(&mgr.task_rescan, "disk rescan", task_rescan, &mgr, WIRE_STACK_ALLOC(64*1024));
 	wire_init(&mgr.task_tur, "tur timer", task_tur, &mgr, WIRE_STACK_ALLOC(4096));
 	wire_init(&mgr.task_five_min_timer, "five min timer", task_five_min_timer, &mgr, WIRE_STACK_ALLOC(4096));
 	wire_init(&mgr.task_dead_disk_reaper, "dead disk reaper", task_dead_disk_reaper, &mgr, WIRE_STACK_ALLOC(4096));
 }
 
-void disk_manager_init(void)
+/* The part of a disk slot that holds its latency history, all of it is touched once the slot is used */
+#define DISK_HISTORY_SIZE (sizeof(latency_t) + sizeof(((disk_t *)0)->class_latency) + sizeof(((disk_t *)0)->latency_totals))
+
+static void disk_manager_latency_memory(self_mem_t *mem)
+{
+	mem->reserved = MAX_DISKS * DISK_HISTORY_SIZE;
+	mem->resident = mgr.first_unused_entry * DISK_HISTORY_SIZE;
+}
+
+static void disk_manager_slots_memory(self_mem_t *mem)
+{
+	self_mem_t history;
+	disk_manager_latency_memory(&history);
+
+	size_t resident = self_stats_resident(mgr.disk_list, sizeof(mgr.disk_list)) +
+		self_stats_resident(&mgr.sort_index, sizeof(mgr.sort_index));
+	mem->reserved = sizeof(mgr.disk_list) + sizeof(mgr.sort_index) - history.reserved;
+	mem->resident = resident > history.resident ? resident - history.resident : 0;
+}
+
+static void disk_manager_init_mgr(void)
 {
 	// Initialize the disk list
 	mgr.first_unused_entry = 0;
@@ -721,11 +1521,28 @@ void disk_manager_init(void)
 	// Initialize the heads
 	mgr.alive_head = -1;
 	mgr.dead_head = -1;
+	mgr.change_head = -1;
+	mgr.change_tail = -1;
+
+	// Versions keep growing across restarts so a client can't mistake an old version for a current one
+	mgr.data_version = (uint64_t)time(NULL) << 20;
+	mgr.min_since_version = mgr.data_version;
+	mgr.list_version = mgr.data_version;
 
 	snprintf(mgr.state_file_name, sizeof(mgr.state_file_name), "./disksurvey.dat");
 	mgr.active = 1;
+	mgr.probe_interval = 1;
+}
 
+void disk_manager_init(void)
+{
+	disk_manager_init_mgr();
+	self_stats_memory("disk_slots", disk_manager_slots_memory);
+	self_stats_memory("latency_history", disk_manager_latency_memory);
+	shm_export_init(MAX_DISKS);
+	wire_init(&mgr.task_save_reaper, "save reaper", task_save_reaper, &mgr, WIRE_STACK_ALLOC(4096));
 	wire_pool_init(&mgr.wire_pool, NULL, MAX_DISKS, 4096);
+	wire_pool_init(&mgr.scan_pool, NULL, SCAN_CONCURRENCY, SCAN_STACK_SIZE);
 	wire_pool_alloc(&mgr.wire_pool, "disk mgr init", disk_manager_init_wire, NULL);
 }
 
@@ -749,6 +1566,7 @@ static void stop_task(void *arg)
 	}
 
 	wire_log(WLOG_INFO, "No more live disks, stopping");
+	shm_export_close();
 	disk_manager_save_state_nofork();
 }
 
@@ -763,3 +1581,14 @@ void disk_manager_stop(void)
 	// Now monitor the disks until they can all be stopped
 	wire_init(&mgr.task_stop, "stopper", stop_task, &mgr, WIRE_STACK_ALLOC(4096));
 }
+
+void disk_manager_set_probe_interval(unsigned secs)
+{
+	wire_log(WLOG_INFO, "Probe interval set to %u seconds%s", secs, secs ? "" : " (paused)");
+	mgr.probe_interval = secs;
+}
+
+unsigned disk_manager_probe_interval(void)
+{
+	return mgr.probe_interval;
+}
@@ -1,10 +1,78 @@
 #ifndef DISKSURVEY_MGR_H
 #define DISKSURVEY_MGR_H
 
+#include "json.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
 void disk_manager_init(void);
 void disk_manager_rescan(void);
-int disk_manager_disk_list_json(char *buf, int len);
+#define DISK_MGR_NOT_FOUND -2
+
+/* Bumped on every change of a disk, the changes since a version are listed by it */
+uint64_t disk_manager_data_version(void);
+/* Bumped on every change and every probe round, the list shows the latency bucket the probes fill */
+uint64_t disk_manager_list_version(void);
+int disk_manager_disk_list_json(json_t *json);
+/* The disks that changed and the serials of those removed after the given data version */
+int disk_manager_disk_changes_json(json_t *json, uint64_t since);
+
+typedef enum disk_sort_e {
+	DISK_SORT_SERIAL,
+	DISK_SORT_MODEL,
+	DISK_SORT_DEV,
+	DISK_SORT_TOP_LATENCY, /* highest latency of the last closed interval */
+	DISK_SORT_DAY_MAX_LATENCY, /* highest latency of the last day */
+	DISK_SORT_COUNT,
+} disk_sort_e;
+
+typedef enum disk_state_filter_e {
+	DISK_STATE_ALIVE,
+	DISK_STATE_DEAD,
+	DISK_STATE_ALL,
+} disk_state_filter_e;
+
+typedef struct disk_query_t {
+	const char *vendor; /* case insensitive substrings, NULL matches everything */
+	const char *model;
+	const char *fw_rev;
+	int smart_ok; /* -1 for either */
+	disk_state_filter_e state;
+	disk_sort_e sort;
+	bool descending;
+	unsigned offset;
+	unsigned limit; /* 0 for no limit */
+} disk_query_t;
+
+/* Returns the key for a sort name or -1 if there is none */
+int disk_manager_sort_key(const char *name);
+/* A page of the disks that match, in sort order, along with the number of all the matches */
+int disk_manager_disk_query_json(json_t *json, const disk_query_t *query);
+struct disk_t;
+typedef int (*disk_json_cb_t)(struct disk_t *disk, json_t *json);
+typedef int (*disk_stream_cb_t)(struct disk_t *disk, stream_t *stream);
+
+typedef enum disk_event_e {
+	DISK_EVENT_NONE,
+	DISK_EVENT_ATTACH,
+	DISK_EVENT_UPDATE, /* a latency bucket closed, SMART state may have changed with it */
+	DISK_EVENT_DEATH,
+} disk_event_e;
+
+/* Called from the wire that caused the change, it must not block */
+typedef void (*disk_event_cb_t)(disk_event_e event, struct disk_t *disk, uint64_t version);
+void disk_manager_set_event_cb(disk_event_cb_t cb);
+int disk_manager_disk_stream(const char *serial, disk_stream_cb_t cb, stream_t *stream);
+/* Visit all the active disks, stops early when the callback returns a negative value which is then returned */
+typedef int (*disk_visit_cb_t)(struct disk_t *disk, void *arg);
+int disk_manager_for_each_disk(disk_visit_cb_t cb, void *arg);
+int disk_manager_disk_visit(const char *serial, disk_visit_cb_t cb, void *arg);
+unsigned disk_manager_num_disks(void);
 void disk_manager_stop(void);
+/* Seconds between the liveness probes (TUR) of the disks, 0 pauses the probing */
+void disk_manager_set_probe_interval(unsigned secs);
+unsigned disk_manager_probe_interval(void);
 void disk_manager_save_state(void);
 
 #endif
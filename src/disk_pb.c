@@ -0,0 +1,120 @@
+#include "disk_pb.h"
+#include "util.h"
+
+#include <stdint.h>
+
+struct pb_stream_buffer {
+	ProtobufCBuffer base;
+	stream_t *stream;
+};
+
+static void pb_stream_append(ProtobufCBuffer *buffer, size_t len, const uint8_t *data)
+{
+	struct pb_stream_buffer *buf = (struct pb_stream_buffer *)buffer;
+	stream_write(buf->stream, (const char *)data, len);
+}
+
+void disk_info_to_pb(disk_info_t *disk_info, Disksurvey__DiskInfo *disk_info_pb,
+                     Disksurvey__DiskATA *disk_ata_pb, Disksurvey__DiskSAS *disk_sas_pb)
+{
+	disksurvey__disk_info__init(disk_info_pb);
+	disk_info_pb->vendor = disk_info->vendor;
+	disk_info_pb->model = disk_info->model;
+	disk_info_pb->serial = disk_info->serial;
+	disk_info_pb->fw_rev = disk_info->fw_rev;
+	disk_info_pb->has_device_type = true;
+	disk_info_pb->device_type = disk_info->device_type;
+
+	switch (disk_info->disk_type) {
+		case DISK_TYPE_ATA:
+			disksurvey__disk_ata__init(disk_ata_pb);
+			disk_ata_pb->smart_supported = disk_info->ata.smart_supported;
+			disk_ata_pb->smart_ok = disk_info->ata.smart_ok;
+			disk_info_pb->ata = disk_ata_pb;
+			break;
+		case DISK_TYPE_SAS:
+			disksurvey__disk_sas__init(disk_sas_pb);
+			disk_sas_pb->smart_asc = disk_info->sas.smart_asc;
+			disk_sas_pb->smart_ascq = disk_info->sas.smart_ascq;
+			disk_info_pb->sas = disk_sas_pb;
+			break;
+		case DISK_TYPE_UNKNOWN:
+			break;
+	}
+}
+
+static void latency_entry_to_pb(latency_summary_t *entry, Disksurvey__LatencyEntry *entry_pb)
+{
+	disksurvey__latency_entry__init(entry_pb);
+	entry_pb->n_top_latencies = ARRAY_SIZE(entry->top_latencies);
+	entry_pb->top_latencies = entry->top_latencies;
+	entry_pb->n_histogram = ARRAY_SIZE(entry->hist);
+	entry_pb->histogram = entry->hist;
+}
+
+int pb_write_delimited(stream_t *stream, const ProtobufCMessage *msg)
+{
+	struct pb_stream_buffer buf = { { pb_stream_append }, stream };
+	uint8_t varint[10];
+	int varint_len = 0;
+
+	size_t len = protobuf_c_message_get_packed_size(msg);
+	do {
+		varint[varint_len++] = (len & 0x7F) | (len > 0x7F ? 0x80 : 0);
+		len >>= 7;
+	} while (len > 0);
+
+	stream_write(stream, (const char *)varint, varint_len);
+	protobuf_c_message_pack_to_buffer(msg, &buf.base);
+
+	return stream->failed ? -1 : 0;
+}
+
+int disk_status_pb(disk_t *disk, stream_t *stream)
+{
+	Disksurvey__DiskStatus status_pb = DISKSURVEY__DISK_STATUS__INIT;
+	Disksurvey__DiskInfo disk_info_pb;
+	Disksurvey__DiskATA disk_ata_pb;
+	Disksurvey__DiskSAS disk_sas_pb;
+	Disksurvey__LatencyEntry entry_pb;
+
+	disk_info_to_pb(&disk->disk_info, &disk_info_pb, &disk_ata_pb, &disk_sas_pb);
+	status_pb.info = &disk_info_pb;
+	status_pb.dev = disk->sg_path;
+	status_pb.has_smart_ok = true;
+	status_pb.smart_ok = disk_smart_ok(disk);
+
+	// The current entry, same as disk_json()
+	latency_entry_to_pb(&disk->latency.entries[disk->latency.cur_entry], &entry_pb);
+	status_pb.last_latency = &entry_pb;
+
+	return pb_write_delimited(stream, &status_pb.base);
+}
+
+int disk_latency_classes_pb(disk_t *disk, stream_t *stream)
+{
+	static Disksurvey__LatencyEntry entries_pb[LATENCY_CLASS_ENTRIES];
+	static Disksurvey__LatencyEntry *entries_pb_ptr[LATENCY_CLASS_ENTRIES];
+	int cls, i;
+
+	for (cls = 0; cls < LATENCY_CLASS_COUNT; cls++) {
+		latency_class_series_t *class_latency = &disk->class_latency[cls];
+		Disksurvey__LatencyClass class_pb = DISKSURVEY__LATENCY_CLASS__INIT;
+
+		class_pb.latency_class = cls;
+		class_pb.has_current_entry = true;
+		class_pb.current_entry = class_latency->cur_entry;
+		class_pb.n_entries = LATENCY_CLASS_ENTRIES;
+		class_pb.entries = entries_pb_ptr;
+
+		for (i = 0; i < LATENCY_CLASS_ENTRIES; i++) {
+			latency_entry_to_pb(&class_latency->entries[i], &entries_pb[i]);
+			entries_pb_ptr[i] = &entries_pb[i];
+		}
+
+		if (pb_write_delimited(stream, &class_pb.base) < 0)
+			return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef DISKSURVEY_DISK_PB_H
+#define DISKSURVEY_DISK_PB_H
+
+#include "disk.h"
+#include "stream.h"
+#include "protocol.pb-c.h"
+
+/** Protobuf encoding of the disks for the API. Messages are written to the
+ * stream prefixed by their varint encoded length, the framing of
+ * writeDelimitedTo() in the protobuf libraries, so a client can read them
+ * one at a time. The messages point straight into disk_t, nothing is copied.
+ */
+
+/* Fill a DiskInfo message, the strings point into disk_info so it must outlive the message */
+void disk_info_to_pb(disk_info_t *disk_info, Disksurvey__DiskInfo *disk_info_pb,
+                     Disksurvey__DiskATA *disk_ata_pb, Disksurvey__DiskSAS *disk_sas_pb);
+
+int pb_write_delimited(stream_t *stream, const ProtobufCMessage *msg);
+
+/* A DiskStatus message, the protobuf counterpart of disk_json() */
+int disk_status_pb(disk_t *disk, stream_t *stream);
+/* One LatencyClass message per command class, the scratch space is static so only to a memory stream */
+int disk_latency_classes_pb(disk_t *disk, stream_t *stream);
+
+#endif
@@ -1,5 +1,5 @@
 #include "disk_scanner.h"
-#include "wire_log.h"
+#include "logger.h"
 
 #include "scsicmd.h"
 #include "ata.h"
@@ -61,6 +61,15 @@ static bool sg_request_data(disk_scanner_t *disk, unsigned char *cdb, int cdb_le
 		return false;
 	}
 
+	sg_io_hdr_t *hdr = &disk->data_request.hdr;
+	sense_outcome_t outcome;
+	sense_outcome_classify(&outcome, hdr->status, hdr->host_status, hdr->driver_status, hdr->sbp, hdr->sb_len_wr);
+	if (disk->num_commands < ARRAY_SIZE(disk->latencies)) {
+		disk->latencies[disk->num_commands] = 1000.0 * (disk->data_request.end - disk->data_request.start);
+		disk->outcomes[disk->num_commands] = outcome;
+		disk->num_commands++;
+	}
+
 	if (disk->data_request.hdr.status != 0) {
 		wire_log(WLOG_INFO, "Request failed, status=%d", disk->data_request.hdr.status);
 		if (disk->data_request.hdr.sb_len_wr) {
@@ -77,11 +86,8 @@ static bool sg_request_data(disk_scanner_t *disk, unsigned char *cdb, int cdb_le
 
 			wire_log(WLOG_INFO, "Sense buffer: %s", sense_text);
 
-			sense_info_t sense_info;
-			bool parsed = scsi_parse_sense(disk->data_request.hdr.sbp, disk->data_request.hdr.sb_len_wr, &sense_info);
-			if (parsed) {
-				wire_log(WLOG_INFO, "Sense info: %01X/%02X/%02X/%04X", sense_info.sense_key, sense_info.asc, sense_info.ascq, 0/*sense_info.vendor_unique_error*/);
-			}
+			if (outcome.sense_key != SENSE_STATS_NO_SENSE)
+				wire_log(WLOG_INFO, "Sense info: %01X/%02X/%02X", outcome.sense_key, outcome.asc, outcome.ascq);
 		}
 		return false;
 	}
@@ -117,7 +123,7 @@ static bool inquiry_parse(disk_scanner_t *disk)
 {
 	sg_request_t *req = &disk->data_request;
 	wire_log(WLOG_INFO, "Got inquiry reply in %f msecs (%d in sg)", 1000.0*(req->end-req->start), req->hdr.duration);
-	wire_log(WLOG_DEBUG, "data buf size %u res %u data %u", sizeof(disk->data_buf), req->hdr.resid, sizeof(disk->data_buf) - req->hdr.resid);
+	wire_log(WLOG_DEBUG, "data buf size %zu res %d data %zu", sizeof(disk->data_buf), req->hdr.resid, sizeof(disk->data_buf) - req->hdr.resid);
 	log_hex("data buffer", (unsigned char *)disk->data_buf, sizeof(disk->data_buf) - req->hdr.resid);
 
 	bool success = parse_inquiry((unsigned char *)disk->data_buf, sizeof(disk->data_buf) - req->hdr.resid, &disk->disk_info.device_type, disk->disk_info.vendor,
@@ -4,6 +4,7 @@
 #include "sg.h"
 #include "scsicmd.h"
 #include "util.h"
+#include "sense_stats.h"
 #include "src/disk_def.h"
 
 #include <time.h>
@@ -15,6 +16,11 @@ struct disk_scanner_t {
 	char sg_path[32];
 	disk_info_t disk_info;
 
+	// The completed scan commands, the disk is only known once they are done
+	double latencies[2]; /* msecs */
+	sense_outcome_t outcomes[2];
+	int num_commands;
+
 	sg_t sg;
 	sg_request_t data_request;
 	char data_buf[512] __attribute__(( aligned(4096) ));
@@ -0,0 +1,264 @@
+/* Command line client of the local control socket of disksurvey, see ctl.h
+ *
+ *   disksurvey-ctl [-s socket] rescan
+ *   disksurvey-ctl [-s socket] save
+ *   disksurvey-ctl [-s socket] dump <serial>
+ *   disksurvey-ctl [-s socket] probe <seconds>
+ *   disksurvey-ctl [-s socket] get <path>
+ *
+ * get fetches any of the HTTP routes over the socket and prints the body.
+ */
+#include "ctl.h"
+#include "protocol.pb-c.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: disksurvey-ctl [-s socket] rescan|save|dump <serial>|probe <seconds>|get <path>\n");
+	exit(2);
+}
+
+static const char *status_str(int status)
+{
+	switch (status) {
+		case CTL_OK: return "ok";
+		case CTL_ERR_UNKNOWN_CMD: return "unknown command";
+		case CTL_ERR_BAD_REQUEST: return "bad request";
+		case CTL_ERR_NOT_FOUND: return "not found";
+		case CTL_ERR_INTERNAL: return "internal error";
+	}
+	return "unknown status";
+}
+
+static int ctl_connect(const char *path)
+{
+	struct sockaddr_un addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "Failed to connect to %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t ret = write(fd, buf, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		buf = (const char *)buf + ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t ret = read(fd, buf, len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return -1;
+		buf = (char *)buf + ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/* Send a command and wait for its response, the payload of the response is malloc'ed */
+static int ctl_command(int fd, uint8_t cmd, const void *payload, uint32_t len, unsigned char **resp, uint32_t *resp_len)
+{
+	unsigned char hdr[CTL_HDR_SIZE];
+
+	ctl_hdr_pack(hdr, cmd, len);
+	if (write_all(fd, hdr, sizeof(hdr)) < 0 || write_all(fd, payload, len) < 0 ||
+	    read_all(fd, hdr, sizeof(hdr)) < 0 || hdr[0] != CTL_MAGIC) {
+		fprintf(stderr, "Control connection failed\n");
+		return -1;
+	}
+
+	*resp_len = ctl_hdr_len(hdr);
+	*resp = malloc(*resp_len + 1);
+	if (!*resp || read_all(fd, *resp, *resp_len) < 0) {
+		fprintf(stderr, "Failed to read the response\n");
+		return -1;
+	}
+
+	return hdr[1];
+}
+
+static void print_disk(const unsigned char *buf, uint32_t len)
+{
+	uint64_t msg_len = 0;
+	unsigned shift = 0, i = 0;
+
+	// The message is length delimited as in the protobuf API
+	while (i < len && shift < 64) {
+		msg_len |= (uint64_t)(buf[i] & 0x7F) << shift;
+		shift += 7;
+		if (!(buf[i++] & 0x80))
+			break;
+	}
+	if (msg_len > len - i) {
+		fprintf(stderr, "Truncated disk message\n");
+		return;
+	}
+
+	Disksurvey__DiskStatus *status = disksurvey__disk_status__unpack(NULL, msg_len, buf + i);
+	if (!status) {
+		fprintf(stderr, "Failed to decode the disk message\n");
+		return;
+	}
+
+	printf("serial:   %s\n", status->info->serial);
+	printf("vendor:   %s\n", status->info->vendor);
+	printf("model:    %s\n", status->info->model);
+	printf("fw_rev:   %s\n", status->info->fw_rev);
+	if (status->dev)
+		printf("dev:      %s\n", status->dev);
+	if (status->has_smart_ok)
+		printf("smart_ok: %s\n", status->smart_ok ? "yes" : "no");
+	if (status->last_latency) {
+		printf("top latencies:");
+		size_t j;
+		for (j = 0; j < status->last_latency->n_top_latencies; j++)
+			printf(" %g", status->last_latency->top_latencies[j]);
+		printf("\n");
+	}
+
+	disksurvey__disk_status__free_unpacked(status, NULL);
+}
+
+/* HTTP/1.0 so the body ends with the connection, whatever the route */
+static int http_get(int fd, const char *path)
+{
+	char buf[4096];
+	bool in_body = false;
+	unsigned len = 0;
+
+	int req_len = snprintf(buf, sizeof(buf), "GET %s HTTP/1.0\r\n\r\n", path);
+	if (req_len >= (int)sizeof(buf) || write_all(fd, buf, req_len) < 0) {
+		fprintf(stderr, "Failed to send the request\n");
+		return 1;
+	}
+
+	while (1) {
+		ssize_t ret = read(fd, buf + len, sizeof(buf) - len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+		len += ret;
+
+		if (!in_body) {
+			char *end = memmem(buf, len, "\r\n\r\n", 4);
+			if (!end) {
+				if (len == sizeof(buf)) {
+					fprintf(stderr, "Response headers too long\n");
+					return 1;
+				}
+				continue;
+			}
+			if (strncmp(buf, "HTTP/1.1 200", 12) != 0 && strncmp(buf, "HTTP/1.0 200", 12) != 0)
+				fprintf(stderr, "%.*s\n", (int)strcspn(buf, "\r\n"), buf);
+			in_body = true;
+			end += 4;
+			len -= end - buf;
+			memmove(buf, end, len);
+		}
+
+		fwrite(buf, 1, len, stdout);
+		len = 0;
+	}
+
+	return in_body ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = CTL_SOCKET_PATH;
+	unsigned char *resp = NULL;
+	uint32_t resp_len = 0;
+	int status;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:")) != -1) {
+		if (opt == 's')
+			path = optarg;
+		else
+			usage();
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc < 1)
+		usage();
+
+	const char *cmd = argv[0];
+	const char *arg = argc > 1 ? argv[1] : NULL;
+
+	int fd = ctl_connect(path);
+	if (fd < 0)
+		return 1;
+
+	if (strcmp(cmd, "rescan") == 0) {
+		status = ctl_command(fd, CTL_CMD_RESCAN, NULL, 0, &resp, &resp_len);
+	} else if (strcmp(cmd, "save") == 0) {
+		status = ctl_command(fd, CTL_CMD_SAVE_STATE, NULL, 0, &resp, &resp_len);
+	} else if (strcmp(cmd, "dump") == 0 && arg) {
+		status = ctl_command(fd, CTL_CMD_DUMP_DISK, arg, strlen(arg), &resp, &resp_len);
+		if (status == CTL_OK)
+			print_disk(resp, resp_len);
+	} else if (strcmp(cmd, "probe") == 0 && arg) {
+		char *end;
+		unsigned long secs = strtoul(arg, &end, 10);
+		if (*end || end == arg)
+			usage();
+		unsigned char payload[4] = { secs >> 24, secs >> 16, secs >> 8, secs };
+		status = ctl_command(fd, CTL_CMD_SET_PROBE, payload, sizeof(payload), &resp, &resp_len);
+	} else if (strcmp(cmd, "get") == 0 && arg) {
+		status = http_get(fd, arg);
+		close(fd);
+		return status;
+	} else {
+		usage();
+	}
+
+	close(fd);
+	free(resp);
+
+	if (status < 0)
+		return 1;
+	if (status != CTL_OK) {
+		fprintf(stderr, "%s: %s\n", cmd, status_str(status));
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,143 @@
+#include "json.h"
+
+#include <inttypes.h>
+#include <math.h>
+
+void json_init(json_t *json, stream_t *stream)
+{
+	json->stream = stream;
+	json->depth = 0;
+	json->has_items = 0;
+}
+
+int json_write_string(stream_t *stream, const char *str)
+{
+	static const char hex[] = "0123456789abcdef";
+	const char *start = str;
+
+	stream_putc(stream, '"');
+
+	// Copy the runs of plain characters in one go
+	for (; *str; str++) {
+		unsigned char ch = *str;
+		if (ch >= 0x20 && ch < 0x7F && ch != '"' && ch != '\\')
+			continue;
+
+		stream_write(stream, start, str - start);
+		start = str + 1;
+
+		switch (ch) {
+			case '"': stream_write(stream, "\\\"", 2); break;
+			case '\\': stream_write(stream, "\\\\", 2); break;
+			case '\n': stream_write(stream, "\\n", 2); break;
+			case '\r': stream_write(stream, "\\r", 2); break;
+			case '\t': stream_write(stream, "\\t", 2); break;
+			default: {
+				// Disks report all sorts of garbage, keep the output valid whatever the encoding
+				char esc[6] = { '\\', 'u', '0', '0', hex[ch >> 4], hex[ch & 0xF] };
+				stream_write(stream, esc, sizeof(esc));
+			}
+		}
+	}
+	stream_write(stream, start, str - start);
+
+	return stream_putc(stream, '"');
+}
+
+/* Separator and key of the next item in the current container */
+static int json_item(json_t *json, const char *key)
+{
+	uint32_t bit = 1U << json->depth;
+
+	if (json->has_items & bit)
+		stream_putc(json->stream, ',');
+	json->has_items |= bit;
+
+	if (key) {
+		json_write_string(json->stream, key);
+		stream_putc(json->stream, ':');
+	}
+
+	return json->stream->failed ? -1 : 0;
+}
+
+static int json_container_start(json_t *json, const char *key, char open)
+{
+	if (json->depth + 1 >= JSON_MAX_DEPTH)
+		return -1;
+
+	json_item(json, key);
+	json->depth++;
+	json->has_items &= ~(1U << json->depth);
+	return stream_putc(json->stream, open);
+}
+
+static int json_container_end(json_t *json, char close)
+{
+	if (json->depth == 0)
+		return -1;
+
+	json->depth--;
+	return stream_putc(json->stream, close);
+}
+
+int json_object_start(json_t *json, const char *key)
+{
+	return json_container_start(json, key, '{');
+}
+
+int json_object_end(json_t *json)
+{
+	return json_container_end(json, '}');
+}
+
+int json_array_start(json_t *json, const char *key)
+{
+	return json_container_start(json, key, '[');
+}
+
+int json_array_end(json_t *json)
+{
+	return json_container_end(json, ']');
+}
+
+int json_str(json_t *json, const char *key, const char *val)
+{
+	json_item(json, key);
+	return json_write_string(json->stream, val);
+}
+
+int json_int(json_t *json, const char *key, int64_t val)
+{
+	json_item(json, key);
+	return stream_printf(json->stream, "%"PRId64, val);
+}
+
+int json_uint(json_t *json, const char *key, uint64_t val)
+{
+	json_item(json, key);
+	return stream_printf(json->stream, "%"PRIu64, val);
+}
+
+int json_double(json_t *json, const char *key, double val)
+{
+	json_item(json, key);
+	// JSON has no representation for these
+	if (isnan(val) || isinf(val))
+		return stream_write(json->stream, "null", 4);
+	return stream_printf(json->stream, "%g", val);
+}
+
+int json_double_fixed(json_t *json, const char *key, double val, int decimals)
+{
+	json_item(json, key);
+	if (isnan(val) || isinf(val))
+		return stream_write(json->stream, "null", 4);
+	return stream_printf(json->stream, "%.*f", decimals, val);
+}
+
+int json_bool(json_t *json, const char *key, bool val)
+{
+	json_item(json, key);
+	return val ? stream_write(json->stream, "true", 4) : stream_write(json->stream, "false", 5);
+}
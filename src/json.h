@@ -0,0 +1,42 @@
+#ifndef DISKSURVEY_JSON_H
+#define DISKSURVEY_JSON_H
+
+#include "stream.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Streaming JSON writer. Commas and string escaping are taken care of, the
+ * caller only opens and closes containers and adds values. Every function
+ * takes the key of the value, pass NULL for values inside an array.
+ *
+ * All functions return -1 once the underlying stream failed.
+ */
+
+#define JSON_MAX_DEPTH 32
+
+typedef struct json_t {
+	stream_t *stream;
+	int depth;
+	uint32_t has_items; /* bit per depth, set once the container got its first item */
+} json_t;
+
+void json_init(json_t *json, stream_t *stream);
+
+int json_object_start(json_t *json, const char *key);
+int json_object_end(json_t *json);
+int json_array_start(json_t *json, const char *key);
+int json_array_end(json_t *json);
+
+int json_str(json_t *json, const char *key, const char *val);
+int json_int(json_t *json, const char *key, int64_t val);
+int json_uint(json_t *json, const char *key, uint64_t val);
+int json_double(json_t *json, const char *key, double val);
+/* A fixed number of decimals, for values such as timestamps that %g would round */
+int json_double_fixed(json_t *json, const char *key, double val, int decimals);
+int json_bool(json_t *json, const char *key, bool val);
+
+/* Write a string value escaped, quotes included */
+int json_write_string(stream_t *stream, const char *str);
+
+#endif
@@ -6,6 +6,7 @@
 #define MIN_BUCKET 0
 
 static double histogram_boundary[] = LATENCY_RANGES;
+const double latency_bucket_bounds[LATENCY_RANGE_COUNT-1] = LATENCY_RANGES;
 
 void latency_init(latency_t *latency)
 {
@@ -26,37 +27,227 @@ static void update_top_latencies(latency_summary_t *entry, double val)
     entry->top_latencies[i] = val;
 }
 
-static void update_histogram(latency_summary_t *entry, double val)
+static int histogram_bucket(double val)
 {
     int i;
 
     for (i = 0; i < ARRAY_SIZE(histogram_boundary); i++)
     {
-        if (val <= histogram_boundary[i]*1000.0) {
-            entry->hist[i]++;
-            return;
-        }
+        if (val <= histogram_boundary[i]*1000.0)
+            return i;
     }
     // Last entry covers the rest of the range
-    entry->hist[i]++;
+    return i;
 }
 
-void latency_add_sample(latency_t *latency, double val)
+static void update_histogram(latency_summary_t *entry, double val)
 {
-    latency_summary_t* entry = &latency->entries[latency->cur_entry];
+    entry->hist[histogram_bucket(val)]++;
+}
 
+static void summary_add_sample(latency_summary_t *entry, double val)
+{
     if (val > entry->top_latencies[0])
         update_top_latencies(entry, val);
-    
+
     update_histogram(entry, val);
 }
 
+/* A segment tree over the entries for the maximum latency in a range. The
+ * leaves are the entries themselves, an inner node holds the entry with the
+ * highest latency below it plus one, zero when they are all empty, so a zeroed
+ * tree is valid for zeroed entries.
+ */
+#define NUM_LATENCY_ENTRIES ARRAY_SIZE(((latency_t *)0)->entries)
+
+static inline double entry_max(latency_t *latency, unsigned slot_ref)
+{
+    return slot_ref ? latency->entries[slot_ref-1].top_latencies[NUM_TOP_LATENCIES-1] : 0;
+}
+
+static inline unsigned node_ref(latency_t *latency, unsigned node)
+{
+    return node >= NUM_LATENCY_ENTRIES ? node - NUM_LATENCY_ENTRIES + 1 : latency->max_tree[node];
+}
+
+static inline void max_tree_set(latency_t *latency, unsigned node)
+{
+    unsigned left = node_ref(latency, 2*node);
+    unsigned right = node_ref(latency, 2*node + 1);
+    latency->max_tree[node] = entry_max(latency, left) >= entry_max(latency, right) ? left : right;
+}
+
+static void max_tree_update(latency_t *latency, int entry)
+{
+    unsigned node;
+
+    for (node = (entry + NUM_LATENCY_ENTRIES) / 2; node >= 1; node /= 2)
+        max_tree_set(latency, node);
+}
+
+/* Maximum over the entries lo to hi, inclusive */
+static double max_tree_query(latency_t *latency, unsigned lo, unsigned hi)
+{
+    double max = 0;
+
+    for (lo += NUM_LATENCY_ENTRIES, hi += NUM_LATENCY_ENTRIES + 1; lo < hi; lo /= 2, hi /= 2) {
+        // Not MAX(), it would evaluate the increments twice
+        if (lo & 1) {
+            double val = entry_max(latency, node_ref(latency, lo++));
+            if (val > max)
+                max = val;
+        }
+        if (hi & 1) {
+            double val = entry_max(latency, node_ref(latency, --hi));
+            if (val > max)
+                max = val;
+        }
+    }
+
+    return max;
+}
+
+static int summary_tick(latency_summary_t *entries, int num_entries, int cur_entry)
+{
+    cur_entry = (cur_entry + 1) % num_entries;
+    memset(&entries[cur_entry], 0, sizeof(entries[cur_entry]));
+    return cur_entry;
+}
+
+/* The histogram counts of a range come from the running total taken as each
+ * block of entries was entered, the difference of two of them covers the
+ * whole blocks in between and only the entries of the partial blocks at the
+ * ends are summed one by one. The block the current entry is in also holds the
+ * oldest entries, it is never a whole block.
+ */
+#define NUM_LATENCY_BLOCKS ARRAY_SIZE(((latency_t *)0)->block_start)
+#define LATENCY_BLOCK_ENTRIES (NUM_LATENCY_ENTRIES / NUM_LATENCY_BLOCKS)
+
+void latency_add_sample(latency_t *latency, double val)
+{
+    latency_summary_t *entry = &latency->entries[latency->cur_entry];
+    bool new_max = val > entry->top_latencies[NUM_TOP_LATENCIES-1];
+
+    summary_add_sample(entry, val);
+    latency->total.hist[histogram_bucket(val)]++;
+    if (new_max)
+        max_tree_update(latency, latency->cur_entry);
+}
+
 void latency_tick(latency_t *latency)
 {
-    latency->cur_entry++;
+    latency->cur_entry = summary_tick(latency->entries, ARRAY_SIZE(latency->entries), latency->cur_entry);
+    if (latency->cur_entry % LATENCY_BLOCK_ENTRIES == 0)
+        latency->block_start[latency->cur_entry / LATENCY_BLOCK_ENTRIES] = latency->total;
+    // The oldest entry was reused
+    max_tree_update(latency, latency->cur_entry);
+}
+
+void latency_reindex(latency_t *latency)
+{
+    int num_entries = ARRAY_SIZE(latency->entries);
+    int i, j;
+
+    // From the oldest whole block, the one after the current, to the current one. The oldest entries
+    // in the block of the current one are before any start and never summed from them.
+    int cur_block = latency->cur_entry / LATENCY_BLOCK_ENTRIES;
+    memset(&latency->total, 0, sizeof(latency->total));
+    for (i = 1; i <= NUM_LATENCY_BLOCKS; i++) {
+        int block = (cur_block + i) % NUM_LATENCY_BLOCKS;
+        int first = block * LATENCY_BLOCK_ENTRIES;
+        int last = block == cur_block ? latency->cur_entry : first + LATENCY_BLOCK_ENTRIES - 1;
+        int idx;
+
+        latency->block_start[block] = latency->total;
+        for (idx = first; idx <= last; idx++) {
+            for (j = 0; j < LATENCY_RANGE_COUNT; j++)
+                latency->total.hist[j] += latency->entries[idx].hist[j];
+        }
+    }
+
+    for (i = num_entries - 1; i >= 1; i--)
+        max_tree_set(latency, i);
+}
+
+static void range_add_entries(latency_t *latency, int oldest_age, int newest_age, latency_range_t *range)
+{
+    int age, j;
+
+    for (age = oldest_age; age >= newest_age; age--) {
+        latency_summary_t *entry = &latency->entries[(latency->cur_entry - age + NUM_LATENCY_ENTRIES) % NUM_LATENCY_ENTRIES];
+        for (j = 0; j < LATENCY_RANGE_COUNT; j++)
+            range->hist[j] += entry->hist[j];
+    }
+}
+
+void latency_range(latency_t *latency, int oldest_age, int newest_age, latency_range_t *range)
+{
+    int num_entries = ARRAY_SIZE(latency->entries);
+    int first = (latency->cur_entry - oldest_age + num_entries) % num_entries;
+    int last = (latency->cur_entry - newest_age + num_entries) % num_entries;
+    int j;
 
-    latency_summary_t* entry = &latency->entries[latency->cur_entry];
-    memset(entry, 0, sizeof(*entry));
+    // Block n back from the current one starts at age k + n*S and ends at age k + (n-1)*S + 1, the current one is block 0
+    int k = latency->cur_entry % LATENCY_BLOCK_ENTRIES;
+    int newest_block = (newest_age - k - 1 + LATENCY_BLOCK_ENTRIES - 1) / LATENCY_BLOCK_ENTRIES + 1;
+    int oldest_block = oldest_age >= k ? MIN((oldest_age - k) / LATENCY_BLOCK_ENTRIES, (int)NUM_LATENCY_BLOCKS - 1) : 0;
+    if (newest_age <= k)
+        newest_block = 1;
+
+    memset(range->hist, 0, sizeof(range->hist));
+    if (newest_block <= oldest_block) {
+        int cur_block = latency->cur_entry / LATENCY_BLOCK_ENTRIES;
+        latency_prefix_t *end = &latency->block_start[(cur_block - newest_block + 1 + NUM_LATENCY_BLOCKS) % NUM_LATENCY_BLOCKS];
+        latency_prefix_t *start = &latency->block_start[(cur_block - oldest_block + NUM_LATENCY_BLOCKS) % NUM_LATENCY_BLOCKS];
+
+        // The total when the block after the newest whole one was entered less the one when the oldest was, unsigned arithmetic takes care of the wrap
+        for (j = 0; j < LATENCY_RANGE_COUNT; j++)
+            range->hist[j] = end->hist[j] - start->hist[j];
+        range_add_entries(latency, oldest_age, k + oldest_block * LATENCY_BLOCK_ENTRIES + 1, range);
+        range_add_entries(latency, k + (newest_block - 1) * LATENCY_BLOCK_ENTRIES, newest_age, range);
+    } else {
+        range_add_entries(latency, oldest_age, newest_age, range);
+    }
+
+    range->count = 0;
+    for (j = 0; j < LATENCY_RANGE_COUNT; j++)
+        range->count += range->hist[j];
+
+    if (first <= last)
+        range->max = max_tree_query(latency, first, last);
+    else
+        range->max = MAX(max_tree_query(latency, first, num_entries - 1), max_tree_query(latency, 0, last));
+}
+
+void latency_class_rollup(latency_class_series_t *series, const latency_summary_t *entry)
+{
+    latency_summary_t *cur = &series->entries[series->cur_entry];
+    int i;
+
+    for (i = 0; i < NUM_TOP_LATENCIES; i++) {
+        if (entry->top_latencies[i] > cur->top_latencies[0])
+            update_top_latencies(cur, entry->top_latencies[i]);
+    }
+    for (i = 0; i < LATENCY_RANGE_COUNT; i++)
+        cur->hist[i] += entry->hist[i];
+}
+
+const char *latency_class_name(latency_class_e latency_class)
+{
+    switch (latency_class) {
+        case LATENCY_CLASS_HEARTBEAT: return "heartbeat";
+        case LATENCY_CLASS_SMART: return "smart";
+        case LATENCY_CLASS_LOG_PAGE: return "log_page";
+        case LATENCY_CLASS_SCAN: return "scan";
+    }
+    return "unknown";
+}
+
+void latency_totals_add(latency_totals_t *totals, double val)
+{
+    totals->count++;
+    totals->sum += val;
+    totals->hist[histogram_bucket(val)]++;
 }
 
 void latency_save(latency_t *latency, FILE *fd)
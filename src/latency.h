@@ -4,8 +4,43 @@
 #include "src/disk_def.h"
 #include <stdio.h>
 
+/* The class series are kept at a coarser resolution, one entry per this many latency ticks */
+#define LATENCY_CLASS_TICKS 12
+
 void latency_init(latency_t *hist);
 void latency_add_sample(latency_t *hist, double val);
 void latency_tick(latency_t *latency);
+/* Rebuild the range indexes after the entries were loaded */
+void latency_reindex(latency_t *latency);
+
+/* Merged summary of consecutive entries */
+typedef struct latency_range_t {
+    uint32_t hist[LATENCY_RANGE_COUNT];
+    uint64_t count;
+    double max; /* msecs */
+} latency_range_t;
+
+/* Merge the entries aged between oldest_age and newest_age ticks, inclusive. Age 0 is the current entry.
+ * The histogram sums at most two partial hours of entries around the hourly running totals, the maximum takes
+ * logarithmic time from the max tree. */
+void latency_range(latency_t *latency, int oldest_age, int newest_age, latency_range_t *range);
+
+void latency_class_add_sample(latency_class_series_t *series, double val);
+void latency_class_tick(latency_class_series_t *series);
+/* Merge a closed entry of a latency_t into the current class entry, for a class that is recorded in the finer series */
+void latency_class_rollup(latency_class_series_t *series, const latency_summary_t *entry);
+const char *latency_class_name(latency_class_e latency_class);
+
+/* Running totals since the disk was attached, exported as cumulative counters */
+typedef struct latency_totals_t {
+    uint64_t count;
+    double sum; /* msecs */
+    uint64_t hist[LATENCY_RANGE_COUNT];
+} latency_totals_t;
+
+void latency_totals_add(latency_totals_t *totals, double val);
+
+/* Upper bounds of the histogram buckets in seconds, the last bucket has no bound */
+extern const double latency_bucket_bounds[LATENCY_RANGE_COUNT-1];
 
 #endif
@@ -0,0 +1,66 @@
+#include "log_support.h"
+#include "util.h"
+
+#include <string.h>
+
+#define LOG_SUPPORT_CACHE_SIZE 32
+
+struct log_support_entry {
+	bool used;
+	disk_type_e disk_type;
+	char vendor[sizeof(((disk_info_t *)0)->vendor)];
+	char model[sizeof(((disk_info_t *)0)->model)];
+	char fw_rev[sizeof(((disk_info_t *)0)->fw_rev)];
+	uint64_t pages;
+};
+
+static struct log_support_entry cache[LOG_SUPPORT_CACHE_SIZE];
+static unsigned next_victim;
+
+static struct log_support_entry *log_support_find(const disk_info_t *disk_info)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(cache); i++) {
+		struct log_support_entry *entry = &cache[i];
+		if (entry->used &&
+		    entry->disk_type == disk_info->disk_type &&
+		    strcmp(entry->vendor, disk_info->vendor) == 0 &&
+		    strcmp(entry->model, disk_info->model) == 0 &&
+		    strcmp(entry->fw_rev, disk_info->fw_rev) == 0)
+		{
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+bool log_support_lookup(const disk_info_t *disk_info, uint64_t *pages)
+{
+	struct log_support_entry *entry = log_support_find(disk_info);
+	if (!entry)
+		return false;
+
+	*pages = entry->pages;
+	return true;
+}
+
+void log_support_store(const disk_info_t *disk_info, uint64_t pages)
+{
+	struct log_support_entry *entry = log_support_find(disk_info);
+
+	if (!entry) {
+		// More models than slots is rare, simply cycle through them
+		entry = &cache[next_victim];
+		next_victim = (next_victim + 1) % ARRAY_SIZE(cache);
+
+		entry->used = true;
+		entry->disk_type = disk_info->disk_type;
+		strcpy(entry->vendor, disk_info->vendor);
+		strcpy(entry->model, disk_info->model);
+		strcpy(entry->fw_rev, disk_info->fw_rev);
+	}
+
+	entry->pages = pages;
+}
@@ -0,0 +1,22 @@
+#ifndef DISKSURVEY_LOG_SUPPORT_H
+#define DISKSURVEY_LOG_SUPPORT_H
+
+#include "src/disk_def.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Which log pages a disk supports is a property of its model and firmware,
+ * the answer is cached so that a host full of identical disks probes it once.
+ * Pages are kept as a bitmap of page numbers below 64.
+ */
+
+bool log_support_lookup(const disk_info_t *disk_info, uint64_t *pages);
+void log_support_store(const disk_info_t *disk_info, uint64_t pages);
+
+static inline bool log_support_has(uint64_t pages, uint8_t page)
+{
+	return page < 64 && (pages & (1ULL << page));
+}
+
+#endif
@@ -0,0 +1,391 @@
+#include "logger.h"
+#include "monoclock.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+/* What the writer formats around the message at most */
+#define LOGGER_LINE_MAX (LOGGER_MSG_LEN * 2 + 160)
+#define LOGGER_WRITE_BUF 65536
+/* How often the wire thread looks up the offset of the local time, for the DST changes */
+#define LOGGER_UTC_OFFSET_SECS 60
+
+struct logger_record {
+	const log_site_t *site;
+	struct timespec ts;
+	unsigned suppressed;
+	unsigned len;
+	char msg[LOGGER_MSG_LEN];
+};
+
+struct logger {
+	bool async;
+	bool json;
+	int level;
+	pthread_t producer;
+	pthread_t writer;
+	int event_fd;
+
+	/* head is written by the producer only and tail by the writer only */
+	_Atomic uint32_t head;
+	_Atomic uint32_t tail;
+	_Atomic bool writer_sleeping;
+	_Atomic bool stop;
+
+	/* Of the local time to UTC, kept up to date by the producer */
+	_Atomic long utc_offset;
+	double utc_offset_ts;
+
+	/* Of the producer */
+	uint64_t dropped;
+	uint64_t suppressed;
+	/* Of the writer */
+	_Atomic uint64_t written;
+
+	struct logger_record ring[LOGGER_RECORDS];
+};
+static struct logger logger = {
+	.level = WLOG_INFO,
+	.event_fd = -1,
+};
+
+static const char *level_names[] = {
+	[WLOG_FATAL] = "fatal",
+	[WLOG_CRITICAL] = "critical",
+	[WLOG_ERR] = "error",
+	[WLOG_WARNING] = "warning",
+	[WLOG_NOTICE] = "notice",
+	[WLOG_INFO] = "info",
+	[WLOG_DEBUG] = "debug",
+};
+
+static const char *level_name(int level)
+{
+	if (level < 0 || level >= (int)(sizeof(level_names)/sizeof(level_names[0])) || !level_names[level])
+		return "unknown";
+	return level_names[level];
+}
+
+static const char *file_basename(const char *file)
+{
+	const char *slash = strrchr(file, '/');
+	return slash ? slash + 1 : file;
+}
+
+static int json_escape(char *buf, int size, const char *str, unsigned len)
+{
+	int out = 0;
+	unsigned i;
+
+	for (i = 0; i < len && out + 7 < size; i++) {
+		unsigned char c = str[i];
+		if (c == '"' || c == '\\') {
+			buf[out++] = '\\';
+			buf[out++] = c;
+		} else if (c < 0x20) {
+			out += snprintf(buf + out, size - out, "\\u%04x", c);
+		} else {
+			buf[out++] = c;
+		}
+	}
+	return out;
+}
+
+/* The wall clock fields without localtime_r() or gmtime_r(), both take the
+ * timezone lock of glibc which the save child could inherit held by the
+ * writer. The days since the epoch to a civil date as in Howard Hinnant's
+ * civil_from_days(). */
+static void logger_civil_time(time_t t, struct tm *tm)
+{
+	long days = t / 86400;
+	long secs = t % 86400;
+
+	if (secs < 0) {
+		secs += 86400;
+		days--;
+	}
+	tm->tm_hour = secs / 3600;
+	tm->tm_min = secs / 60 % 60;
+	tm->tm_sec = secs % 60;
+
+	days += 719468;
+	long era = (days >= 0 ? days : days - 146096) / 146097;
+	unsigned doe = days - era * 146097;
+	unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	unsigned mp = (5 * doy + 2) / 153;
+	unsigned month = mp < 10 ? mp + 3 : mp - 9;
+
+	tm->tm_mday = doy - (153 * mp + 2) / 5 + 1;
+	tm->tm_mon = month - 1;
+	tm->tm_year = yoe + era * 400 + (month <= 2) - 1900;
+}
+
+/* Called by the producer only, the fork happens on its thread so it never holds the timezone lock then */
+static void logger_utc_offset_update(void)
+{
+	double now = monoclock_get();
+	struct tm tm;
+	time_t t;
+
+	if (logger.utc_offset_ts > 0 && now - logger.utc_offset_ts < LOGGER_UTC_OFFSET_SECS)
+		return;
+	logger.utc_offset_ts = now;
+
+	t = time(NULL);
+	if (localtime_r(&t, &tm))
+		atomic_store_explicit(&logger.utc_offset, tm.tm_gmtoff, memory_order_relaxed);
+}
+
+/* Returns the length of the line, buf must hold LOGGER_LINE_MAX */
+static int logger_format(char *buf, const struct logger_record *rec)
+{
+	const log_site_t *site = rec->site;
+	int len;
+
+	if (logger.json) {
+		len = snprintf(buf, LOGGER_LINE_MAX, "{\"ts\":%ld.%03ld,\"level\":\"%s\",\"file\":\"%s\",\"line\":%d,\"msg\":\"",
+				(long)rec->ts.tv_sec, rec->ts.tv_nsec / 1000000, level_name(site->level), file_basename(site->file), site->line);
+		len += json_escape(buf + len, LOGGER_LINE_MAX - len, rec->msg, rec->len);
+		if (rec->suppressed)
+			len += snprintf(buf + len, LOGGER_LINE_MAX - len, "\",\"suppressed\":%u}\n", rec->suppressed);
+		else
+			len += snprintf(buf + len, LOGGER_LINE_MAX - len, "\"}\n");
+	} else {
+		struct tm tm;
+		logger_civil_time(rec->ts.tv_sec + atomic_load_explicit(&logger.utc_offset, memory_order_relaxed), &tm);
+		len = snprintf(buf, LOGGER_LINE_MAX, "%04d-%02d-%02d %02d:%02d:%02d.%03ld %s %s:%d: %.*s",
+				tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+				rec->ts.tv_nsec / 1000000, level_name(site->level), file_basename(site->file), site->line, rec->len, rec->msg);
+		if (rec->suppressed)
+			len += snprintf(buf + len, LOGGER_LINE_MAX - len, " (%u similar messages suppressed)", rec->suppressed);
+		buf[len++] = '\n';
+	}
+	return len;
+}
+
+static void write_all(const char *buf, int len)
+{
+	while (len > 0) {
+		ssize_t ret = write(STDOUT_FILENO, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+		buf += ret;
+		len -= ret;
+	}
+}
+
+static void *logger_writer(void *arg)
+{
+	static char buf[LOGGER_WRITE_BUF];
+	(void)arg;
+
+	while (1) {
+		uint32_t tail = atomic_load_explicit(&logger.tail, memory_order_relaxed);
+		uint32_t head = atomic_load_explicit(&logger.head, memory_order_acquire);
+		int len = 0;
+
+		if (tail == head) {
+			if (atomic_load(&logger.stop))
+				break;
+
+			// The producer checks the flag after publishing a record, check the head again after setting it
+			atomic_store(&logger.writer_sleeping, true);
+			if (atomic_load(&logger.head) == tail && !atomic_load(&logger.stop)) {
+				uint64_t val;
+				if (read(logger.event_fd, &val, sizeof(val)) < 0 && errno != EINTR && errno != EAGAIN)
+					break;
+			}
+			atomic_store(&logger.writer_sleeping, false);
+			continue;
+		}
+
+		uint32_t first = tail;
+		for (; tail != head && len + LOGGER_LINE_MAX <= LOGGER_WRITE_BUF; tail++)
+			len += logger_format(buf + len, &logger.ring[tail % LOGGER_RECORDS]);
+		atomic_store_explicit(&logger.tail, tail, memory_order_release);
+		atomic_fetch_add_explicit(&logger.written, tail - first, memory_order_relaxed);
+
+		write_all(buf, len);
+	}
+	return NULL;
+}
+
+static void logger_wake(void)
+{
+	uint64_t one = 1;
+	if (write(logger.event_fd, &one, sizeof(one)) < 0) {
+		// The counter can't overflow in practice, the writer is woken anyway
+	}
+}
+
+/* The save child must not queue to a writer it doesn't have */
+static void logger_atfork_child(void)
+{
+	logger.async = false;
+}
+
+void logger_init(void)
+{
+	const char *env;
+
+	env = getenv("DISKSURVEY_LOG_FORMAT");
+	logger.json = env && strcmp(env, "json") == 0;
+	env = getenv("DISKSURVEY_LOG_LEVEL");
+	if (env && strcmp(env, "debug") == 0)
+		logger.level = WLOG_DEBUG;
+
+	logger.producer = pthread_self();
+	logger_utc_offset_update();
+	logger.event_fd = eventfd(0, EFD_CLOEXEC);
+	if (logger.event_fd < 0) {
+		wire_log(WLOG_WARNING, "Failed to create the log eventfd, logging synchronously: %m");
+		return;
+	}
+	if (pthread_create(&logger.writer, NULL, logger_writer, NULL) != 0) {
+		close(logger.event_fd);
+		logger.event_fd = -1;
+		wire_log(WLOG_WARNING, "Failed to start the log writer, logging synchronously");
+		return;
+	}
+	pthread_atfork(NULL, NULL, logger_atfork_child);
+	logger.async = true;
+}
+
+/* Waits until the writer took everything queued */
+static void logger_drain(void)
+{
+	while (atomic_load(&logger.tail) != atomic_load(&logger.head)) {
+		logger_wake();
+		usleep(1000);
+	}
+}
+
+void logger_stop(void)
+{
+	if (!logger.async)
+		return;
+
+	logger.async = false;
+	atomic_store(&logger.stop, true);
+	logger_wake();
+	pthread_join(logger.writer, NULL);
+	close(logger.event_fd);
+	logger.event_fd = -1;
+}
+
+void logger_counters(logger_counters_t *counters)
+{
+	counters->written = atomic_load_explicit(&logger.written, memory_order_relaxed);
+	counters->dropped = logger.dropped;
+	counters->suppressed = logger.suppressed;
+}
+
+/* Returns true when the message may get out, false when it is over the site's burst */
+static bool logger_site_allow(log_site_t *site)
+{
+	if (site->level <= WLOG_CRITICAL || site->unlimited)
+		return true;
+
+	double now = monoclock_get();
+	if (now - site->window_start >= LOGGER_SITE_WINDOW_SECS) {
+		site->window_start = now;
+		site->window_count = 0;
+	}
+	if (site->window_count >= LOGGER_SITE_BURST) {
+		site->suppressed++;
+		logger.suppressed++;
+		return false;
+	}
+	site->window_count++;
+	return true;
+}
+
+static void logger_record_fill(struct logger_record *rec, log_site_t *site, const char *fmt, va_list ap)
+{
+	int len;
+
+	rec->site = site;
+	clock_gettime(CLOCK_REALTIME, &rec->ts);
+	rec->suppressed = site->suppressed;
+	site->suppressed = 0;
+
+	len = vsnprintf(rec->msg, sizeof(rec->msg), fmt, ap);
+	if (len < 0)
+		len = 0;
+	else if (len >= (int)sizeof(rec->msg))
+		len = sizeof(rec->msg) - 1;
+	// Some messages carry their own newline
+	while (len > 0 && rec->msg[len-1] == '\n')
+		len--;
+	rec->len = len;
+}
+
+void logger_write(log_site_t *site, const char *fmt, ...)
+{
+	struct logger_record *rec;
+	va_list ap;
+
+	if (site->level > logger.level)
+		return;
+
+	bool producer = logger.async && pthread_equal(pthread_self(), logger.producer);
+
+	// The site state belongs to the wire thread, other threads are rare and not limited
+	if (producer && !logger_site_allow(site))
+		return;
+
+	if (site->level <= WLOG_CRITICAL) {
+		// libwire decides what happens on these, get what came before them out first
+		char msg[LOGGER_MSG_LEN];
+		va_start(ap, fmt);
+		vsnprintf(msg, sizeof(msg), fmt, ap);
+		va_end(ap);
+		if (producer)
+			logger_drain();
+		(wire_log)(site->level, "%s", msg);
+		return;
+	}
+
+	if (!producer) {
+		struct logger_record sync_rec;
+		char line[LOGGER_LINE_MAX];
+
+		va_start(ap, fmt);
+		logger_record_fill(&sync_rec, site, fmt, ap);
+		va_end(ap);
+		write_all(line, logger_format(line, &sync_rec));
+		return;
+	}
+
+	uint32_t head = atomic_load_explicit(&logger.head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&logger.tail, memory_order_acquire) == LOGGER_RECORDS) {
+		// The site keeps its suppressed count for the next record that fits
+		logger.dropped++;
+		return;
+	}
+
+	logger_utc_offset_update();
+	rec = &logger.ring[head % LOGGER_RECORDS];
+	va_start(ap, fmt);
+	logger_record_fill(rec, site, fmt, ap);
+	va_end(ap);
+	atomic_store_explicit(&logger.head, head + 1, memory_order_release);
+
+	// Pairs with the writer setting the flag before checking the head, only a sleeping writer costs a syscall
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&logger.writer_sleeping, memory_order_relaxed))
+		logger_wake();
+}
@@ -0,0 +1,69 @@
+#ifndef DISKSURVEY_LOGGER_H
+#define DISKSURVEY_LOGGER_H
+
+#include "wire_log.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Logging off the monitoring thread. Include this instead of wire_log.h, it
+ * turns every wire_log() into a call site with its own static state. The
+ * message is formatted at the call (so %m still sees the errno) into a fixed
+ * record of a ring that a writer thread drains to stdout, the wire thread
+ * never waits on the output. When the ring is full the record is dropped and
+ * counted.
+ *
+ * Each call site may log LOGGER_SITE_BURST messages per
+ * LOGGER_SITE_WINDOW_SECS, the rest are counted and the next message of the
+ * site that gets out tells how many were suppressed. FATAL and CRITICAL are
+ * never limited and go synchronously through libwire after the ring drained.
+ * wire_log_unlimited() is for the call sites that dump a bounded report line
+ * by line (e.g. the command trace of a dead disk), which must come out whole.
+ *
+ * DISKSURVEY_LOG_FORMAT=json writes JSON lines instead of text and
+ * DISKSURVEY_LOG_LEVEL=debug lets the DEBUG messages out.
+ */
+
+#define LOGGER_RECORDS 512
+#define LOGGER_MSG_LEN 200
+#define LOGGER_SITE_BURST 10
+#define LOGGER_SITE_WINDOW_SECS 60
+
+typedef struct log_site_t {
+	const char *file;
+	int line;
+	int level;
+	bool unlimited;
+	double window_start;
+	unsigned window_count;
+	unsigned suppressed; /* since the last message out */
+} log_site_t;
+
+typedef struct logger_counters_t {
+	uint64_t written;
+	uint64_t dropped; /* the ring was full */
+	uint64_t suppressed; /* by the per site limit */
+} logger_counters_t;
+
+/* Call from the wire thread, which becomes the only one to use the ring */
+void logger_init(void);
+/* Writes out what is queued and stops the writer, later messages are written synchronously */
+void logger_stop(void);
+void logger_counters(logger_counters_t *counters);
+
+void logger_write(log_site_t *site, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#undef wire_log
+#define wire_log(_level_, _fmt_...) \
+	do { \
+		static log_site_t _log_site_ = { .file = __FILE__, .line = __LINE__, .level = (_level_) }; \
+		logger_write(&_log_site_, _fmt_); \
+	} while (0)
+
+#define wire_log_unlimited(_level_, _fmt_...) \
+	do { \
+		static log_site_t _log_site_ = { .file = __FILE__, .line = __LINE__, .level = (_level_), .unlimited = true }; \
+		logger_write(&_log_site_, _fmt_); \
+	} while (0)
+
+#endif
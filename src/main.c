@@ -1,11 +1,13 @@
 #include "disk_mgr.h"
 #include "web.h"
+#include "startup_trace.h"
+#include "self_stats.h"
 
 #include "wire.h"
 #include "wire_fd.h"
 #include "wire_stack.h"
 #include "wire_io.h"
-#include "wire_log.h"
+#include "logger.h"
 
 #include <sys/signalfd.h>
 #include <errno.h>
@@ -94,17 +96,21 @@ static void register_shutdown_handler(void)
 
 int main()
 {
+	startup_trace_init();
+	self_stats_init();
 	wire_stack_fault_detector_install();
 
 	wire_thread_init(&wire_thread_main);
 	wire_fd_init();
 	wire_io_init(8);
 	wire_log_init_stdout();
+	logger_init();
 
 	register_shutdown_handler();
 	disk_manager_init();
 	web_init(5001);
 
 	wire_thread_run();
+	logger_stop();
 	return 0;
 }
@@ -0,0 +1,246 @@
+#include "metrics.h"
+#include "disk_mgr.h"
+#include "disk.h"
+#include "latency.h"
+#include "self_stats.h"
+#include "util.h"
+
+#include <inttypes.h>
+
+#define METRIC_PREFIX "disksurvey_"
+
+/* Label values must be valid UTF-8, disks report anything so non-ASCII bytes are replaced */
+static void metrics_write_label(stream_t *stream, const char *name, const char *value, bool first)
+{
+	const char *start = value;
+
+	stream_printf(stream, "%s%s=\"", first ? "" : ",", name);
+
+	for (; *value; value++) {
+		unsigned char ch = *value;
+		if (ch >= 0x20 && ch < 0x7F && ch != '"' && ch != '\\')
+			continue;
+
+		stream_write(stream, start, value - start);
+		start = value + 1;
+
+		switch (ch) {
+			case '"': stream_write(stream, "\\\"", 2); break;
+			case '\\': stream_write(stream, "\\\\", 2); break;
+			case '\n': stream_write(stream, "\\n", 2); break;
+			default: stream_putc(stream, '?'); break;
+		}
+	}
+	stream_write(stream, start, value - start);
+	stream_putc(stream, '"');
+}
+
+static void metrics_family(stream_t *stream, const char *name, const char *type, const char *help)
+{
+	stream_printf(stream, "# HELP " METRIC_PREFIX "%s %s\n# TYPE " METRIC_PREFIX "%s %s\n", name, help, name, type);
+}
+
+/* Starts a sample line up to the end of the serial label, the caller adds its own labels and the value */
+static void metrics_sample(stream_t *stream, const char *name, disk_t *disk)
+{
+	stream_printf(stream, METRIC_PREFIX "%s{", name);
+	metrics_write_label(stream, "serial", disk->disk_info.serial, true);
+}
+
+static int metrics_disk_info(disk_t *disk, void *arg)
+{
+	stream_t *stream = arg;
+
+	metrics_sample(stream, "disk_info", disk);
+	metrics_write_label(stream, "vendor", disk->disk_info.vendor, false);
+	metrics_write_label(stream, "model", disk->disk_info.model, false);
+	metrics_write_label(stream, "fw_rev", disk->disk_info.fw_rev, false);
+	metrics_write_label(stream, "dev", disk->sg_path, false);
+	stream_write(stream, "} 1\n", 4);
+
+	return stream->failed ? -1 : 0;
+}
+
+static int metrics_smart_ok(disk_t *disk, void *arg)
+{
+	stream_t *stream = arg;
+
+	metrics_sample(stream, "disk_smart_ok", disk);
+	stream_printf(stream, "} %d\n", disk_smart_ok(disk) ? 1 : 0);
+
+	return stream->failed ? -1 : 0;
+}
+
+static int metrics_latency_histogram(disk_t *disk, void *arg)
+{
+	stream_t *stream = arg;
+	int class, i;
+
+	for (class = 0; class < LATENCY_CLASS_COUNT; class++) {
+		latency_totals_t *totals = &disk->latency_totals[class];
+		const char *class_name = latency_class_name(class);
+		uint64_t cumulative = 0;
+
+		// Classes that were never used would only add noise
+		if (totals->count == 0)
+			continue;
+
+		for (i = 0; i < LATENCY_RANGE_COUNT; i++) {
+			cumulative += totals->hist[i];
+			metrics_sample(stream, "command_latency_seconds_bucket", disk);
+			if (i < ARRAY_SIZE(latency_bucket_bounds))
+				stream_printf(stream, ",class=\"%s\",le=\"%g\"} %"PRIu64"\n", class_name, latency_bucket_bounds[i], cumulative);
+			else
+				stream_printf(stream, ",class=\"%s\",le=\"+Inf\"} %"PRIu64"\n", class_name, cumulative);
+		}
+
+		metrics_sample(stream, "command_latency_seconds_sum", disk);
+		stream_printf(stream, ",class=\"%s\"} %.6f\n", class_name, totals->sum / 1000.0);
+		metrics_sample(stream, "command_latency_seconds_count", disk);
+		stream_printf(stream, ",class=\"%s\"} %"PRIu64"\n", class_name, totals->count);
+	}
+
+	return stream->failed ? -1 : 0;
+}
+
+static int metrics_top_latency(disk_t *disk, void *arg)
+{
+	stream_t *stream = arg;
+	int i;
+
+	// The last closed entry, a scrape sees each interval complete
+	int num_entries = ARRAY_SIZE(disk->latency.entries);
+	latency_summary_t *entry = &disk->latency.entries[(disk->latency.cur_entry + num_entries - 1) % num_entries];
+
+	for (i = 0; i < ARRAY_SIZE(entry->top_latencies); i++) {
+		metrics_sample(stream, "top_latency_seconds", disk);
+		stream_printf(stream, ",rank=\"%d\"} %.6f\n", i, entry->top_latencies[i] / 1000.0);
+	}
+
+	return stream->failed ? -1 : 0;
+}
+
+static int metrics_commands(disk_t *disk, void *arg)
+{
+	stream_t *stream = arg;
+
+	metrics_sample(stream, "commands_total", disk);
+	stream_printf(stream, "} %"PRIu64"\n", disk->commands);
+	return stream->failed ? -1 : 0;
+}
+
+static int metrics_command_errors(disk_t *disk, void *arg)
+{
+	stream_t *stream = arg;
+
+	metrics_sample(stream, "command_errors_total", disk);
+	stream_printf(stream, "} %"PRIu64"\n", disk->command_errors);
+	return stream->failed ? -1 : 0;
+}
+
+static int metrics_command_failures(disk_t *disk, void *arg)
+{
+	stream_t *stream = arg;
+
+	metrics_sample(stream, "command_failures_total", disk);
+	stream_printf(stream, "} %"PRIu64"\n", disk->command_failures);
+	return stream->failed ? -1 : 0;
+}
+
+static int metrics_smart_value(disk_t *disk, void *arg)
+{
+	stream_t *stream = arg;
+	int i;
+
+	for (i = 0; i < disk->num_smart_attrs; i++) {
+		metrics_sample(stream, "smart_attribute_value", disk);
+		stream_printf(stream, ",id=\"%u\"} %u\n", disk->smart_attrs[i].id, disk->smart_attrs[i].value);
+	}
+	return stream->failed ? -1 : 0;
+}
+
+static int metrics_smart_raw(disk_t *disk, void *arg)
+{
+	stream_t *stream = arg;
+	int i;
+
+	for (i = 0; i < disk->num_smart_attrs; i++) {
+		metrics_sample(stream, "smart_attribute_raw", disk);
+		stream_printf(stream, ",id=\"%u\"} %"PRIu64"\n", disk->smart_attrs[i].id, disk->smart_attrs[i].raw);
+	}
+	return stream->failed ? -1 : 0;
+}
+
+/* The text format wants all the samples of a family together, so every family is a pass over the disks */
+struct metrics_family {
+	const char *name;
+	const char *type;
+	const char *help;
+	disk_visit_cb_t render;
+};
+
+/* Only change when a disk changes, along with the data version of the disk manager */
+static const struct metrics_family state_families[] = {
+	{"disk_info", "gauge", "Identification of a monitored disk, join on the serial", metrics_disk_info},
+	{"disk_smart_ok", "gauge", "Whether the disk reports its SMART status as good", metrics_smart_ok},
+	{"top_latency_seconds", "gauge", "Highest latencies of the last closed latency interval", metrics_top_latency},
+	{"smart_attribute_value", "gauge", "Normalized value of an ATA SMART attribute", metrics_smart_value},
+	{"smart_attribute_raw", "gauge", "Raw value of an ATA SMART attribute", metrics_smart_raw},
+};
+
+/* Move with every command */
+static const struct metrics_family counter_families[] = {
+	{"command_latency_seconds", "histogram", "Latency of the commands sent to the disk since it was attached", metrics_latency_histogram},
+	{"commands_total", "counter", "Commands completed by the disk since it was attached", metrics_commands},
+	{"command_errors_total", "counter", "Commands that completed with an error status", metrics_command_errors},
+	{"command_failures_total", "counter", "Commands that could not be submitted or whose completion was lost", metrics_command_failures},
+};
+
+static int metrics_render_families(stream_t *stream, const struct metrics_family *families, int num_families)
+{
+	int i;
+
+	for (i = 0; i < num_families; i++) {
+		metrics_family(stream, families[i].name, families[i].type, families[i].help);
+		if (disk_manager_for_each_disk(families[i].render, stream) < 0)
+			return -1;
+	}
+
+	return stream->failed ? -1 : 0;
+}
+
+/* A histogram of the host, in seconds */
+static void metrics_delay(stream_t *stream, const char *name, const char *help, const self_delay_hist_t *delay)
+{
+	uint64_t cumulative = 0;
+	int i;
+
+	metrics_family(stream, name, "histogram", help);
+	for (i = 0; i < SELF_DELAY_BUCKETS; i++) {
+		cumulative += delay->hist[i];
+		if (i < SELF_DELAY_BUCKETS - 1)
+			stream_printf(stream, METRIC_PREFIX "%s_bucket{le=\"%g\"} %"PRIu64"\n", name, (1 << i) / 1000000.0, cumulative);
+		else
+			stream_printf(stream, METRIC_PREFIX "%s_bucket{le=\"+Inf\"} %"PRIu64"\n", name, cumulative);
+	}
+	stream_printf(stream, METRIC_PREFIX "%s_sum %.6f\n", name, delay->sum / 1000000.0);
+	stream_printf(stream, METRIC_PREFIX "%s_count %"PRIu64"\n", name, delay->count);
+}
+
+int metrics_render_state(stream_t *stream)
+{
+	metrics_family(stream, "disks", "gauge", "Number of disks being monitored");
+	stream_printf(stream, METRIC_PREFIX "disks %u\n", disk_manager_num_disks());
+
+	return metrics_render_families(stream, state_families, ARRAY_SIZE(state_families));
+}
+
+int metrics_render_counters(stream_t *stream)
+{
+	metrics_delay(stream, "probe_submit_delay_seconds", "Delay from when a probe was due until its command was written",
+			self_stats_submit_delay());
+	metrics_delay(stream, "probe_read_delay_seconds", "Delay from when a probe completion was seen until its wire read it",
+			self_stats_read_delay());
+
+	return metrics_render_families(stream, counter_families, ARRAY_SIZE(counter_families));
+}
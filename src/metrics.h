@@ -0,0 +1,17 @@
+#ifndef DISKSURVEY_METRICS_H
+#define DISKSURVEY_METRICS_H
+
+#include "stream.h"
+
+/** Prometheus text exposition of the state of all the disks. The per disk
+ * series are labelled only by the serial, the identification of the disk is in
+ * disksurvey_disk_info to keep the scrape small with many disks.
+ */
+
+/* The exposition is the two parts one after the other, each returns -1 if the stream failed */
+/* The families that only change with a disk, rendered again on a new data version */
+int metrics_render_state(stream_t *stream);
+/* The counters and histograms that move with every command, rendered again for each scrape interval */
+int metrics_render_counters(stream_t *stream);
+
+#endif
@@ -16,6 +16,6 @@ double monoclock_get(void)
 	struct timespec t;
 	clock_gettime(CLOCK_MONOTONIC, &t);
 
-	double val = (double)t.tv_sec + (double)(t.tv_nsec / 1000000000);
+	double val = (double)t.tv_sec + (double)t.tv_nsec / 1000000000.0;
 	return val;
 }
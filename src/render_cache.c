@@ -0,0 +1,92 @@
+#include "render_cache.h"
+#include "logger.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#define RENDER_STREAM_BUF_SIZE 4096
+#define GZIP_WINDOW_BITS (15 + 16)
+
+static void render_gzip(render_buf_t *buf)
+{
+	z_stream zs;
+
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, GZIP_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return;
+
+	unsigned bound = deflateBound(&zs, buf->len);
+	buf->gz_data = malloc(bound);
+	if (!buf->gz_data)
+		goto out;
+
+	zs.next_in = (unsigned char *)buf->data;
+	zs.avail_in = buf->len;
+	zs.next_out = (unsigned char *)buf->gz_data;
+	zs.avail_out = bound;
+	if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+		free(buf->gz_data);
+		buf->gz_data = NULL;
+		goto out;
+	}
+	buf->gz_len = zs.total_out;
+
+out:
+	deflateEnd(&zs);
+}
+
+static render_buf_t *render(uint64_t version, render_cb_t render_cb)
+{
+	// Kept off the wire stacks
+	static char stream_buf[RENDER_STREAM_BUF_SIZE];
+	stream_mem_t mem = { NULL, 0, 0 };
+	stream_t stream;
+
+	render_buf_t *buf = calloc(1, sizeof(*buf));
+	if (!buf)
+		return NULL;
+
+	stream_init(&stream, stream_buf, sizeof(stream_buf), stream_mem_flush, &mem);
+	render_cb(&stream);
+	if (stream_flush(&stream) < 0) {
+		wire_log(WLOG_ERR, "Failed to render response of version %"PRIu64, version);
+		free(mem.data);
+		free(buf);
+		return NULL;
+	}
+
+	buf->refs = 1;
+	buf->version = version;
+	buf->data = mem.data;
+	buf->len = mem.len;
+	render_gzip(buf);
+	return buf;
+}
+
+render_buf_t *render_cache_get(render_cache_t *cache, uint64_t version, render_cb_t render_cb)
+{
+	if (!cache->cur || cache->cur->version != version) {
+		render_buf_t *buf = render(version, render_cb);
+		if (!buf)
+			return NULL;
+
+		if (cache->cur)
+			render_buf_put(cache->cur);
+		cache->cur = buf;
+	}
+
+	cache->cur->refs++;
+	return cache->cur;
+}
+
+void render_buf_put(render_buf_t *buf)
+{
+	if (--buf->refs > 0)
+		return;
+
+	free(buf->data);
+	free(buf->gz_data);
+	free(buf);
+}
@@ -0,0 +1,32 @@
+#ifndef DISKSURVEY_RENDER_CACHE_H
+#define DISKSURVEY_RENDER_CACHE_H
+
+#include "stream.h"
+
+#include <stdint.h>
+
+/** A rendered response that stays valid as long as the data version it was
+ * rendered at. The buffers are reference counted since a connection may still
+ * be sending an old rendering when a newer one replaces it in the cache.
+ */
+
+typedef struct render_buf_t {
+	int refs;
+	uint64_t version;
+	char *data;
+	unsigned len;
+	char *gz_data; /* NULL when it couldn't be compressed */
+	unsigned gz_len;
+} render_buf_t;
+
+typedef struct render_cache_t {
+	render_buf_t *cur;
+} render_cache_t;
+
+typedef int (*render_cb_t)(stream_t *stream);
+
+/* Returns the rendering for the given version, rendering it if the cached one is older. Release with render_buf_put() */
+render_buf_t *render_cache_get(render_cache_t *cache, uint64_t version, render_cb_t render);
+void render_buf_put(render_buf_t *buf);
+
+#endif
@@ -0,0 +1,271 @@
+#include "sas_log.h"
+#include "util.h"
+
+#include <memory.h>
+
+#define LOG_PAGE_HDR_LEN 4
+#define LOG_PARAM_HDR_LEN 4
+
+#define BMS_STATUS_PARAM 0x0000
+#define BMS_RESULT_PARAM_FIRST 0x0001
+#define BMS_RESULT_PARAM_LAST 0x0800
+
+#define PERF_GENERAL_ACCESS_PARAM 0x0001
+#define PERF_IDLE_TIME_PARAM 0x0002
+
+const uint8_t sas_log_monitored_pages[] = {
+	SAS_LOG_PAGE_INFORMATIONAL_EXCEPTIONS,
+	SAS_LOG_PAGE_WRITE_ERRORS,
+	SAS_LOG_PAGE_READ_ERRORS,
+	SAS_LOG_PAGE_VERIFY_ERRORS,
+	SAS_LOG_PAGE_NON_MEDIUM_ERRORS,
+	SAS_LOG_PAGE_TEMPERATURE,
+	SAS_LOG_PAGE_BACKGROUND_SCAN,
+	SAS_LOG_PAGE_PERFORMANCE,
+	SAS_LOG_PAGE_UTILIZATION,
+};
+const unsigned sas_log_monitored_pages_count = ARRAY_SIZE(sas_log_monitored_pages);
+
+static inline uint16_t get_be16(const unsigned char *buf)
+{
+	return buf[0] << 8 | buf[1];
+}
+
+static inline uint32_t get_be32(const unsigned char *buf)
+{
+	return (uint32_t)buf[0] << 24 | buf[1] << 16 | buf[2] << 8 | buf[3];
+}
+
+static inline uint64_t get_be64(const unsigned char *buf)
+{
+	return (uint64_t)get_be32(buf) << 32 | get_be32(buf + 4);
+}
+
+/* Counters are variable length big endian, anything beyond 8 bytes keeps only the low part */
+static uint64_t get_counter(const unsigned char *buf, unsigned len)
+{
+	uint64_t val = 0;
+	unsigned i;
+
+	for (i = 0; i < len; i++)
+		val = (val << 8) | buf[i];
+	return val;
+}
+
+typedef void (*param_cb_t)(sas_log_t *log, uint8_t page, uint16_t code, const unsigned char *val, unsigned len);
+
+static bool for_each_param(const unsigned char *buf, unsigned buf_len, sas_log_t *log, param_cb_t cb)
+{
+	if (buf_len < LOG_PAGE_HDR_LEN)
+		return false;
+
+	uint8_t page = buf[0] & 0x3F;
+	unsigned page_len = get_be16(buf + 2);
+	if (page_len + LOG_PAGE_HDR_LEN > buf_len)
+		page_len = buf_len - LOG_PAGE_HDR_LEN;
+
+	const unsigned char *param = buf + LOG_PAGE_HDR_LEN;
+	const unsigned char *end = param + page_len;
+
+	while (param + LOG_PARAM_HDR_LEN <= end) {
+		uint16_t code = get_be16(param);
+		unsigned len = param[3];
+
+		if (param + LOG_PARAM_HDR_LEN + len > end)
+			break;
+
+		cb(log, page, code, param + LOG_PARAM_HDR_LEN, len);
+		param += LOG_PARAM_HDR_LEN + len;
+	}
+
+	return true;
+}
+
+static sas_err_counters_t *err_counters_for_page(sas_log_t *log, uint8_t page)
+{
+	switch (page) {
+		case SAS_LOG_PAGE_WRITE_ERRORS: return &log->write_errors;
+		case SAS_LOG_PAGE_READ_ERRORS: return &log->read_errors;
+		case SAS_LOG_PAGE_VERIFY_ERRORS: return &log->verify_errors;
+	}
+	return NULL;
+}
+
+static void parse_err_counter(sas_log_t *log, uint8_t page, uint16_t code, const unsigned char *val, unsigned len)
+{
+	sas_err_counters_t *counters = err_counters_for_page(log, page);
+	if (code < SAS_ERR_PARAM_COUNT)
+		counters->counter[code] = get_counter(val, len);
+}
+
+static void parse_non_medium(sas_log_t *log, uint8_t page, uint16_t code, const unsigned char *val, unsigned len)
+{
+	if (code == 0)
+		log->non_medium_errors = get_counter(val, len);
+}
+
+static void parse_temperature(sas_log_t *log, uint8_t page, uint16_t code, const unsigned char *val, unsigned len)
+{
+	if (len < 2)
+		return;
+
+	if (code == 0)
+		log->temperature = val[1];
+	else if (code == 1)
+		log->ref_temperature = val[1];
+}
+
+static void parse_ie(sas_log_t *log, uint8_t page, uint16_t code, const unsigned char *val, unsigned len)
+{
+	if (code != 0 || len < 3)
+		return;
+
+	log->ie_asc = val[0];
+	log->ie_ascq = val[1];
+	log->ie_temperature = val[2];
+}
+
+static void parse_background_scan(sas_log_t *log, uint8_t page, uint16_t code, const unsigned char *val, unsigned len)
+{
+	if (code == BMS_STATUS_PARAM) {
+		if (len < 12)
+			return;
+		log->bms_power_on_minutes = get_be32(val);
+		log->bms_status = val[5];
+		log->bms_scans = get_be16(val + 6);
+		log->bms_progress = get_be16(val + 8);
+		log->bms_medium_scans = get_be16(val + 10);
+	} else if (code >= BMS_RESULT_PARAM_FIRST && code <= BMS_RESULT_PARAM_LAST) {
+		log->bms_results++;
+	}
+}
+
+static void parse_performance(sas_log_t *log, uint8_t page, uint16_t code, const unsigned char *val, unsigned len)
+{
+	if (code == PERF_GENERAL_ACCESS_PARAM) {
+		if (len < 6*8)
+			return;
+		log->read_cmds = get_be64(val);
+		log->write_cmds = get_be64(val + 8);
+		log->blocks_received = get_be64(val + 16);
+		log->blocks_transmitted = get_be64(val + 24);
+		log->read_proc_intervals = get_be64(val + 32);
+		log->write_proc_intervals = get_be64(val + 40);
+	} else if (code == PERF_IDLE_TIME_PARAM) {
+		if (len < 8)
+			return;
+		log->idle_intervals = get_be64(val);
+	}
+}
+
+static void parse_utilization(sas_log_t *log, uint8_t page, uint16_t code, const unsigned char *val, unsigned len)
+{
+	if (code == 0 && len >= 2)
+		log->workload_utilization = get_be16(val);
+	else if (code == 1 && len >= 1)
+		log->utilization_rate = val[0];
+}
+
+uint64_t sas_log_parse_supported(const unsigned char *buf, unsigned buf_len)
+{
+	uint64_t pages = 0;
+	unsigned i;
+
+	if (buf_len < LOG_PAGE_HDR_LEN || (buf[0] & 0x3F) != SAS_LOG_PAGE_SUPPORTED)
+		return 0;
+
+	unsigned page_len = get_be16(buf + 2);
+	for (i = 0; i < page_len && LOG_PAGE_HDR_LEN + i < buf_len; i++)
+		pages |= 1ULL << (buf[LOG_PAGE_HDR_LEN + i] & 0x3F);
+
+	return pages;
+}
+
+bool sas_log_parse(const unsigned char *buf, unsigned buf_len, sas_log_t *log)
+{
+	param_cb_t cb;
+
+	if (buf_len < LOG_PAGE_HDR_LEN)
+		return false;
+
+	uint8_t page = buf[0] & 0x3F;
+	switch (page) {
+		case SAS_LOG_PAGE_WRITE_ERRORS:
+		case SAS_LOG_PAGE_READ_ERRORS:
+		case SAS_LOG_PAGE_VERIFY_ERRORS:
+			cb = parse_err_counter;
+			break;
+		case SAS_LOG_PAGE_NON_MEDIUM_ERRORS:
+			cb = parse_non_medium;
+			break;
+		case SAS_LOG_PAGE_TEMPERATURE:
+			cb = parse_temperature;
+			break;
+		case SAS_LOG_PAGE_INFORMATIONAL_EXCEPTIONS:
+			cb = parse_ie;
+			break;
+		case SAS_LOG_PAGE_BACKGROUND_SCAN:
+			// The result entries are counted, start afresh on every read
+			log->bms_results = 0;
+			cb = parse_background_scan;
+			break;
+		case SAS_LOG_PAGE_PERFORMANCE:
+			cb = parse_performance;
+			break;
+		case SAS_LOG_PAGE_UTILIZATION:
+			// Subpage 0 is the start-stop cycle counter
+			if (!(buf[0] & 0x40) || buf[1] != sas_log_subpage(page))
+				return false;
+			cb = parse_utilization;
+			break;
+		default:
+			return false;
+	}
+
+	if (!for_each_param(buf, buf_len, log, cb))
+		return false;
+
+	log->pages_read |= 1ULL << page;
+	return true;
+}
+
+void sas_log_update_series(const sas_log_t *log, series_set_t *set, uint32_t ts)
+{
+	static const uint8_t err_pages[] = { SAS_LOG_PAGE_WRITE_ERRORS, SAS_LOG_PAGE_READ_ERRORS, SAS_LOG_PAGE_VERIFY_ERRORS };
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(err_pages); i++) {
+		uint8_t page = err_pages[i];
+		if (!sas_log_has_page(log, page))
+			continue;
+
+		const sas_err_counters_t *counters = err_counters_for_page((sas_log_t *)log, page);
+		series_set_add(set, SAS_SERIES_ID(page, SAS_ERR_TOTAL_CORRECTED), ts, counters->counter[SAS_ERR_TOTAL_CORRECTED]);
+		series_set_add(set, SAS_SERIES_ID(page, SAS_ERR_UNCORRECTED), ts, counters->counter[SAS_ERR_UNCORRECTED]);
+	}
+
+	if (sas_log_has_page(log, SAS_LOG_PAGE_NON_MEDIUM_ERRORS))
+		series_set_add(set, SAS_SERIES_ID(SAS_LOG_PAGE_NON_MEDIUM_ERRORS, 0), ts, log->non_medium_errors);
+
+	if (sas_log_has_page(log, SAS_LOG_PAGE_TEMPERATURE))
+		series_set_add(set, SAS_SERIES_ID(SAS_LOG_PAGE_TEMPERATURE, 0), ts, log->temperature);
+
+	if (sas_log_has_page(log, SAS_LOG_PAGE_INFORMATIONAL_EXCEPTIONS))
+		series_set_add(set, SAS_SERIES_ID(SAS_LOG_PAGE_INFORMATIONAL_EXCEPTIONS, 0), ts, log->ie_asc << 8 | log->ie_ascq);
+
+	if (sas_log_has_page(log, SAS_LOG_PAGE_BACKGROUND_SCAN)) {
+		series_set_add(set, SAS_SERIES_ID(SAS_LOG_PAGE_BACKGROUND_SCAN, BMS_STATUS_PARAM), ts, log->bms_scans);
+		series_set_add(set, SAS_SERIES_ID(SAS_LOG_PAGE_BACKGROUND_SCAN, BMS_RESULT_PARAM_FIRST), ts, log->bms_results);
+	}
+
+	// The command counts and their processing intervals give the device side view of the latency
+	if (sas_log_has_page(log, SAS_LOG_PAGE_PERFORMANCE)) {
+		series_set_add(set, SAS_SERIES_ID(SAS_LOG_PAGE_PERFORMANCE, 0), ts, log->read_cmds);
+		series_set_add(set, SAS_SERIES_ID(SAS_LOG_PAGE_PERFORMANCE, 1), ts, log->write_cmds);
+		series_set_add(set, SAS_SERIES_ID(SAS_LOG_PAGE_PERFORMANCE, 4), ts, log->read_proc_intervals);
+		series_set_add(set, SAS_SERIES_ID(SAS_LOG_PAGE_PERFORMANCE, 5), ts, log->write_proc_intervals);
+	}
+
+	if (sas_log_has_page(log, SAS_LOG_PAGE_UTILIZATION))
+		series_set_add(set, SAS_SERIES_ID(SAS_LOG_PAGE_UTILIZATION, 0), ts, log->workload_utilization);
+}
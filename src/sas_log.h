@@ -0,0 +1,96 @@
+#ifndef DISKSURVEY_SAS_LOG_H
+#define DISKSURVEY_SAS_LOG_H
+
+#include "series.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum sas_log_page {
+	SAS_LOG_PAGE_SUPPORTED = 0x00,
+	SAS_LOG_PAGE_WRITE_ERRORS = 0x02,
+	SAS_LOG_PAGE_READ_ERRORS = 0x03,
+	SAS_LOG_PAGE_VERIFY_ERRORS = 0x05,
+	SAS_LOG_PAGE_NON_MEDIUM_ERRORS = 0x06,
+	SAS_LOG_PAGE_TEMPERATURE = 0x0D,
+	SAS_LOG_PAGE_UTILIZATION = 0x0E, /* subpage 0x01 */
+	SAS_LOG_PAGE_BACKGROUND_SCAN = 0x15,
+	SAS_LOG_PAGE_PERFORMANCE = 0x19,
+	SAS_LOG_PAGE_INFORMATIONAL_EXCEPTIONS = 0x2F,
+};
+
+/* Series ids of the log page parameters, they don't collide with the ATA attribute ids */
+#define SAS_SERIES_ID(page, param) (((page) << 8) | (param))
+
+/* Error counter parameters of the read/write/verify pages */
+enum sas_err_param {
+	SAS_ERR_CORRECTED_FAST = 0,
+	SAS_ERR_CORRECTED_DELAYED = 1,
+	SAS_ERR_REREADS = 2,
+	SAS_ERR_TOTAL_CORRECTED = 3,
+	SAS_ERR_ALGORITHM_PROCESSED = 4,
+	SAS_ERR_BYTES_PROCESSED = 5,
+	SAS_ERR_UNCORRECTED = 6,
+	SAS_ERR_PARAM_COUNT
+};
+
+typedef struct sas_err_counters_t {
+	uint64_t counter[SAS_ERR_PARAM_COUNT];
+} sas_err_counters_t;
+
+typedef struct sas_log_t {
+	uint64_t pages_read; /* bit per page code that was parsed successfully */
+
+	uint8_t ie_asc;
+	uint8_t ie_ascq;
+	uint8_t ie_temperature;
+
+	uint8_t temperature;
+	uint8_t ref_temperature;
+
+	sas_err_counters_t write_errors;
+	sas_err_counters_t read_errors;
+	sas_err_counters_t verify_errors;
+	uint64_t non_medium_errors;
+
+	uint32_t bms_power_on_minutes;
+	uint8_t bms_status;
+	uint16_t bms_scans;
+	uint16_t bms_progress;
+	uint16_t bms_medium_scans;
+	uint16_t bms_results;
+
+	uint64_t read_cmds;
+	uint64_t write_cmds;
+	uint64_t blocks_received;
+	uint64_t blocks_transmitted;
+	uint64_t read_proc_intervals;
+	uint64_t write_proc_intervals;
+	uint64_t idle_intervals;
+	uint16_t workload_utilization; /* in 0.01% of the rated workload */
+	uint8_t utilization_rate;
+} sas_log_t;
+
+extern const uint8_t sas_log_monitored_pages[];
+extern const unsigned sas_log_monitored_pages_count;
+
+static inline uint8_t sas_log_subpage(uint8_t page)
+{
+	return page == SAS_LOG_PAGE_UTILIZATION ? 0x01 : 0x00;
+}
+
+/* Parse the supported log pages page into a bitmap */
+uint64_t sas_log_parse_supported(const unsigned char *buf, unsigned buf_len);
+
+/* Parse a LOG SENSE reply into the typed record, the page is identified from the reply itself */
+bool sas_log_parse(const unsigned char *buf, unsigned buf_len, sas_log_t *log);
+
+/* Record the counters worth tracking over time */
+void sas_log_update_series(const sas_log_t *log, series_set_t *set, uint32_t ts);
+
+static inline bool sas_log_has_page(const sas_log_t *log, uint8_t page)
+{
+	return log->pages_read & (1ULL << (page & 0x3F));
+}
+
+#endif
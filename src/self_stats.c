@@ -0,0 +1,451 @@
+#include "self_stats.h"
+#include "alloc_track.h"
+#include "monoclock.h"
+#include "logger.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#define SELF_MAX_TIMER_BUSES 4
+#define SELF_MAX_MEMORY 8
+#define SELF_CPU_BUDGET_PERCENT 0.1 /* of a core per 100 disks */
+
+/* Upper bounds of the web request latency buckets in msecs, the last bucket has no bound */
+static const double web_request_bounds[] = {0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25, 50, 100, 250, 1000};
+#define WEB_REQUEST_BUCKETS (ARRAY_SIZE(web_request_bounds) + 1)
+
+struct self_task {
+	double cpu;
+	uint64_t sections;
+	uint64_t allocs; /* with ./configure --alloc-track only */
+	uint64_t alloc_bytes;
+};
+
+/* The cumulative counters, a copy is kept at the start of each window */
+struct self_counters {
+	double ts; /* monoclock */
+	double process_cpu;
+	double thread_cpu;
+	struct self_task tasks[SELF_TASK_COUNT];
+	uint64_t thread_allocs;
+	uint64_t probes;
+	uint64_t probe_syscalls;
+	long voluntary_switches;
+	long involuntary_switches;
+};
+
+struct self_timer_bus {
+	const char *name;
+	timer_bus_t *tbus;
+};
+
+struct self_memory {
+	const char *name;
+	self_mem_cb_t cb;
+};
+
+struct self_stats {
+	struct self_counters start; /* only the time, the counters start at zero */
+	struct self_counters cur;
+	struct self_counters window_start;
+	struct self_counters last_window; /* the deltas of the last complete window */
+	bool have_window;
+
+	struct self_timer_bus timer_buses[SELF_MAX_TIMER_BUSES];
+	int num_timer_buses;
+	struct self_memory memory[SELF_MAX_MEMORY];
+	int num_memory;
+
+	uint64_t saves;
+	uint64_t saves_failed;
+	bool save_running;
+	double last_fork_msecs;
+	double max_fork_msecs;
+	double last_save_msecs;
+	double max_save_msecs;
+
+	self_delay_hist_t submit_delay;
+	self_delay_hist_t read_delay;
+
+	uint64_t web_requests;
+	double web_request_sum;
+	double web_request_max;
+	uint64_t web_request_hist[WEB_REQUEST_BUCKETS];
+};
+static struct self_stats self;
+
+static const char *task_names[SELF_TASK_COUNT] = {
+	[SELF_TASK_PROBE] = "probe",
+	[SELF_TASK_MONITOR] = "monitor",
+	[SELF_TASK_TICK] = "tick",
+	[SELF_TASK_RESCAN] = "rescan",
+	[SELF_TASK_WEB] = "web",
+	[SELF_TASK_SAVE] = "save",
+};
+
+static double cpu_clock(clockid_t clock)
+{
+	struct timespec ts;
+	if (clock_gettime(clock, &ts) < 0)
+		return 0;
+	return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+void self_stats_init(void)
+{
+	self.start.ts = self.cur.ts = monoclock_get();
+	self.window_start = self.cur;
+}
+
+void self_cpu_start(self_cpu_t *cpu)
+{
+	cpu->start = cpu_clock(CLOCK_THREAD_CPUTIME_ID);
+	alloc_track_get(&cpu->alloc);
+}
+
+void self_cpu_stop(self_cpu_t *cpu, self_task_e task)
+{
+	if (cpu->start == 0)
+		return;
+
+	struct self_task *t = &self.cur.tasks[task];
+	alloc_count_t alloc;
+	alloc_track_get(&alloc);
+	t->cpu += cpu_clock(CLOCK_THREAD_CPUTIME_ID) - cpu->start;
+	t->sections++;
+	t->allocs += alloc.allocs - cpu->alloc.allocs;
+	t->alloc_bytes += alloc.bytes - cpu->alloc.bytes;
+	cpu->start = 0;
+}
+
+void self_stats_probe(unsigned syscalls)
+{
+	self.cur.probes++;
+	self.cur.probe_syscalls += syscalls;
+}
+
+static void self_delay_add(self_delay_hist_t *delay, double secs)
+{
+	double usecs = secs > 0 ? secs * 1000000.0 : 0;
+	unsigned bucket = 0;
+
+	while (bucket < SELF_DELAY_BUCKETS - 1 && usecs > (double)(1 << bucket))
+		bucket++;
+	delay->hist[bucket]++;
+	delay->count++;
+	delay->sum += usecs;
+	delay->max = MAX(delay->max, usecs);
+}
+
+void self_stats_probe_delay(double submit_delay, double read_delay)
+{
+	self_delay_add(&self.submit_delay, submit_delay);
+	self_delay_add(&self.read_delay, read_delay);
+}
+
+const self_delay_hist_t *self_stats_submit_delay(void)
+{
+	return &self.submit_delay;
+}
+
+const self_delay_hist_t *self_stats_read_delay(void)
+{
+	return &self.read_delay;
+}
+
+void self_stats_timer_bus(const char *name, timer_bus_t *tbus)
+{
+	if (self.num_timer_buses == SELF_MAX_TIMER_BUSES)
+		return;
+	self.timer_buses[self.num_timer_buses].name = name;
+	self.timer_buses[self.num_timer_buses].tbus = tbus;
+	self.num_timer_buses++;
+}
+
+void self_stats_memory(const char *name, self_mem_cb_t cb)
+{
+	if (self.num_memory == SELF_MAX_MEMORY)
+		return;
+	self.memory[self.num_memory].name = name;
+	self.memory[self.num_memory].cb = cb;
+	self.num_memory++;
+}
+
+void self_stats_save_forked(double fork_msecs)
+{
+	self.save_running = true;
+	self.last_fork_msecs = fork_msecs;
+	self.max_fork_msecs = MAX(self.max_fork_msecs, fork_msecs);
+}
+
+void self_stats_save_done(double msecs, bool ok)
+{
+	self.save_running = false;
+	self.saves++;
+	if (!ok)
+		self.saves_failed++;
+	self.last_save_msecs = msecs;
+	self.max_save_msecs = MAX(self.max_save_msecs, msecs);
+}
+
+void self_stats_web_request(double msecs)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(web_request_bounds) && msecs > web_request_bounds[i]; i++)
+		;
+	self.web_request_hist[i]++;
+	self.web_requests++;
+	self.web_request_sum += msecs;
+	self.web_request_max = MAX(self.web_request_max, msecs);
+}
+
+/* The clocks are read when needed, the task counters are kept up to date as they go */
+static void self_stats_sample(void)
+{
+	struct rusage usage;
+	alloc_count_t alloc;
+
+	self.cur.ts = monoclock_get();
+	self.cur.process_cpu = cpu_clock(CLOCK_PROCESS_CPUTIME_ID);
+	self.cur.thread_cpu = cpu_clock(CLOCK_THREAD_CPUTIME_ID);
+	alloc_track_get(&alloc);
+	self.cur.thread_allocs = alloc.allocs;
+	if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+		self.cur.voluntary_switches = usage.ru_nvcsw;
+		self.cur.involuntary_switches = usage.ru_nivcsw;
+	}
+}
+
+static void self_counters_sub(struct self_counters *res, const struct self_counters *a, const struct self_counters *b)
+{
+	int i;
+
+	res->ts = a->ts - b->ts;
+	res->process_cpu = a->process_cpu - b->process_cpu;
+	res->thread_cpu = a->thread_cpu - b->thread_cpu;
+	for (i = 0; i < SELF_TASK_COUNT; i++) {
+		res->tasks[i].cpu = a->tasks[i].cpu - b->tasks[i].cpu;
+		res->tasks[i].sections = a->tasks[i].sections - b->tasks[i].sections;
+		res->tasks[i].allocs = a->tasks[i].allocs - b->tasks[i].allocs;
+		res->tasks[i].alloc_bytes = a->tasks[i].alloc_bytes - b->tasks[i].alloc_bytes;
+	}
+	res->thread_allocs = a->thread_allocs - b->thread_allocs;
+	res->probes = a->probes - b->probes;
+	res->probe_syscalls = a->probe_syscalls - b->probe_syscalls;
+	res->voluntary_switches = a->voluntary_switches - b->voluntary_switches;
+	res->involuntary_switches = a->involuntary_switches - b->involuntary_switches;
+}
+
+void self_stats_tick(void)
+{
+	self_stats_sample();
+	self_counters_sub(&self.last_window, &self.cur, &self.window_start);
+	self.window_start = self.cur;
+	self.have_window = true;
+}
+
+size_t self_stats_resident(const void *addr, size_t len)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)addr & ~(page_size - 1);
+	size_t num_pages = ((uintptr_t)addr + len - start + page_size - 1) / page_size;
+	unsigned char vec[256];
+	size_t resident = 0;
+	size_t page;
+
+	// In chunks to keep the vector on the stack
+	for (page = 0; page < num_pages; page += sizeof(vec)) {
+		size_t chunk = MIN(num_pages - page, sizeof(vec));
+		if (mincore((void *)(start + page * page_size), chunk * page_size, vec) < 0)
+			return 0;
+
+		size_t i;
+		for (i = 0; i < chunk; i++)
+			resident += vec[i] & 1;
+	}
+
+	return MIN(resident * page_size, len);
+}
+
+/* From procfs, the read never waits on a disk */
+static size_t self_rss(void)
+{
+	char buf[128];
+	unsigned long size, resident;
+
+	int fd = open("/proc/self/statm", O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	ssize_t len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len <= 0)
+		return 0;
+	buf[len] = 0;
+
+	if (sscanf(buf, "%lu %lu", &size, &resident) != 2)
+		return 0;
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+static int self_counters_json(json_t *json, const char *name, const struct self_counters *c, unsigned num_disks)
+{
+	double tasks_cpu = 0;
+	uint64_t tasks_allocs = 0;
+	int i;
+
+	json_object_start(json, name);
+	json_double(json, "secs", c->ts);
+
+	// CPU times in msecs
+	json_double(json, "process_cpu", c->process_cpu * 1000.0);
+	json_double(json, "wire_thread_cpu", c->thread_cpu * 1000.0);
+	json_object_start(json, "tasks");
+	for (i = 0; i < SELF_TASK_COUNT; i++) {
+		json_object_start(json, task_names[i]);
+		json_double(json, "cpu", c->tasks[i].cpu * 1000.0);
+		json_uint(json, "sections", c->tasks[i].sections);
+		if (ALLOC_TRACK_ENABLED) {
+			json_uint(json, "allocs", c->tasks[i].allocs);
+			json_uint(json, "alloc_bytes", c->tasks[i].alloc_bytes);
+		}
+		json_object_end(json);
+		tasks_cpu += c->tasks[i].cpu;
+		tasks_allocs += c->tasks[i].allocs;
+	}
+	json_object_end(json);
+	// The wire scheduler, the timer buses, the event stream and the logging
+	json_double(json, "other_cpu", (c->thread_cpu - tasks_cpu) * 1000.0);
+	if (ALLOC_TRACK_ENABLED)
+		json_uint(json, "other_allocs", c->thread_allocs - tasks_allocs);
+
+	double cpu_percent = c->ts > 0 ? c->process_cpu / c->ts * 100.0 : 0;
+	json_double(json, "cpu_percent", cpu_percent);
+	if (num_disks > 0) {
+		double per_100_disks = cpu_percent * 100.0 / num_disks;
+		json_double(json, "cpu_percent_per_100_disks", per_100_disks);
+		json_bool(json, "within_budget", per_100_disks < SELF_CPU_BUDGET_PERCENT);
+	}
+
+	json_uint(json, "probes", c->probes);
+	if (c->probes > 0) {
+		json_double(json, "probe_cpu_usecs", c->tasks[SELF_TASK_PROBE].cpu * 1000000.0 / c->probes);
+		json_double(json, "syscalls_per_probe", (double)c->probe_syscalls / c->probes);
+		json_double(json, "context_switches_per_probe", (double)(c->voluntary_switches + c->involuntary_switches) / c->probes);
+	}
+	// The wire thread sleeps only in epoll, each sleep is a voluntary switch
+	json_int(json, "epoll_wakeups", c->voluntary_switches);
+	json_int(json, "preemptions", c->involuntary_switches);
+	return json_object_end(json);
+}
+
+static void self_delay_json(json_t *json, const char *name, const self_delay_hist_t *delay)
+{
+	int i;
+
+	// In usecs, the upper bounds of the buckets are the powers of two
+	json_object_start(json, name);
+	json_uint(json, "count", delay->count);
+	json_double(json, "sum", delay->sum);
+	json_double(json, "max", delay->max);
+	json_array_start(json, "histogram");
+	for (i = 0; i < SELF_DELAY_BUCKETS; i++)
+		json_uint(json, NULL, delay->hist[i]);
+	json_array_end(json);
+	json_object_end(json);
+}
+
+int self_stats_json(json_t *json, unsigned num_disks)
+{
+	struct self_counters total;
+	int i;
+
+	self_stats_sample();
+	self_counters_sub(&total, &self.cur, &self.start);
+
+	json_object_start(json, NULL);
+	json_uint(json, "disks", num_disks);
+	json_double(json, "budget_percent_per_100_disks", SELF_CPU_BUDGET_PERCENT);
+
+	// Since the start, and over the last complete window which leaves out the startup scan
+	self_counters_json(json, "total", &total, num_disks);
+	if (self.have_window)
+		self_counters_json(json, "window", &self.last_window, num_disks);
+
+	// Lag of the ticks behind their schedule, in msecs
+	json_array_start(json, "timer_buses");
+	for (i = 0; i < self.num_timer_buses; i++) {
+		timer_bus_t *tbus = self.timer_buses[i].tbus;
+
+		json_object_start(json, NULL);
+		json_str(json, "name", self.timer_buses[i].name);
+		json_uint(json, "unit", tbus->time_unit_msec);
+		json_uint(json, "expirations", tbus->expirations);
+		json_uint(json, "overruns", tbus->overruns);
+		if (tbus->lag_count > 0)
+			json_double(json, "lag_avg", tbus->lag_sum / tbus->lag_count * 1000.0);
+		json_double(json, "lag_max", tbus->lag_max * 1000.0);
+		json_object_end(json);
+	}
+	json_array_end(json);
+
+	json_object_start(json, "save");
+	json_uint(json, "count", self.saves);
+	json_uint(json, "failed", self.saves_failed);
+	json_bool(json, "running", self.save_running);
+	json_double(json, "last_fork", self.last_fork_msecs);
+	json_double(json, "max_fork", self.max_fork_msecs);
+	json_double(json, "last_duration", self.last_save_msecs);
+	json_double(json, "max_duration", self.max_save_msecs);
+	json_object_end(json);
+
+	json_object_start(json, "probe_delay");
+	self_delay_json(json, "submit", &self.submit_delay);
+	self_delay_json(json, "read", &self.read_delay);
+	json_object_end(json);
+
+	// From the first byte of the request until the response was written, in msecs
+	json_object_start(json, "web_requests");
+	json_uint(json, "count", self.web_requests);
+	json_double(json, "sum", self.web_request_sum);
+	json_double(json, "max", self.web_request_max);
+	json_array_start(json, "bounds");
+	for (i = 0; i < ARRAY_SIZE(web_request_bounds); i++)
+		json_double(json, NULL, web_request_bounds[i]);
+	json_array_end(json);
+	json_array_start(json, "histogram");
+	for (i = 0; i < WEB_REQUEST_BUCKETS; i++)
+		json_uint(json, NULL, self.web_request_hist[i]);
+	json_array_end(json);
+	json_object_end(json);
+
+	logger_counters_t log;
+	logger_counters(&log);
+	json_object_start(json, "log");
+	json_uint(json, "written", log.written);
+	json_uint(json, "dropped", log.dropped);
+	json_uint(json, "suppressed", log.suppressed);
+	json_object_end(json);
+
+	json_object_start(json, "memory");
+	json_uint(json, "rss", self_rss());
+	for (i = 0; i < self.num_memory; i++) {
+		self_mem_t mem = { 0, 0 };
+		self.memory[i].cb(&mem);
+
+		json_object_start(json, self.memory[i].name);
+		json_uint(json, "reserved", mem.reserved);
+		json_uint(json, "resident", mem.resident);
+		json_object_end(json);
+	}
+	json_object_end(json);
+
+	return json_object_end(json);
+}
@@ -0,0 +1,82 @@
+#ifndef DISKSURVEY_SELF_STATS_H
+#define DISKSURVEY_SELF_STATS_H
+
+#include "alloc_track.h"
+#include "json.h"
+#include "timer_bus.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** What the daemon itself costs, served at /api/self. All the counters are
+ * only touched from the wire thread so they are plain fields without atomics.
+ * The CPU time of the wire thread is charged to a task between
+ * self_cpu_start() and self_cpu_stop(), the wires share the thread so a
+ * section must be stopped before its wire may yield. Reading the thread CPU
+ * clock costs well under a microsecond, the probe path takes two sections.
+ * With allocation tracking built in the heap allocations of a section are
+ * charged to its task as well.
+ */
+
+typedef enum self_task_e {
+	SELF_TASK_PROBE, /* the liveness probes (TUR) */
+	SELF_TASK_MONITOR, /* SMART and log pages */
+	SELF_TASK_TICK, /* closing the latency buckets */
+	SELF_TASK_RESCAN,
+	SELF_TASK_WEB,
+	SELF_TASK_SAVE, /* the parent side, mostly the fork */
+	SELF_TASK_COUNT,
+} self_task_e;
+
+typedef struct self_cpu_t {
+	double start; /* thread CPU seconds, 0 when stopped */
+	alloc_count_t alloc; /* of the thread at the start */
+} self_cpu_t;
+
+/* Memory of a subsystem and how much of it is resident, in bytes */
+typedef struct self_mem_t {
+	size_t reserved;
+	size_t resident;
+} self_mem_t;
+
+typedef void (*self_mem_cb_t)(self_mem_t *mem);
+
+/* Delays in usecs, bucket i holds those up to 2^i usecs and the last one the rest */
+#define SELF_DELAY_BUCKETS 21
+
+typedef struct self_delay_hist_t {
+	uint64_t count;
+	double sum;
+	double max;
+	uint64_t hist[SELF_DELAY_BUCKETS];
+} self_delay_hist_t;
+
+void self_stats_init(void);
+
+void self_cpu_start(self_cpu_t *cpu);
+void self_cpu_stop(self_cpu_t *cpu, self_task_e task);
+
+/* A probe got its answer with the given number of syscalls on its path */
+void self_stats_probe(unsigned syscalls);
+/* What the daemon added to a probe, in seconds: from when it was due until the command was written,
+ * and from when the completion was seen until the wire read it */
+void self_stats_probe_delay(double submit_delay, double read_delay);
+const self_delay_hist_t *self_stats_submit_delay(void);
+const self_delay_hist_t *self_stats_read_delay(void);
+void self_stats_timer_bus(const char *name, timer_bus_t *tbus);
+/* A subsystem reports its memory when the stats are read */
+void self_stats_memory(const char *name, self_mem_cb_t cb);
+void self_stats_save_forked(double fork_msecs);
+void self_stats_save_done(double msecs, bool ok);
+void self_stats_web_request(double msecs);
+/* Closes the window the recent CPU usage is computed over, called every DISK_TICK_SECS */
+void self_stats_tick(void);
+
+/* Resident part of a memory range */
+size_t self_stats_resident(const void *addr, size_t len);
+
+/* The CPU usage is also given per 100 of the disks */
+int self_stats_json(json_t *json, unsigned num_disks);
+
+#endif
@@ -0,0 +1,119 @@
+#include "sense_stats.h"
+#include "util.h"
+
+#include "scsicmd.h"
+
+#include <memory.h>
+
+static inline bool outcome_equal(const sense_outcome_t *a, const sense_outcome_t *b)
+{
+	return a->status == b->status &&
+	       a->host_status == b->host_status &&
+	       a->driver_status == b->driver_status &&
+	       a->sense_key == b->sense_key &&
+	       a->asc == b->asc &&
+	       a->ascq == b->ascq;
+}
+
+static unsigned outcome_hash(const sense_outcome_t *outcome)
+{
+	uint32_t key = outcome->sense_key << 24 | outcome->asc << 16 | outcome->ascq << 8 | outcome->status;
+	key ^= outcome->host_status << 20 ^ outcome->driver_status << 4;
+	return (key * 2654435761U) >> (32 - 4);
+}
+
+void sense_outcome_classify(sense_outcome_t *outcome, uint8_t status, uint16_t host_status, uint16_t driver_status,
+                            const unsigned char *sense, int sense_len)
+{
+	sense_info_t info;
+
+	memset(outcome, 0, sizeof(*outcome));
+	outcome->status = status;
+	outcome->host_status = host_status;
+	outcome->driver_status = driver_status;
+	outcome->sense_key = SENSE_STATS_NO_SENSE;
+
+	if (sense_len > 0 && scsi_parse_sense(sense, sense_len, &info)) {
+		outcome->sense_key = info.sense_key;
+		outcome->asc = info.asc;
+		outcome->ascq = info.ascq;
+	}
+}
+
+/* Open addressing with linear probing, the table is tiny so a miss costs at most a few cache lines */
+static sense_count_t *window_slot(sense_window_t *window, const sense_outcome_t *outcome)
+{
+	unsigned idx = outcome_hash(outcome) % SENSE_STATS_SLOTS;
+	unsigned i;
+
+	for (i = 0; i < SENSE_STATS_SLOTS; i++) {
+		sense_count_t *count = &window->counts[(idx + i) % SENSE_STATS_SLOTS];
+		if (!count->used) {
+			count->used = true;
+			count->outcome = *outcome;
+			return count;
+		}
+		if (outcome_equal(&count->outcome, outcome))
+			return count;
+	}
+
+	return NULL;
+}
+
+static sense_window_t *current_window(sense_stats_t *stats, uint32_t ts)
+{
+	uint32_t start_ts = ts - ts % SENSE_STATS_WINDOW_MINUTES;
+	sense_window_t *window = &stats->windows[stats->cur_window];
+
+	if (window->start_ts != start_ts) {
+		if (window->start_ts != 0) {
+			stats->cur_window = (stats->cur_window + 1) % SENSE_STATS_WINDOWS;
+			window = &stats->windows[stats->cur_window];
+		}
+		memset(window, 0, sizeof(*window));
+		window->start_ts = start_ts;
+	}
+
+	return window;
+}
+
+void sense_stats_record(sense_stats_t *stats, const sense_outcome_t *outcome, uint32_t ts)
+{
+	sense_window_t *window = current_window(stats, ts);
+
+	window->total++;
+	if (sense_outcome_ok(outcome) && outcome->sense_key == SENSE_STATS_NO_SENSE)
+		return;
+
+	sense_count_t *count = window_slot(window, outcome);
+	if (!count) {
+		window->overflow++;
+		return;
+	}
+
+	count->count++;
+	count->last_ts = ts;
+}
+
+bool sense_stats_restore(sense_window_t *window, const sense_outcome_t *outcome, uint32_t count, uint32_t last_ts)
+{
+	sense_count_t *slot = window_slot(window, outcome);
+	if (!slot)
+		return false;
+
+	slot->count = count;
+	slot->last_ts = last_ts;
+	return true;
+}
+
+void sense_outcome_json(json_t *json, const sense_outcome_t *outcome)
+{
+	json_uint(json, "status", outcome->status);
+	json_uint(json, "host_status", outcome->host_status);
+	json_uint(json, "driver_status", outcome->driver_status);
+	if (outcome->sense_key != SENSE_STATS_NO_SENSE) {
+		json_uint(json, "sense_key", outcome->sense_key);
+		json_uint(json, "asc", outcome->asc);
+		json_uint(json, "ascq", outcome->ascq);
+	}
+}
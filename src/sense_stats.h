@@ -0,0 +1,75 @@
+#ifndef DISKSURVEY_SENSE_STATS_H
+#define DISKSURVEY_SENSE_STATS_H
+
+#include "json.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** Counts of the command completions of a disk, grouped by outcome. An
+ * outcome is the SCSI status, the host and driver status of the SG layer and
+ * when sense data was returned the sense key, ASC and ASCQ. Successful
+ * completions are only counted, failures are kept in a small hash table per
+ * window so that the memory per disk is fixed and an update never scans the
+ * whole table. When a window has more distinct outcomes than slots the rest
+ * are counted as overflow.
+ */
+
+#define SENSE_STATS_SLOTS 16
+#define SENSE_STATS_WINDOWS 8
+#define SENSE_STATS_WINDOW_MINUTES (24*60)
+
+#define SENSE_STATS_NO_SENSE 0xFF
+
+typedef struct sense_outcome_t {
+	uint8_t status;
+	uint8_t host_status;
+	uint8_t driver_status;
+	uint8_t sense_key; /* SENSE_STATS_NO_SENSE when there was no parsable sense data */
+	uint8_t asc;
+	uint8_t ascq;
+} sense_outcome_t;
+
+typedef struct sense_count_t {
+	sense_outcome_t outcome;
+	bool used;
+	uint32_t count;
+	uint32_t last_ts;
+} sense_count_t;
+
+typedef struct sense_window_t {
+	uint32_t start_ts;
+	uint32_t total;
+	uint32_t overflow;
+	sense_count_t counts[SENSE_STATS_SLOTS];
+} sense_window_t;
+
+typedef struct sense_stats_t {
+	int cur_window;
+	sense_window_t windows[SENSE_STATS_WINDOWS];
+} sense_stats_t;
+
+static inline bool sense_outcome_ok(const sense_outcome_t *outcome)
+{
+	return outcome->status == 0 && outcome->host_status == 0 && outcome->driver_status == 0;
+}
+
+/* Classify a completion from the SG header fields and its sense buffer */
+void sense_outcome_classify(sense_outcome_t *outcome, uint8_t status, uint16_t host_status, uint16_t driver_status,
+                            const unsigned char *sense, int sense_len);
+
+/* Timestamps are in minutes as returned by series_now() */
+void sense_stats_record(sense_stats_t *stats, const sense_outcome_t *outcome, uint32_t ts);
+
+/* Insert a persisted count into a window, returns false when there is no room */
+bool sense_stats_restore(sense_window_t *window, const sense_outcome_t *outcome, uint32_t count, uint32_t last_ts);
+
+/* The members of an outcome, the sense data only when there was some */
+void sense_outcome_json(json_t *json, const sense_outcome_t *outcome);
+
+/* Windows from the oldest to the newest, skipping the ones that were never used */
+#define for_each_sense_window(_stats_, _i_, _window_) \
+	for (_i_ = 0; _i_ < SENSE_STATS_WINDOWS; _i_++) \
+		if (((_window_) = &(_stats_)->windows[((_stats_)->cur_window + 1 + _i_) % SENSE_STATS_WINDOWS])->start_ts != 0)
+
+#endif
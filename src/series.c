@@ -0,0 +1,196 @@
+#include "series.h"
+#include "util.h"
+
+#include <memory.h>
+#include <time.h>
+
+#define RUN_MAX_SIZE (10+5+10)
+
+uint32_t series_now(void)
+{
+	return time(NULL) / 60;
+}
+
+static unsigned varint_put(unsigned char *buf, uint64_t val)
+{
+	unsigned len = 0;
+
+	while (val >= 0x80) {
+		buf[len++] = (val & 0x7F) | 0x80;
+		val >>= 7;
+	}
+	buf[len++] = val;
+	return len;
+}
+
+static unsigned varint_get(const unsigned char *buf, unsigned len, uint64_t *val)
+{
+	unsigned i;
+	uint64_t result = 0;
+
+	for (i = 0; i < len && i < 10; i++) {
+		result |= (uint64_t)(buf[i] & 0x7F) << (7*i);
+		if ((buf[i] & 0x80) == 0) {
+			*val = result;
+			return i+1;
+		}
+	}
+
+	// Truncated or corrupted data
+	return 0;
+}
+
+static inline uint64_t zigzag_encode(int64_t val)
+{
+	return ((uint64_t)val << 1) ^ (uint64_t)(val >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t val)
+{
+	return (int64_t)(val >> 1) ^ -(int64_t)(val & 1);
+}
+
+static unsigned run_encode(unsigned char *buf, const series_run_t *run)
+{
+	unsigned len = 0;
+	len += varint_put(buf + len, run->count);
+	len += varint_put(buf + len, run->dt);
+	len += varint_put(buf + len, zigzag_encode(run->dv));
+	return len;
+}
+
+bool series_next_run(const series_t *series, unsigned *offset, series_run_t *run)
+{
+	uint64_t count, dt, dv;
+	unsigned off = *offset;
+	unsigned n;
+
+	if (off >= series->len)
+		return false;
+
+	n = varint_get(series->data + off, series->len - off, &count);
+	if (n == 0)
+		return false;
+	off += n;
+
+	n = varint_get(series->data + off, series->len - off, &dt);
+	if (n == 0)
+		return false;
+	off += n;
+
+	n = varint_get(series->data + off, series->len - off, &dv);
+	if (n == 0)
+		return false;
+	off += n;
+
+	run->count = count;
+	run->dt = dt;
+	run->dv = zigzag_decode(dv);
+	*offset = off;
+	return true;
+}
+
+/* Fold the oldest run into the base value of the series to make room for new data */
+static void series_drop_oldest(series_t *series)
+{
+	series_run_t run;
+	unsigned off = 0;
+
+	if (!series_next_run(series, &off, &run)) {
+		// Corrupted, start over from the last known value
+		off = series->len;
+		series->first_ts = series->last_ts;
+		series->first_val = series->last_val;
+	} else {
+		series->first_ts += run.count * run.dt;
+		series->first_val += run.count * run.dv;
+	}
+
+	memmove(series->data, series->data + off, series->len - off);
+	series->len -= off;
+	series->last_rec_off = series->last_rec_off >= off ? series->last_rec_off - off : 0;
+}
+
+bool series_empty(const series_t *series)
+{
+	return series->first_ts == 0;
+}
+
+void series_add(series_t *series, uint32_t ts, int64_t val)
+{
+	if (series_empty(series)) {
+		series->first_ts = series->last_ts = series->last_seen_ts = ts;
+		series->first_val = series->last_val = val;
+		series->len = series->last_rec_off = 0;
+		return;
+	}
+
+	if (ts < series->last_seen_ts)
+		return; // Clock went backwards, keep the history monotonic
+	series->last_seen_ts = ts;
+
+	if (val == series->last_val)
+		return;
+
+	series_run_t run = { .count = 1, .dt = ts - series->last_ts, .dv = val - series->last_val };
+
+	// Extend the last run if this sample continues it
+	if (series->len > 0) {
+		series_run_t last;
+		unsigned off = series->last_rec_off;
+		if (series_next_run(series, &off, &last) && last.dt == run.dt && last.dv == run.dv) {
+			run.count = last.count + 1;
+			series->len = series->last_rec_off;
+		}
+	}
+
+	unsigned char rec[RUN_MAX_SIZE];
+	unsigned rec_len = run_encode(rec, &run);
+
+	while (series->len + rec_len > SERIES_DATA_SIZE)
+		series_drop_oldest(series);
+
+	series->last_rec_off = series->len;
+	memcpy(series->data + series->len, rec, rec_len);
+	series->len += rec_len;
+
+	series->last_ts = ts;
+	series->last_val = val;
+}
+
+series_t *series_set_find(series_set_t *set, uint16_t id)
+{
+	series_t *series;
+
+	for_each_series(set, series) {
+		if (series->id == id)
+			return series;
+	}
+
+	return NULL;
+}
+
+series_t *series_set_get(series_set_t *set, uint16_t id)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(set->series); i++) {
+		series_t *series = &set->series[i];
+		if (series->id == id)
+			return series;
+		if (series->id == 0) {
+			memset(series, 0, sizeof(*series));
+			series->id = id;
+			return series;
+		}
+	}
+
+	return NULL;
+}
+
+void series_set_add(series_set_t *set, uint16_t id, uint32_t ts, int64_t val)
+{
+	series_t *series = series_set_get(set, id);
+	if (series)
+		series_add(series, ts, val);
+}
@@ -0,0 +1,60 @@
+#ifndef DISKSURVEY_SERIES_H
+#define DISKSURVEY_SERIES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/** A series keeps the history of a single counter or gauge in a small fixed
+ * buffer. Only changes are stored, each record is a run of samples:
+ *
+ *   varint(count) varint(dt) zigzag-varint(dv)
+ *
+ * meaning `count` consecutive samples, each dt minutes after the previous one
+ * and dv larger than it. Steadily increasing counters (power on hours) collapse
+ * into a single run, counters that rarely change (reallocated sectors) cost a
+ * few bytes per change. When the buffer fills up the oldest records are
+ * folded into the base value so the most recent history is always kept.
+ */
+
+#define SERIES_DATA_SIZE 512
+#define SERIES_SET_SIZE 48
+
+typedef struct series_t {
+	uint16_t id;
+	uint16_t len;
+	uint16_t last_rec_off;
+	uint32_t first_ts;
+	uint32_t last_ts;
+	uint32_t last_seen_ts;
+	int64_t first_val;
+	int64_t last_val;
+	unsigned char data[SERIES_DATA_SIZE];
+} series_t;
+
+typedef struct series_set_t {
+	series_t series[SERIES_SET_SIZE];
+} series_set_t;
+
+typedef struct series_run_t {
+	uint32_t count;
+	uint32_t dt;
+	int64_t dv;
+} series_run_t;
+
+/* Timestamps are kept in minutes since the epoch */
+uint32_t series_now(void);
+
+void series_add(series_t *series, uint32_t ts, int64_t val);
+bool series_empty(const series_t *series);
+
+/* Iterate the runs of a series, offset starts at zero and is advanced by each call */
+bool series_next_run(const series_t *series, unsigned *offset, series_run_t *run);
+
+series_t *series_set_get(series_set_t *set, uint16_t id);
+series_t *series_set_find(series_set_t *set, uint16_t id);
+void series_set_add(series_set_t *set, uint16_t id, uint32_t ts, int64_t val);
+
+#define for_each_series(_set_, _series_) \
+	for (_series_ = &(_set_)->series[0]; _series_ < &(_set_)->series[SERIES_SET_SIZE] && _series_->id != 0; _series_++)
+
+#endif
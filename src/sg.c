@@ -1,10 +1,13 @@
 #include "sg.h"
 #include "monoclock.h"
+#include "wire.h"
 #include "wire_fd.h"
-#include "wire_log.h"
+#include "logger.h"
 #include "wire_io.h"
+#include "wire_stack.h"
 
 #include <memory.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -13,9 +16,70 @@
 #include <stdio.h>
 #include <errno.h>
 
+#define SG_DISPATCH_EVENTS 64
+
+/** The completions of all the devices are reported through one epoll set so
+ * that the time a completion became readable is taken as soon as the wire
+ * thread sees it, before the wire of the device gets to run. The devices are
+ * registered edge triggered once when opened, a request only waits on its
+ * device and costs no epoll_ctl.
+ */
+struct sg_dispatch {
+	bool init;
+	int epoll_fd;
+	wire_t wire;
+};
+static struct sg_dispatch dispatch;
+
+static void sg_dispatch_wire(void *arg)
+{
+	wire_fd_state_t fd_state;
+	struct epoll_event events[SG_DISPATCH_EVENTS];
+
+	UNUSED(arg);
+	wire_fd_mode_init(&fd_state, dispatch.epoll_fd);
+
+	while (1) {
+		wire_fd_mode_read(&fd_state);
+		wire_fd_wait(&fd_state);
+		wire_wait_reset(&fd_state.wait);
+
+		int num_events;
+		do {
+			num_events = epoll_wait(dispatch.epoll_fd, events, SG_DISPATCH_EVENTS, 0);
+			double now = monoclock_get();
+
+			int i;
+			for (i = 0; i < num_events; i++) {
+				sg_t *sg = events[i].data.ptr;
+				sg->readable = now;
+				wire_wait_resume(&sg->ready);
+			}
+		} while (num_events == SG_DISPATCH_EVENTS);
+	}
+}
+
+static bool sg_dispatch_init(void)
+{
+	if (dispatch.init)
+		return true;
+
+	dispatch.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (dispatch.epoll_fd < 0) {
+		wire_log(WLOG_ERR, "Failed to create the completion epoll: %m");
+		return false;
+	}
+
+	wire_init(&dispatch.wire, "sg dispatch", sg_dispatch_wire, NULL, WIRE_STACK_ALLOC(4096));
+	dispatch.init = true;
+	return true;
+}
+
 static int submit_request(sg_t *sg, sg_request_t *request)
 {
 	request->hdr.usr_ptr = request;
+	request->readable = 0;
+	request->syscalls = 1;
 	request->start = monoclock_get();
 	ssize_t ret = write(sg->sg_fd, &request->hdr, sizeof(request->hdr));
 	if (ret == sizeof(request->hdr)) {
@@ -41,17 +105,31 @@ static void set_nonblock(int fd)
 
 bool sg_init(sg_t *sg, const char *sg_path)
 {
+	if (!sg_dispatch_init())
+		return false;
+
 	sg->sg_fd = wio_open(sg_path, O_RDWR|O_CLOEXEC, 0);
 	if (sg->sg_fd < 0)
 		return false;
 
 	set_nonblock(sg->sg_fd);
+	wire_wait_init(&sg->ready);
+	sg->readable = 0;
+
+	struct epoll_event event = { .events = EPOLLIN|EPOLLET, .data.ptr = sg };
+	if (epoll_ctl(dispatch.epoll_fd, EPOLL_CTL_ADD, sg->sg_fd, &event) < 0) {
+		wire_log(WLOG_ERR, "Failed to watch %s for completions: %m", sg_path);
+		wio_close(sg->sg_fd);
+		sg->sg_fd = -1;
+		return false;
+	}
 
 	return true;
 }
 
 void sg_close(sg_t *sg)
 {
+	epoll_ctl(dispatch.epoll_fd, EPOLL_CTL_DEL, sg->sg_fd, NULL);
 	wio_close(sg->sg_fd);
 	sg->sg_fd = -1;
 }
@@ -74,43 +152,42 @@ int sg_request_submit(sg_t *sg, sg_request_t *req, unsigned char *cdb,
 	req->hdr.pack_id = 0;
 	req->hdr.usr_ptr = req;
 
+	// A completion that arrives from here on wakes the wait
+	wire_wait_reset(&sg->ready);
 	return submit_request(sg, req);
 }
 
 int sg_request_wait_response(sg_t *sg, sg_request_t *req)
 {
-	int result = -1;
-	wire_fd_state_t fd_state;
-
-	wire_fd_mode_init(&fd_state, sg->sg_fd);
+	wire_wait_single(&sg->ready);
 
+	// The device is edge triggered, read until it runs dry before waiting again. The wait is
+	// reset before each read so that a completion queued after a read that found nothing wakes it.
 	while (1) {
-		wire_fd_mode_read(&fd_state);
-		wire_fd_wait(&fd_state);
+		wire_wait_reset(&sg->ready);
 
 		sg_io_hdr_t hdr;
 		int ret = read(sg->sg_fd, &hdr, sizeof(hdr));
 		req->end = monoclock_get();
+		req->syscalls++;
 		if (ret == sizeof(hdr)) {
 			if (req != hdr.usr_ptr) {
 				wire_log(WLOG_WARNING, "Unknown response received, waiting for the real one!");
 				continue;
 			}
 			req->hdr = hdr;
-			result = 0;
-			break;
+			// An edge from before the submit belongs to another response, the read is the nearest bound then
+			req->readable = sg->readable >= req->start ? sg->readable : req->end;
+			return 0;
 		} else if (ret < 0) {
 			if (errno == EAGAIN || errno == EWOULDBLOCK)
-				continue;
+				wire_wait_single(&sg->ready);
 			else {
 				wire_log(WLOG_WARNING, "Error while reading the data, bailing out: %m");
-				break;
+				return -1;
 			}
 		} else {
 			wire_log(WLOG_ERR, "Didn't read the full data only read %d bytes, weird!", ret);
 		}
 	}
-
-	wire_fd_mode_none(&fd_state);
-	return result;
 }
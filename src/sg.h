@@ -1,6 +1,8 @@
 #ifndef DISKSURVEY_SG_H
 #define DISKSURVEY_SG_H
 
+#include "wire_wait.h"
+
 #include <stdbool.h>
 #include <scsi/sg.h>
 
@@ -10,12 +12,16 @@ struct sg_request_t {
 	sg_io_hdr_t hdr;
 	double start;
 	double end;
+	double readable; /* when the wire thread saw the completion, before the wire ran */
+	unsigned syscalls; /* made by the request, the shared epoll_wait of the completions is not counted */
 	unsigned char sense[128];
 };
 
 typedef struct sg {
 	int sg_fd;
 	sg_io_hdr_t hdr;
+	wire_wait_t ready;
+	double readable;
 } sg_t;
 
 bool sg_init(sg_t *sg, const char *sg_path);
@@ -0,0 +1,131 @@
+#include "shm_export.h"
+#include "disk.h"
+#include "self_stats.h"
+
+#include "logger.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+_Static_assert(SHM_LATENCY_BUCKETS == LATENCY_RANGE_COUNT, "shared memory histogram out of sync");
+
+struct shm_export {
+	shm_header_t *hdr;
+	shm_disk_record_t *records;
+	size_t size;
+};
+static struct shm_export shm;
+
+static void shm_export_memory(self_mem_t *mem)
+{
+	if (!shm.hdr)
+		return;
+	mem->reserved = shm.size;
+	mem->resident = self_stats_resident(shm.hdr, shm.size);
+}
+
+void shm_export_init(unsigned num_records)
+{
+	size_t size = sizeof(shm_header_t) + num_records * sizeof(shm_disk_record_t);
+
+	// Readers of an earlier run keep their mapping of the old segment, the new one starts clean
+	shm_unlink(SHM_EXPORT_NAME);
+	int fd = shm_open(SHM_EXPORT_NAME, O_CREAT|O_EXCL|O_RDWR|O_CLOEXEC, 0644);
+	if (fd < 0) {
+		wire_log(WLOG_WARNING, "Failed to create shared memory %s, not exporting: %m", SHM_EXPORT_NAME);
+		return;
+	}
+
+	if (ftruncate(fd, size) < 0) {
+		wire_log(WLOG_WARNING, "Failed to size shared memory: %m");
+		goto err;
+	}
+
+	void *mem = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mem == MAP_FAILED) {
+		wire_log(WLOG_WARNING, "Failed to map shared memory: %m");
+		goto err;
+	}
+	close(fd);
+
+	shm.hdr = mem;
+	shm.records = (shm_disk_record_t *)(shm.hdr + 1);
+	shm.size = size;
+
+	shm.hdr->version = SHM_EXPORT_VERSION;
+	shm.hdr->record_size = sizeof(shm_disk_record_t);
+	shm.hdr->num_records = num_records;
+	shm.hdr->active = 1;
+	shm.hdr->start_ts = time(NULL);
+	__atomic_store_n(&shm.hdr->magic, SHM_EXPORT_MAGIC, __ATOMIC_RELEASE);
+	self_stats_memory("shm_export", shm_export_memory);
+	return;
+
+err:
+	close(fd);
+	shm_unlink(SHM_EXPORT_NAME);
+}
+
+void shm_export_close(void)
+{
+	if (!shm.hdr)
+		return;
+
+	__atomic_store_n(&shm.hdr->active, 0, __ATOMIC_RELEASE);
+	munmap(shm.hdr, shm.size);
+	shm_unlink(SHM_EXPORT_NAME);
+	memset(&shm, 0, sizeof(shm));
+}
+
+void shm_export_disk_attach(disk_t *disk, unsigned idx)
+{
+	if (!shm.hdr || idx >= shm.hdr->num_records) {
+		disk->shm = NULL;
+		return;
+	}
+
+	shm_disk_record_t *record = &shm.records[idx];
+	shm_write_begin(record);
+	record->flags = SHM_DISK_USED;
+	record->last_probe_ns = 0;
+	snprintf(record->dev, sizeof(record->dev), "%s", disk->sg_path);
+	snprintf(record->serial, sizeof(record->serial), "%s", disk->disk_info.serial);
+	shm_write_end(record);
+
+	disk->shm = record;
+	shm_export_disk_update(disk, 0);
+}
+
+void shm_export_disk_update(disk_t *disk, double probe_ts)
+{
+	shm_disk_record_t *record = disk->shm;
+	if (!record)
+		return;
+
+	latency_summary_t *entry = &disk->latency.entries[disk->latency.cur_entry];
+
+	// A handful of stores into the first cache line of the record
+	shm_write_begin(record);
+	record->flags = SHM_DISK_USED | (disk->active ? SHM_DISK_ALIVE : 0) | (disk_smart_ok(disk) ? SHM_DISK_SMART_OK : 0);
+	if (probe_ts > 0)
+		record->last_probe_ns = probe_ts * 1000000000.0;
+	record->window_start = disk->latency_tick_ts;
+	record->window_max_msecs = entry->top_latencies[NUM_TOP_LATENCIES-1];
+	memcpy(record->window_hist, entry->hist, sizeof(record->window_hist));
+	shm_write_end(record);
+}
+
+void shm_export_release(unsigned idx)
+{
+	if (!shm.hdr || idx >= shm.hdr->num_records)
+		return;
+
+	shm_disk_record_t *record = &shm.records[idx];
+	shm_write_begin(record);
+	record->flags = 0;
+	shm_write_end(record);
+}
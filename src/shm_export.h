@@ -0,0 +1,22 @@
+#ifndef DISKSURVEY_SHM_EXPORT_H
+#define DISKSURVEY_SHM_EXPORT_H
+
+#include "shm_layout.h"
+
+/** The writer side of the shared memory export, see shm_layout.h. When the
+ * segment can't be set up the export is off and the calls do nothing.
+ */
+
+struct disk_t;
+
+void shm_export_init(unsigned num_records);
+void shm_export_close(void);
+
+/* Claim the record of a disk manager slot for the disk */
+void shm_export_disk_attach(struct disk_t *disk, unsigned idx);
+/* Publish the current window, the health flags and when given (non-zero) the monoclock time of a probe */
+void shm_export_disk_update(struct disk_t *disk, double probe_ts);
+/* The slot is reused for another disk */
+void shm_export_release(unsigned idx);
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef DISKSURVEY_SHM_LAYOUT_H
+#define DISKSURVEY_SHM_LAYOUT_H
+
+#include <stdint.h>
+
+/** Layout of the POSIX shared memory segment with the live stats of the
+ * disks, for agents on the same host that want them without a request.
+ *
+ * The segment is a header followed by a fixed array of records, one per
+ * slot of the disk manager. Every record is cache line aligned and guarded
+ * by its own seqlock: the daemon makes the sequence odd, updates the record
+ * and makes it even again. A reader copies the record and retries when the
+ * sequence was odd or changed meanwhile, see shm_reader.h. The daemon is the
+ * only writer and readers map the segment read-only, they never hold it up.
+ *
+ * A restart of the daemon creates a new segment, readers of the old one see
+ * active drop to 0 and should map it again.
+ */
+
+#define SHM_EXPORT_NAME "/disksurvey"
+#define SHM_EXPORT_MAGIC 0x44534d31 /* "DSM1" */
+#define SHM_EXPORT_VERSION 1
+#define SHM_CACHE_LINE 64
+#define SHM_LATENCY_BUCKETS 7 /* the histogram buckets of the latency API */
+
+enum shm_disk_flags_e {
+	SHM_DISK_USED = 1, /* the slot holds a disk, all else is meaningless without it */
+	SHM_DISK_ALIVE = 2,
+	SHM_DISK_SMART_OK = 4,
+};
+
+typedef struct shm_header_t {
+	uint32_t magic; /* written last, the rest is valid once it is set */
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t num_records;
+	uint32_t active; /* cleared when the daemon stops */
+	uint64_t start_ts; /* wall clock seconds the daemon started */
+} __attribute__((aligned(SHM_CACHE_LINE))) shm_header_t;
+
+typedef struct shm_disk_record_t {
+	// Updated by every probe, kept within the first cache line
+	uint32_t seq; /* odd while the record is being written */
+	uint32_t flags;
+	uint64_t last_probe_ns; /* CLOCK_MONOTONIC of the last completed liveness probe */
+	uint64_t window_start; /* wall clock seconds the current latency window started */
+	double window_max_msecs;
+	uint32_t window_hist[SHM_LATENCY_BUCKETS];
+
+	// Set when the disk attaches
+	char dev[32];
+	char serial[64];
+} __attribute__((aligned(SHM_CACHE_LINE))) shm_disk_record_t;
+
+/* The writer side of the seqlock, the fence keeps the stores to the record after the odd sequence */
+static inline void shm_write_begin(shm_disk_record_t *record)
+{
+	__atomic_store_n(&record->seq, record->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void shm_write_end(shm_disk_record_t *record)
+{
+	__atomic_store_n(&record->seq, record->seq + 1, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,92 @@
+#include "shm_reader.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* A write is a few stores, a reader only runs out of retries when the writer is descheduled mid-write */
+#define SHM_READ_RETRIES 1000
+
+int shm_reader_open(shm_reader_t *reader, const char *name)
+{
+	struct stat st;
+
+	memset(reader, 0, sizeof(*reader));
+
+	int fd = shm_open(name ? name : SHM_EXPORT_NAME, O_RDONLY|O_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(shm_header_t)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	void *mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED)
+		return -1;
+
+	const shm_header_t *hdr = mem;
+	if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != SHM_EXPORT_MAGIC ||
+	    hdr->version != SHM_EXPORT_VERSION ||
+	    hdr->record_size != sizeof(shm_disk_record_t) ||
+	    sizeof(*hdr) + (size_t)hdr->num_records * hdr->record_size > (size_t)st.st_size) {
+		munmap(mem, st.st_size);
+		errno = EPROTO;
+		return -1;
+	}
+
+	reader->hdr = hdr;
+	reader->records = (const shm_disk_record_t *)(hdr + 1);
+	reader->size = st.st_size;
+	return 0;
+}
+
+void shm_reader_close(shm_reader_t *reader)
+{
+	if (reader->hdr)
+		munmap((void *)reader->hdr, reader->size);
+	memset(reader, 0, sizeof(*reader));
+}
+
+int shm_reader_get(const shm_reader_t *reader, unsigned idx, shm_disk_record_t *record)
+{
+	const shm_disk_record_t *shared;
+	int i;
+
+	if (idx >= reader->hdr->num_records)
+		return 0;
+	shared = &reader->records[idx];
+
+	for (i = 0; i < SHM_READ_RETRIES; i++) {
+		uint32_t seq = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		memcpy(record, shared, sizeof(*record));
+
+		// The copy must be complete before the sequence is checked again
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&shared->seq, __ATOMIC_RELAXED) == seq)
+			return record->flags & SHM_DISK_USED ? 1 : 0;
+	}
+
+	return -1;
+}
+
+int shm_reader_find(const shm_reader_t *reader, const char *serial, shm_disk_record_t *record)
+{
+	unsigned i;
+
+	for (i = 0; i < reader->hdr->num_records; i++) {
+		if (shm_reader_get(reader, i, record) == 1 && strcmp(record->serial, serial) == 0)
+			return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef DISKSURVEY_SHM_READER_H
+#define DISKSURVEY_SHM_READER_H
+
+#include "shm_layout.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Reader of the shared memory export of disksurvey, for agents on the same
+ * host. Once the segment is mapped a read is a copy of the record, no
+ * system calls and no locks, see shm_layout.h for what a record holds.
+ */
+
+typedef struct shm_reader_t {
+	const shm_header_t *hdr;
+	const shm_disk_record_t *records;
+	size_t size;
+} shm_reader_t;
+
+/* Map the segment read-only, NULL for the default name. Returns -1 with errno set on failure. */
+int shm_reader_open(shm_reader_t *reader, const char *name);
+void shm_reader_close(shm_reader_t *reader);
+
+static inline unsigned shm_reader_num_records(const shm_reader_t *reader)
+{
+	return reader->hdr->num_records;
+}
+
+/* False once the daemon stopped, a restarted daemon is found by opening the segment again */
+static inline bool shm_reader_active(const shm_reader_t *reader)
+{
+	return __atomic_load_n(&reader->hdr->active, __ATOMIC_ACQUIRE);
+}
+
+/* Copy a consistent snapshot of a record. Returns 1 for a disk, 0 for an unused slot and -1 when
+ * the writer kept changing the record for all of the retries. */
+int shm_reader_get(const shm_reader_t *reader, unsigned idx, shm_disk_record_t *record);
+
+/* Look up a disk by its serial, returns 1 when found */
+int shm_reader_find(const shm_reader_t *reader, const char *serial, shm_disk_record_t *record);
+
+#endif
@@ -0,0 +1,96 @@
+#include "smart_attr.h"
+
+#include <memory.h>
+
+#define SMART_SECTOR_SIZE 512
+#define SMART_ATTR_OFFSET 2
+#define SMART_ATTR_SIZE 12
+#define SMART_ATTR_MAX_ENTRIES 30
+
+#define SMART_ATTR_POWER_ON_HOURS 9
+#define SMART_ATTR_AIRFLOW_TEMPERATURE 190
+#define SMART_ATTR_TEMPERATURE 194
+
+static bool smart_checksum_ok(const unsigned char *buf)
+{
+	unsigned char sum = 0;
+	int i;
+
+	for (i = 0; i < SMART_SECTOR_SIZE; i++)
+		sum += buf[i];
+
+	return sum == 0;
+}
+
+static inline uint64_t get_le48(const unsigned char *buf)
+{
+	uint64_t val = 0;
+	int i;
+
+	for (i = 5; i >= 0; i--)
+		val = (val << 8) | buf[i];
+	return val;
+}
+
+int smart_attr_parse_data(const unsigned char *buf, unsigned buf_len, smart_attr_t *attrs, int max_attrs)
+{
+	int i;
+	int num_attrs = 0;
+
+	if (buf_len < SMART_SECTOR_SIZE || !smart_checksum_ok(buf))
+		return -1;
+
+	for (i = 0; i < SMART_ATTR_MAX_ENTRIES && num_attrs < max_attrs; i++) {
+		const unsigned char *entry = buf + SMART_ATTR_OFFSET + i*SMART_ATTR_SIZE;
+		if (entry[0] == 0)
+			continue;
+
+		smart_attr_t *attr = &attrs[num_attrs++];
+		attr->id = entry[0];
+		attr->flags = entry[1] | (entry[2] << 8);
+		attr->value = entry[3];
+		attr->worst = entry[4];
+		attr->raw = get_le48(entry + 5);
+		attr->threshold = 0;
+	}
+
+	return num_attrs;
+}
+
+bool smart_attr_parse_thresholds(const unsigned char *buf, unsigned buf_len, smart_attr_t *attrs, int num_attrs)
+{
+	int i, j;
+
+	if (buf_len < SMART_SECTOR_SIZE || !smart_checksum_ok(buf))
+		return false;
+
+	for (i = 0; i < SMART_ATTR_MAX_ENTRIES; i++) {
+		const unsigned char *entry = buf + SMART_ATTR_OFFSET + i*SMART_ATTR_SIZE;
+		if (entry[0] == 0)
+			continue;
+
+		for (j = 0; j < num_attrs; j++) {
+			if (attrs[j].id == entry[0]) {
+				attrs[j].threshold = entry[1];
+				break;
+			}
+		}
+	}
+
+	return true;
+}
+
+int64_t smart_attr_series_value(const smart_attr_t *attr)
+{
+	switch (attr->id) {
+		case SMART_ATTR_AIRFLOW_TEMPERATURE:
+		case SMART_ATTR_TEMPERATURE:
+			// Upper bytes hold the min/max temperature, they would make every sample a change
+			return attr->raw & 0xFF;
+		case SMART_ATTR_POWER_ON_HOURS:
+			// Some vendors keep the minutes/msecs in the upper bytes
+			return attr->raw & 0xFFFFFFFF;
+		default:
+			return attr->raw;
+	}
+}
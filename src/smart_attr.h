@@ -0,0 +1,27 @@
+#ifndef DISKSURVEY_SMART_ATTR_H
+#define DISKSURVEY_SMART_ATTR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SMART_MAX_ATTRS 30
+
+typedef struct smart_attr_t {
+	uint8_t id;
+	uint8_t value;
+	uint8_t worst;
+	uint8_t threshold;
+	uint16_t flags;
+	uint64_t raw;
+} smart_attr_t;
+
+/* Parse the SMART READ DATA sector, returns the number of attributes found or -1 if the sector is invalid */
+int smart_attr_parse_data(const unsigned char *buf, unsigned buf_len, smart_attr_t *attrs, int max_attrs);
+
+/* Parse the SMART READ THRESHOLDS sector into attributes already parsed from the data sector */
+bool smart_attr_parse_thresholds(const unsigned char *buf, unsigned buf_len, smart_attr_t *attrs, int num_attrs);
+
+/* The part of the raw value that is worth tracking over time */
+int64_t smart_attr_series_value(const smart_attr_t *attr);
+
+#endif
@@ -0,0 +1,97 @@
+#include "smbios.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define SMBIOS_HDR_LEN 4
+
+enum smbios_type_e {
+	SMBIOS_TYPE_SYSTEM = 1,
+	SMBIOS_TYPE_BASEBOARD = 2,
+	SMBIOS_TYPE_CHASSIS = 3,
+	SMBIOS_TYPE_END = 127,
+};
+
+/* The serial number is at the same offset in all three structures */
+#define SMBIOS_SERIAL_OFFSET 0x07
+
+struct smbios_struct {
+	const unsigned char *data; /* the formatted area */
+	unsigned len;
+	const unsigned char *strings; /* NUL terminated strings, ends with an empty one */
+};
+
+static void smbios_string(const struct smbios_struct *s, unsigned offset, char *out, unsigned out_len)
+{
+	const char *str;
+
+	if (offset >= s->len)
+		return;
+
+	uint8_t idx = s->data[offset];
+	if (idx == 0) {
+		str = "Not Specified";
+	} else {
+		str = (const char *)s->strings;
+		while (--idx > 0 && *str)
+			str += strlen(str) + 1;
+		if (!*str)
+			str = "<BAD INDEX>";
+	}
+
+	unsigned i;
+	for (i = 0; str[i] && i < out_len - 1; i++) {
+		unsigned char ch = str[i];
+		out[i] = ch < 32 || ch == 127 ? '.' : ch;
+	}
+	out[i] = 0;
+}
+
+bool smbios_parse(const unsigned char *table, size_t len, smbios_serials_t *serials)
+{
+	size_t offset = 0;
+	unsigned num_structs = 0;
+
+	memset(serials, 0, sizeof(*serials));
+
+	while (offset + SMBIOS_HDR_LEN <= len) {
+		struct smbios_struct s = {
+			.data = table + offset,
+			.len = table[offset + 1],
+			.strings = table + offset + table[offset + 1],
+		};
+		uint8_t type = s.data[0];
+
+		if (s.len < SMBIOS_HDR_LEN || offset + s.len > len)
+			break;
+
+		// The strings end with a double NUL, the structure is taken only when it is all there
+		size_t end = offset + s.len;
+		while (end + 1 < len && (table[end] || table[end + 1]))
+			end++;
+		if (end + 1 >= len)
+			break;
+		offset = end + 2;
+		num_structs++;
+
+		// A structure may repeat (e.g. several baseboards), the first one is used as dmidecode -s would show it first
+		switch (type) {
+			case SMBIOS_TYPE_SYSTEM:
+				if (!serials->system[0])
+					smbios_string(&s, SMBIOS_SERIAL_OFFSET, serials->system, sizeof(serials->system));
+				break;
+			case SMBIOS_TYPE_BASEBOARD:
+				if (!serials->baseboard[0])
+					smbios_string(&s, SMBIOS_SERIAL_OFFSET, serials->baseboard, sizeof(serials->baseboard));
+				break;
+			case SMBIOS_TYPE_CHASSIS:
+				if (!serials->chassis[0])
+					smbios_string(&s, SMBIOS_SERIAL_OFFSET, serials->chassis, sizeof(serials->chassis));
+				break;
+			case SMBIOS_TYPE_END:
+				return true;
+		}
+	}
+
+	return num_structs > 0;
+}
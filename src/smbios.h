@@ -0,0 +1,29 @@
+#ifndef DISKSURVEY_SMBIOS_H
+#define DISKSURVEY_SMBIOS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** Parser of the SMBIOS structure table as the kernel exposes it in
+ * /sys/firmware/dmi/tables/DMI. Only the serial numbers that identify the
+ * system are extracted. Strings are handled as dmidecode does so that the
+ * identifiers stay what they were when they were read through it: a missing
+ * string is "Not Specified", a dangling index is "<BAD INDEX>" and
+ * unprintable characters turn into dots. A field that is absent from its
+ * structure, or a structure that is absent from the table, is left empty.
+ */
+
+#define SMBIOS_TABLE_PATH "/sys/firmware/dmi/tables/DMI"
+#define SMBIOS_STRING_LEN 128
+
+typedef struct smbios_serials_t {
+	char system[SMBIOS_STRING_LEN];
+	char chassis[SMBIOS_STRING_LEN];
+	char baseboard[SMBIOS_STRING_LEN];
+} smbios_serials_t;
+
+/* Returns false when the table is malformed before its first structure, the serials found up to a
+ * malformed structure are kept otherwise */
+bool smbios_parse(const unsigned char *table, size_t len, smbios_serials_t *serials);
+
+#endif
@@ -0,0 +1,384 @@
+#include "sse.h"
+#include "disk_mgr.h"
+#include "disk.h"
+#include "stream.h"
+#include "json.h"
+#include "util.h"
+
+#include "wire.h"
+#include "wire_fd.h"
+#include "wire_wait.h"
+#include "wire_stack.h"
+#include "logger.h"
+#include "wire_io.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define SSE_MAX_SUBSCRIBERS 256
+#define SSE_QUEUE_LEN 32
+#define SSE_MAX_PENDING 128
+#define SSE_STREAM_BUF_SIZE 2048
+
+typedef struct sse_event_t {
+	int refs;
+	disk_event_e event;
+	const disk_t *disk;
+	unsigned len;
+	char data[];
+} sse_event_t;
+
+struct sse_subscriber {
+	int fd;
+	wire_fd_state_t fd_state;
+	bool writing; /* waiting to write, otherwise waiting to read so that a close is noticed */
+	unsigned head;
+	unsigned count;
+	unsigned sent; /* bytes of the head event already sent */
+	sse_event_t *queue[SSE_QUEUE_LEN];
+};
+
+struct sse_pending {
+	disk_t *disk;
+	disk_event_e event;
+	uint64_t version;
+};
+
+struct sse {
+	wire_t wire;
+	wire_wait_t wait;
+	wire_wait_list_t wait_list;
+	bool active;
+	bool overflow; /* changes were lost before they were encoded, everyone resyncs */
+	int num_pending;
+	struct sse_pending pending[SSE_MAX_PENDING];
+	int num_subscribers;
+	struct sse_subscriber *subscribers[SSE_MAX_SUBSCRIBERS];
+};
+static struct sse sse;
+
+static const char *sse_event_name(disk_event_e event)
+{
+	switch (event) {
+		case DISK_EVENT_ATTACH: return "attach";
+		case DISK_EVENT_UPDATE: return "update";
+		case DISK_EVENT_DEATH: return "death";
+		case DISK_EVENT_NONE: break;
+	}
+	return "resync";
+}
+
+static void sse_event_put(sse_event_t *ev)
+{
+	if (--ev->refs == 0)
+		free(ev);
+}
+
+/* Encode an event once, the subscribers hold references to it */
+static sse_event_t *sse_event_encode(disk_event_e event, disk_t *disk, uint64_t version)
+{
+	// The memory buffer keeps its allocation between events
+	static char stream_buf[SSE_STREAM_BUF_SIZE];
+	static stream_mem_t mem;
+	stream_t stream;
+	json_t json;
+
+	mem.len = 0;
+	stream_init(&stream, stream_buf, sizeof(stream_buf), stream_mem_flush, &mem);
+	json_init(&json, &stream);
+
+	// The JSON writer never emits a newline, a single data line holds it all
+	stream_printf(&stream, "id: %"PRIu64"\nevent: %s\ndata: ", version, sse_event_name(event));
+	if (event == DISK_EVENT_ATTACH || event == DISK_EVENT_UPDATE) {
+		disk_json(disk, &json);
+	} else {
+		json_object_start(&json, NULL);
+		if (disk)
+			json_str(&json, "serial", disk->disk_info.serial);
+		json_uint(&json, "version", version);
+		json_object_end(&json);
+	}
+	stream_write(&stream, "\n\n", 2);
+
+	if (stream_flush(&stream) < 0)
+		return NULL;
+
+	sse_event_t *ev = malloc(sizeof(*ev) + mem.len);
+	if (!ev)
+		return NULL;
+
+	ev->refs = 1;
+	ev->event = event;
+	ev->disk = disk;
+	ev->len = mem.len;
+	memcpy(ev->data, mem.data, mem.len);
+	return ev;
+}
+
+static void sse_subscriber_free(struct sse_subscriber *sub)
+{
+	while (sub->count > 0) {
+		sse_event_put(sub->queue[sub->head]);
+		sub->head = (sub->head + 1) % SSE_QUEUE_LEN;
+		sub->count--;
+	}
+
+	wire_fd_mode_none(&sub->fd_state);
+	wire_wait_unchain(&sub->fd_state.wait);
+	wio_close(sub->fd);
+	free(sub);
+}
+
+static void sse_enqueue(struct sse_subscriber *sub, sse_event_t *ev, sse_event_t *resync)
+{
+	unsigned i;
+
+	// A newer update of a disk replaces the last event of the disk when that is an update still waiting, never
+	// the one that is partly sent. An attach, death or resync after it must stay ahead of the newer state.
+	if (ev->event == DISK_EVENT_UPDATE) {
+		for (i = sub->count; i > (sub->sent ? 1u : 0u); i--) {
+			unsigned idx = (sub->head + i - 1) % SSE_QUEUE_LEN;
+			sse_event_t *queued = sub->queue[idx];
+			if (queued->disk != ev->disk && queued->disk)
+				continue;
+
+			if (queued->event == DISK_EVENT_UPDATE) {
+				sse_event_put(queued);
+				ev->refs++;
+				sub->queue[idx] = ev;
+				return;
+			}
+			break;
+		}
+	}
+
+	if (sub->count == SSE_QUEUE_LEN) {
+		// Too far behind, drop all that isn't on the wire yet and have the client start over
+		unsigned keep = sub->sent ? 1 : 0;
+		for (i = keep; i < sub->count; i++)
+			sse_event_put(sub->queue[(sub->head + i) % SSE_QUEUE_LEN]);
+		sub->count = keep;
+		ev = resync;
+	}
+
+	if (!ev)
+		return;
+
+	ev->refs++;
+	sub->queue[(sub->head + sub->count) % SSE_QUEUE_LEN] = ev;
+	sub->count++;
+}
+
+static void sse_broadcast(sse_event_t *ev, sse_event_t *resync)
+{
+	int i;
+
+	for (i = 0; i < sse.num_subscribers; i++)
+		sse_enqueue(sse.subscribers[i], ev, resync);
+}
+
+/* Encode the pending changes and queue them to all the subscribers */
+static void sse_fan_out(void)
+{
+	sse_event_t *resync = sse_event_encode(DISK_EVENT_NONE, NULL, disk_manager_data_version());
+	int i;
+
+	if (sse.overflow) {
+		sse.overflow = false;
+		sse.num_pending = 0;
+		if (resync)
+			sse_broadcast(resync, resync);
+	}
+
+	for (i = 0; i < sse.num_pending; i++) {
+		struct sse_pending *pending = &sse.pending[i];
+		sse_event_t *ev = sse_event_encode(pending->event, pending->disk, pending->version);
+		if (!ev) {
+			wire_log(WLOG_ERR, "Failed to encode event, subscribers will resync");
+			ev = resync;
+			if (!ev)
+				continue;
+			ev->refs++;
+		}
+
+		sse_broadcast(ev, resync);
+		sse_event_put(ev);
+	}
+	sse.num_pending = 0;
+
+	if (resync)
+		sse_event_put(resync);
+}
+
+/* Returns false when the subscriber is gone */
+static bool sse_subscriber_io(struct sse_subscriber *sub)
+{
+	struct iovec iov[SSE_QUEUE_LEN];
+	struct msghdr msg;
+	unsigned i;
+
+	if (!sub->writing) {
+		// Nothing is expected from the client, only its end of the connection matters
+		char buf[128];
+		int ret = read(sub->fd, buf, sizeof(buf));
+		if (ret == 0 || (ret < 0 && errno != EAGAIN && errno != EINTR))
+			return false;
+	}
+
+	while (sub->count > 0) {
+		for (i = 0; i < sub->count; i++) {
+			sse_event_t *ev = sub->queue[(sub->head + i) % SSE_QUEUE_LEN];
+			unsigned skip = i == 0 ? sub->sent : 0;
+			iov[i].iov_base = ev->data + skip;
+			iov[i].iov_len = ev->len - skip;
+		}
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = sub->count;
+
+		// A client that went away must not take the process down with SIGPIPE
+		ssize_t ret = sendmsg(sub->fd, &msg, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				return false;
+
+			if (!sub->writing) {
+				wire_fd_mode_write(&sub->fd_state);
+				sub->writing = true;
+			}
+			return true;
+		}
+
+		size_t sent = ret;
+		while (sent > 0) {
+			sse_event_t *ev = sub->queue[sub->head];
+			size_t left = ev->len - sub->sent;
+			if (sent < left) {
+				sub->sent += sent;
+				break;
+			}
+
+			sent -= left;
+			sse_event_put(ev);
+			sub->head = (sub->head + 1) % SSE_QUEUE_LEN;
+			sub->count--;
+			sub->sent = 0;
+		}
+	}
+
+	if (sub->writing) {
+		wire_fd_mode_read(&sub->fd_state);
+		sub->writing = false;
+	}
+	return true;
+}
+
+static void sse_run(void *arg)
+{
+	int i;
+
+	while (sse.active) {
+		if (!sse.wait.triggered)
+			wire_list_wait(&sse.wait_list);
+		wire_wait_reset(&sse.wait);
+
+		if (sse.overflow || sse.num_pending > 0)
+			sse_fan_out();
+
+		for (i = 0; i < sse.num_subscribers; ) {
+			struct sse_subscriber *sub = sse.subscribers[i];
+
+			wire_wait_reset(&sub->fd_state.wait);
+			if (sse_subscriber_io(sub)) {
+				i++;
+				continue;
+			}
+
+			sse_subscriber_free(sub);
+			sse.subscribers[i] = sse.subscribers[--sse.num_subscribers];
+		}
+	}
+
+	while (sse.num_subscribers > 0)
+		sse_subscriber_free(sse.subscribers[--sse.num_subscribers]);
+}
+
+static void sse_disk_event(disk_event_e event, disk_t *disk, uint64_t version)
+{
+	int i;
+
+	if (sse.num_subscribers == 0)
+		return;
+
+	// Only the latest state of a disk is of interest, an attach or death is not overridden by an update
+	for (i = 0; i < sse.num_pending; i++) {
+		struct sse_pending *pending = &sse.pending[i];
+		if (pending->disk == disk) {
+			if (event != DISK_EVENT_UPDATE)
+				pending->event = event;
+			pending->version = version;
+			goto out;
+		}
+	}
+
+	if (sse.num_pending == SSE_MAX_PENDING) {
+		sse.overflow = true;
+		goto out;
+	}
+
+	sse.pending[sse.num_pending].disk = disk;
+	sse.pending[sse.num_pending].event = event;
+	sse.pending[sse.num_pending].version = version;
+	sse.num_pending++;
+
+out:
+	wire_wait_resume(&sse.wait);
+}
+
+bool sse_subscribe(int fd)
+{
+	if (!sse.active || sse.num_subscribers == SSE_MAX_SUBSCRIBERS) {
+		wire_log(WLOG_NOTICE, "Too many event stream subscribers");
+		return false;
+	}
+
+	struct sse_subscriber *sub = calloc(1, sizeof(*sub));
+	if (!sub)
+		return false;
+
+	sub->fd = fd;
+	wire_fd_mode_init(&sub->fd_state, fd);
+	wire_fd_wait_list_chain(&sse.wait_list, &sub->fd_state);
+	wire_fd_mode_read(&sub->fd_state);
+
+	sse.subscribers[sse.num_subscribers++] = sub;
+	return true;
+}
+
+void sse_init(void)
+{
+	memset(&sse, 0, sizeof(sse));
+	sse.active = true;
+
+	wire_wait_list_init(&sse.wait_list);
+	wire_wait_init(&sse.wait);
+	wire_wait_chain(&sse.wait_list, &sse.wait);
+
+	wire_init(&sse.wire, "event stream", sse_run, NULL, WIRE_STACK_ALLOC(64*1024));
+	disk_manager_set_event_cb(sse_disk_event);
+}
+
+void sse_stop(void)
+{
+	disk_manager_set_event_cb(NULL);
+	sse.active = false;
+	wire_wait_resume(&sse.wait);
+}
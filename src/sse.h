@@ -0,0 +1,22 @@
+#ifndef DISKSURVEY_SSE_H
+#define DISKSURVEY_SSE_H
+
+#include <stdbool.h>
+
+/** Server-Sent Events push of disk changes. A single broadcaster wire owns
+ * the sockets of all the subscribers, so an idle subscriber costs a small
+ * struct rather than a connection wire and its stack. Every event is encoded
+ * once and shared by all the subscriber queues.
+ *
+ * A subscriber that doesn't keep up has its queued updates of the same disk
+ * coalesced, when the queue still overflows it is dropped and replaced with
+ * a single resync event telling the client to refetch the disk list.
+ */
+
+void sse_init(void);
+void sse_stop(void);
+
+/* Take over a connection after the response headers were sent, returns false if it was not taken and must be closed */
+bool sse_subscribe(int fd);
+
+#endif
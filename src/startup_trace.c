@@ -0,0 +1,106 @@
+#include "startup_trace.h"
+#include "monoclock.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+struct startup_span {
+	const char *name; /* static strings only */
+	char detail[32];
+	double start;
+	double end; /* 0 while open */
+};
+
+struct startup_trace {
+	double start;
+	time_t start_ts;
+	int num_spans;
+	bool overflow;
+	struct startup_span spans[STARTUP_TRACE_MAX_SPANS];
+};
+static struct startup_trace trace;
+
+void startup_trace_init(void)
+{
+	trace.start = monoclock_get();
+	trace.start_ts = time(NULL);
+}
+
+static bool startup_trace_open(void)
+{
+	if (monoclock_get() - trace.start > STARTUP_TRACE_SECS)
+		return false;
+	if (trace.num_spans == STARTUP_TRACE_MAX_SPANS) {
+		trace.overflow = true;
+		return false;
+	}
+	return true;
+}
+
+int startup_trace_begin(const char *name, const char *detail)
+{
+	if (!startup_trace_open())
+		return -1;
+
+	struct startup_span *span = &trace.spans[trace.num_spans];
+	span->name = name;
+	snprintf(span->detail, sizeof(span->detail), "%s", detail ? detail : "");
+	span->start = monoclock_get();
+	span->end = 0;
+	return trace.num_spans++;
+}
+
+void startup_trace_end(int span)
+{
+	if (span >= 0 && span < trace.num_spans)
+		trace.spans[span].end = monoclock_get();
+}
+
+void startup_trace_mark(const char *name, const char *detail)
+{
+	int span = startup_trace_begin(name, detail);
+	if (span >= 0)
+		trace.spans[span].end = trace.spans[span].start;
+}
+
+int startup_trace_json(json_t *json)
+{
+	double last_probe = 0;
+	unsigned probes = 0;
+	int i;
+
+	json_object_start(json, NULL);
+	json_uint(json, "start", trace.start_ts);
+	json_bool(json, "recording", monoclock_get() - trace.start <= STARTUP_TRACE_SECS);
+	json_bool(json, "overflow", trace.overflow);
+
+	// Times in msecs since the start of the process
+	json_array_start(json, "spans");
+	for (i = 0; i < trace.num_spans; i++) {
+		struct startup_span *span = &trace.spans[i];
+
+		json_object_start(json, NULL);
+		json_str(json, "name", span->name);
+		if (span->detail[0])
+			json_str(json, "detail", span->detail);
+		json_double(json, "start", (span->start - trace.start) * 1000.0);
+		if (span->end > 0)
+			json_double(json, "duration", (span->end - span->start) * 1000.0);
+		json_object_end(json);
+
+		if (strcmp(span->name, "first probe") == 0) {
+			probes++;
+			if (span->end > last_probe)
+				last_probe = span->end;
+		}
+	}
+	json_array_end(json);
+
+	// The critical path ends when the last disk found at startup got its first answer
+	json_uint(json, "probed_disks", probes);
+	if (probes > 0)
+		json_double(json, "all_probed", (last_probe - trace.start) * 1000.0);
+	return json_object_end(json);
+}
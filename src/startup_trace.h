@@ -0,0 +1,26 @@
+#ifndef DISKSURVEY_STARTUP_TRACE_H
+#define DISKSURVEY_STARTUP_TRACE_H
+
+#include "json.h"
+
+/** Timing of the phases of the startup, from the process start until every
+ * disk answered its first probe. Spans are recorded only in the first
+ * STARTUP_TRACE_SECS and into a fixed table, later calls cost a compare.
+ * The trace is served at /api/self/startup.
+ */
+
+#define STARTUP_TRACE_SECS 60
+#define STARTUP_TRACE_MAX_SPANS 512
+
+/* Call first thing in main(), the times are relative to it */
+void startup_trace_init(void);
+
+/* Returns the span to end or -1 when it isn't recorded. The detail is copied (e.g. the device). */
+int startup_trace_begin(const char *name, const char *detail);
+void startup_trace_end(int span);
+/* A span without duration */
+void startup_trace_mark(const char *name, const char *detail);
+
+int startup_trace_json(json_t *json);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef DISKSURVEY_STATIC_ASSET_H
+#define DISKSURVEY_STATIC_ASSET_H
+
+/** A web asset embedded at build time by web/app_inc.sh along with its
+ * precompressed variants. A variant is NULL when the compressor wasn't
+ * available or didn't make it smaller. The hash is of the uncompressed
+ * content and serves as the ETag and as the cache buster in index.html.
+ */
+
+struct static_asset {
+	const unsigned char *data;
+	unsigned len;
+	const unsigned char *gz_data;
+	unsigned gz_len;
+	const unsigned char *br_data;
+	unsigned br_len;
+	const char *hash;
+};
+
+#endif
@@ -0,0 +1,113 @@
+#include "stream.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void stream_init(stream_t *stream, char *buf, unsigned size, stream_flush_cb_t flush, void *priv)
+{
+	stream->buf = buf;
+	stream->size = size;
+	stream->len = 0;
+	stream->failed = false;
+	stream->flush = flush;
+	stream->priv = priv;
+}
+
+int stream_flush(stream_t *stream)
+{
+	if (stream->failed)
+		return -1;
+
+	if (stream->len > 0) {
+		if (stream->flush(stream, stream->buf, stream->len) < 0) {
+			stream->failed = true;
+			return -1;
+		}
+		stream->len = 0;
+	}
+
+	return 0;
+}
+
+int stream_write(stream_t *stream, const char *data, unsigned len)
+{
+	while (len > 0) {
+		if (stream->failed)
+			return -1;
+
+		if (stream->len == stream->size && stream_flush(stream) < 0)
+			return -1;
+
+		unsigned room = stream->size - stream->len;
+		unsigned copy = len < room ? len : room;
+		memcpy(stream->buf + stream->len, data, copy);
+		stream->len += copy;
+		data += copy;
+		len -= copy;
+	}
+
+	return stream->failed ? -1 : 0;
+}
+
+int stream_printf(stream_t *stream, const char *fmt, ...)
+{
+	va_list ap;
+	int written;
+
+	if (stream->failed)
+		return -1;
+
+	// Try in place first, only flush when the output doesn't fit
+	va_start(ap, fmt);
+	written = vsnprintf(stream->buf + stream->len, stream->size - stream->len, fmt, ap);
+	va_end(ap);
+	if (written < 0) {
+		stream->failed = true;
+		return -1;
+	}
+	if ((unsigned)written < stream->size - stream->len) {
+		stream->len += written;
+		return 0;
+	}
+
+	if (stream_flush(stream) < 0)
+		return -1;
+
+	if ((unsigned)written < stream->size) {
+		va_start(ap, fmt);
+		vsnprintf(stream->buf, stream->size, fmt, ap);
+		va_end(ap);
+		stream->len = written;
+		return 0;
+	}
+
+	// Larger than the whole buffer, format it aside
+	char tmp[written + 1];
+	va_start(ap, fmt);
+	vsnprintf(tmp, sizeof(tmp), fmt, ap);
+	va_end(ap);
+	return stream_write(stream, tmp, written);
+}
+
+int stream_mem_flush(stream_t *stream, const char *buf, unsigned len)
+{
+	stream_mem_t *mem = stream->priv;
+
+	if (mem->len + len > mem->size) {
+		unsigned size = mem->size ? mem->size : 4096;
+		while (size < mem->len + len)
+			size *= 2;
+
+		char *data = realloc(mem->data, size);
+		if (!data)
+			return -1;
+		mem->data = data;
+		mem->size = size;
+	}
+
+	memcpy(mem->data + mem->len, buf, len);
+	mem->len += len;
+	return 0;
+}
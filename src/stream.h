@@ -0,0 +1,58 @@
+#ifndef DISKSURVEY_STREAM_H
+#define DISKSURVEY_STREAM_H
+
+#include <stdbool.h>
+
+/** A byte stream over a small caller provided buffer. Whenever the buffer
+ * fills up it is handed to the flush callback (a socket, a growing memory
+ * buffer, ...) so output of any size needs only the buffer's memory.
+ *
+ * Errors are sticky: once a flush failed every further call returns -1, so a
+ * writer can emit a whole document and check the result once at the end.
+ */
+
+typedef struct stream_t stream_t;
+typedef int (*stream_flush_cb_t)(stream_t *stream, const char *buf, unsigned len);
+
+struct stream_t {
+	char *buf;
+	unsigned size;
+	unsigned len;
+	bool failed;
+	stream_flush_cb_t flush;
+	void *priv;
+};
+
+void stream_init(stream_t *stream, char *buf, unsigned size, stream_flush_cb_t flush, void *priv);
+
+int stream_write(stream_t *stream, const char *data, unsigned len);
+int stream_printf(stream_t *stream, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static inline int stream_putc(stream_t *stream, char ch)
+{
+	if (stream->len < stream->size && !stream->failed) {
+		stream->buf[stream->len++] = ch;
+		return 0;
+	}
+	return stream_write(stream, &ch, 1);
+}
+
+/* Hand over whatever is buffered, returns -1 if the stream failed at any point */
+int stream_flush(stream_t *stream);
+
+/* A sink that collects the whole output in a malloc'ed buffer, pass it as the priv of the stream.
+ *
+ * Flushing to memory never yields the wire, so a document written to it is
+ * done before any other wire runs. The stream buffer and any other scratch
+ * space used only while writing can therefore be static and shared by all
+ * the writers of the thread.
+ */
+typedef struct stream_mem_t {
+	char *data;
+	unsigned len;
+	unsigned size;
+} stream_mem_t;
+
+int stream_mem_flush(stream_t *stream, const char *buf, unsigned len);
+
+#endif
@@ -1,9 +1,14 @@
 #include "system_id.h"
 
+#include "smbios.h"
+
 #include "wire_io.h"
+#include "logger.h"
 
 #include "sha1.h"
 
+#include <fcntl.h>
+#include <stdlib.h>
 #include <memory.h>
 #include <stdio.h>
 #include <assert.h>
@@ -12,6 +17,10 @@
 #include <unistd.h>
 #include <netinet/in.h>
 #include <string.h>
+#include <sys/stat.h>
+
+/* Tables are a few KB, anything much larger is not a table */
+#define SMBIOS_MAX_TABLE_SIZE (1024*1024)
 
 static void sha1_calc(const unsigned char *src, int src_len, char *out, int out_size)
 {
@@ -30,49 +39,67 @@ static void sha1_calc(const unsigned char *src, int src_len, char *out, int out_
 }
 
 
-static void dmidecode_read(const char *field_name, char *buf, int len)
+/* Read the whole DMI table, returns a malloc'ed buffer or NULL */
+static unsigned char *dmi_table_read(const char *path, size_t *len)
 {
-    char cmd[128];
+    struct stat st;
+    unsigned char *table = NULL;
 
-    memset(buf, 0, len);
+    int fd = wio_open(path, O_RDONLY, 0);
+    if (fd < 0) {
+        wire_log(WLOG_INFO, "Failed to open %s: %m", path);
+        return NULL;
+    }
 
-    snprintf(cmd, sizeof(cmd), "dmidecode -s %s", field_name);
+    if (wio_fstat(fd, &st) < 0 || st.st_size <= 0 || st.st_size > SMBIOS_MAX_TABLE_SIZE) {
+        wire_log(WLOG_INFO, "Unexpected size of the DMI table");
+        goto Exit;
+    }
 
-    FILE *f = wio_popen(cmd, "r");
-    if (!f)
-        return;
+    table = malloc(st.st_size);
+    if (!table)
+        goto Exit;
 
-    char *ret = wio_fgets(buf, len, f);
-    wio_pclose(f);
-    
-    if (ret == NULL)
-        return;
-
-    int actual_len = strlen(buf);
-    switch (buf[actual_len-1]) {
-        case '\r':
-        case '\n':
-            buf[actual_len-1] = 0;
-            actual_len--;
+    *len = 0;
+    while (*len < (size_t)st.st_size) {
+        ssize_t ret = wio_read(fd, table + *len, st.st_size - *len);
+        if (ret <= 0) {
+            if (ret < 0)
+                wire_log(WLOG_INFO, "Failed to read the DMI table: %m");
             break;
+        }
+        *len += ret;
     }
 
-    sha1_calc((unsigned char *)buf, actual_len, buf, len);
-}
-
-static void system_serial_read(char *buf, int len)
-{
-    dmidecode_read("system-serial-number", buf, len);
+Exit:
+    wio_close(fd);
+    return table;
 }
 
-static void chassis_serial_read(char *buf, int len)
+static bool dmi_serials_read(system_identifier_t *system_id)
 {
-    dmidecode_read("chassis-serial-number", buf, len);
-}
+    smbios_serials_t serials;
+    size_t len = 0;
+
+    unsigned char *table = dmi_table_read(SMBIOS_TABLE_PATH, &len);
+    if (!table)
+        return false;
+
+    bool parsed = smbios_parse(table, len, &serials);
+    free(table);
+    if (!parsed) {
+        wire_log(WLOG_INFO, "Failed to parse the DMI table");
+        return false;
+    }
 
-static void baseboard_serial_read(char *buf, int len)
-{
-    dmidecode_read("baseboard-serial-number", buf, len);
+    // Only the hashes are kept, a missing serial stays empty
+    if (serials.system[0])
+        sha1_calc((unsigned char *)serials.system, strlen(serials.system), system_id->system, sizeof(system_id->system));
+    if (serials.chassis[0])
+        sha1_calc((unsigned char *)serials.chassis, strlen(serials.chassis), system_id->chassis, sizeof(system_id->chassis));
+    if (serials.baseboard[0])
+        sha1_calc((unsigned char *)serials.baseboard, strlen(serials.baseboard), system_id->baseboard, sizeof(system_id->baseboard));
+    return true;
 }
 
 static void mac_read(char *buf, int len)
@@ -80,45 +107,53 @@ static void mac_read(char *buf, int len)
     struct ifreq ifr;
     struct ifconf ifc;
     char data[1024];
-    int success = 0;
+    bool success = false;
+
+    memset(buf, 0, len);
 
     int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
-    if (sock == -1) { /* handle error*/ };
+    if (sock == -1) {
+        wire_log(WLOG_INFO, "Failed to create a socket to find the MAC: %m");
+        return;
+    }
 
     ifc.ifc_len = sizeof(data);
     ifc.ifc_buf = data;
-    if (wio_ioctl(sock, SIOCGIFCONF, &ifc) == -1) { /* handle error */ }
+    if (wio_ioctl(sock, SIOCGIFCONF, &ifc) == -1) {
+        wire_log(WLOG_INFO, "Failed to list the network interfaces: %m");
+        goto Exit;
+    }
 
     struct ifreq* it = ifc.ifc_req;
     const struct ifreq* const end = it + (ifc.ifc_len / sizeof(struct ifreq));
 
     for (; it != end; ++it) {
-        strcpy(ifr.ifr_name, it->ifr_name);
-        if (wio_ioctl(sock, SIOCGIFFLAGS, &ifr) == 0) {
-            if (! (ifr.ifr_flags & IFF_LOOPBACK)) { // don't count loopback
-                if (wio_ioctl(sock, SIOCGIFHWADDR, &ifr) == 0) {
-                    success = 1;
-                    break;
-                }
-            }
+        memset(&ifr, 0, sizeof(ifr));
+        memcpy(ifr.ifr_name, it->ifr_name, sizeof(ifr.ifr_name));
+        ifr.ifr_name[sizeof(ifr.ifr_name)-1] = 0;
+
+        // An interface may go away while we look, just move on to the next one
+        if (wio_ioctl(sock, SIOCGIFFLAGS, &ifr) != 0 || (ifr.ifr_flags & IFF_LOOPBACK))
+            continue;
+
+        if (wio_ioctl(sock, SIOCGIFHWADDR, &ifr) == 0) {
+            success = true;
+            break;
         }
-        else { /* handle error */ }
     }
 
-    if (success) {
+    if (success)
         sha1_calc((unsigned char*)ifr.ifr_hwaddr.sa_data, 6, buf, len);
-    } else {
-        memset(buf, 0, len);
-    }
 
-	wio_close(sock);
+Exit:
+    wio_close(sock);
 }
 
 bool system_identifier_read(system_identifier_t *system_id)
 {
-    system_serial_read(system_id->system, sizeof(system_id->system));
-    chassis_serial_read(system_id->chassis, sizeof(system_id->chassis));
-    baseboard_serial_read(system_id->baseboard, sizeof(system_id->baseboard));
+    memset(system_id, 0, sizeof(*system_id));
+
+    bool found = dmi_serials_read(system_id);
     mac_read(system_id->mac, sizeof(system_id->mac));
-    return false;
+    return found;
 }
@@ -1,12 +1,14 @@
 #include "timer_bus.h"
+#include "monoclock.h"
 
-#include "wire_log.h"
+#include "logger.h"
 #include "wire_fd.h"
 #include "wire_stack.h"
 #include "wire_io.h"
 
 #include <sys/timerfd.h>
 #include <stdint.h>
+#include <limits.h>
 #include <errno.h>
 
 struct timer_bus_sleeper {
@@ -53,10 +55,8 @@ static int timer_read(wire_fd_state_t *fd_state)
 		return -1;
 	}
 
-	if (timer_val > 0) {
-		ret = 0;
-		return 1;
-	}
+	if (timer_val > 0)
+		return timer_val > INT_MAX ? INT_MAX : timer_val;
 
 	return 0;
 }
@@ -68,6 +68,51 @@ static void timer_close(wire_fd_state_t *fd_state)
 }
 
 
+static void timer_bus_wheel_tick(timer_bus_t *tbus)
+{
+	struct list_head *slot, *next, *cur;
+
+	tbus->now++;
+	slot = &tbus->wheel[tbus->now % TIMER_BUS_WHEEL_SLOTS];
+
+	// Deadlines further out than a full turn of the wheel share the slot and stay for a later round
+	for (cur = slot->next, next = cur->next; cur != slot; cur = next, next = cur->next) {
+		timer_bus_deadline_t *deadline = list_entry(cur, timer_bus_deadline_t, list);
+		if (deadline->expires <= tbus->now) {
+			list_del(cur);
+			list_head_init(cur);
+			wire_wait_resume(&deadline->wait);
+		}
+	}
+}
+
+/* Missed units are caught up one by one, beyond a full turn of the wheel the
+ * early ones are skipped since the last turn visits every slot anyway */
+static void timer_bus_wheel_advance(timer_bus_t *tbus, unsigned units)
+{
+	if (units > TIMER_BUS_WHEEL_SLOTS) {
+		tbus->now += units - TIMER_BUS_WHEEL_SLOTS;
+		units = TIMER_BUS_WHEEL_SLOTS;
+	}
+	while (units-- > 0)
+		timer_bus_wheel_tick(tbus);
+}
+
+/* The expiration that was just read was due a whole number of units after the timer started */
+static void timer_bus_lag(timer_bus_t *tbus, unsigned expirations)
+{
+	tbus->expirations += expirations;
+	tbus->overruns += expirations - 1;
+
+	double lag = monoclock_get() - tbus->started - tbus->expirations * tbus->time_unit_msec / 1000.0;
+	if (lag < 0)
+		lag = 0;
+	tbus->lag_count++;
+	tbus->lag_sum += lag;
+	if (lag > tbus->lag_max)
+		tbus->lag_max = lag;
+}
+
 static void timer_bus_wire(void *arg)
 {
 	timer_bus_t *tbus = arg;
@@ -75,20 +120,30 @@ static void timer_bus_wire(void *arg)
 	struct list_head *next, *cur;
 
 	timer_monotonic(&fd_state, tbus->time_unit_msec);
+	tbus->started = monoclock_get();
 
 	while (1) {
 		int ret = timer_read(&fd_state);
 		if (tbus->stop || ret < 0)
 			break;
 
+		if (ret == 0)
+			continue;
+
+		// A busy wire thread reads several expirations at once, all of them count
 		for (cur = tbus->sleepers.next, next = cur->next; cur != &tbus->sleepers; cur = next, next = cur->next) {
 			struct timer_bus_sleeper *sleeper = list_entry(cur, struct timer_bus_sleeper, list);
-			sleeper->units_left--;
-			if (sleeper->units_left == 0) {
+			if (sleeper->units_left <= (unsigned)ret) {
+				sleeper->units_left = 0;
 				list_del(cur);
 				wire_wait_resume(&sleeper->wait);
+			} else {
+				sleeper->units_left -= ret;
 			}
 		}
+
+		timer_bus_lag(tbus, ret);
+		timer_bus_wheel_advance(tbus, ret);
 	}
 
 	tbus->stop = -1;
@@ -99,13 +154,33 @@ static void timer_bus_wire(void *arg)
 		list_del(cur);
 		wire_wait_resume(&sleeper->wait);
 	}
+
+	// Nothing will expire anymore, let everyone waiting on a deadline go now
+	int i;
+	for (i = 0; i < TIMER_BUS_WHEEL_SLOTS; i++) {
+		struct list_head *slot = &tbus->wheel[i];
+		for (cur = slot->next, next = cur->next; cur != slot; cur = next, next = cur->next) {
+			timer_bus_deadline_t *deadline = list_entry(cur, timer_bus_deadline_t, list);
+			list_del(cur);
+			list_head_init(cur);
+			wire_wait_resume(&deadline->wait);
+		}
+	}
 }
 
 void timer_bus_init(timer_bus_t *tbus, unsigned time_unit_msec)
 {
+	int i;
+
 	list_head_init(&tbus->sleepers);
 	tbus->stop = 0;
 	tbus->time_unit_msec = time_unit_msec;
+	tbus->now = 0;
+	tbus->started = 0;
+	tbus->expirations = tbus->overruns = tbus->lag_count = 0;
+	tbus->lag_sum = tbus->lag_max = 0;
+	for (i = 0; i < TIMER_BUS_WHEEL_SLOTS; i++)
+		list_head_init(&tbus->wheel[i]);
 	wire_init(&tbus->wire, "timer bus", timer_bus_wire, tbus, WIRE_STACK_ALLOC(4096));
 }
 
@@ -124,3 +199,33 @@ int timer_bus_sleep(timer_bus_t *tbus, unsigned units)
 	wire_wait_single(&sleeper.wait);
 	return tbus->stop;
 }
+
+void timer_bus_deadline_init(timer_bus_deadline_t *deadline)
+{
+	list_head_init(&deadline->list);
+	deadline->expires = 0;
+	wire_wait_init(&deadline->wait);
+}
+
+void timer_bus_deadline_set(timer_bus_t *tbus, timer_bus_deadline_t *deadline, unsigned units)
+{
+	timer_bus_deadline_clear(deadline);
+
+	if (tbus->stop) {
+		wire_wait_resume(&deadline->wait);
+		return;
+	}
+
+	// The current tick is partly gone already, a deadline is never shorter than asked for
+	deadline->expires = tbus->now + (units ? units : 1) + 1;
+	list_add_tail(&deadline->list, &tbus->wheel[deadline->expires % TIMER_BUS_WHEEL_SLOTS]);
+}
+
+void timer_bus_deadline_clear(timer_bus_deadline_t *deadline)
+{
+	if (!list_empty(&deadline->list)) {
+		list_del(&deadline->list);
+		list_head_init(&deadline->list);
+	}
+	wire_wait_reset(&deadline->wait);
+}
@@ -3,18 +3,48 @@
 
 #include "wire_wait.h"
 
+#include <stdint.h>
+
+#define TIMER_BUS_WHEEL_SLOTS 256
+
 typedef struct timer_bus timer_bus_t;
 
+/** A deadline triggers its wait once the given number of time units passed.
+ * The armed deadlines hash into a wheel by their expiry so that a tick only
+ * looks at its own slot, arming and clearing one is constant time no matter
+ * how many there are.
+ */
+typedef struct timer_bus_deadline {
+	struct list_head list;
+	uint64_t expires;
+	wire_wait_t wait;
+} timer_bus_deadline_t;
+
 void timer_bus_init(timer_bus_t *tbus, unsigned time_unit_msec);
 void timer_bus_stop(timer_bus_t *tbus);
 
 int timer_bus_sleep(timer_bus_t *tbus, unsigned units);
 
+void timer_bus_deadline_init(timer_bus_deadline_t *deadline);
+/* Re-arming replaces the previous expiry, the wait is reset either way */
+void timer_bus_deadline_set(timer_bus_t *tbus, timer_bus_deadline_t *deadline, unsigned units);
+void timer_bus_deadline_clear(timer_bus_deadline_t *deadline);
+
 struct timer_bus {
 	struct list_head sleepers;
 	int stop;
 	wire_t wire;
 	unsigned time_unit_msec;
+	uint64_t now; /* ticks since the start */
+	struct list_head wheel[TIMER_BUS_WHEEL_SLOTS];
+
+	// How late the wire gets to the expirations of the timer, in seconds
+	double started;
+	uint64_t expirations;
+	uint64_t overruns; /* expirations that were only seen along with a later one */
+	uint64_t lag_count;
+	double lag_sum;
+	double lag_max;
 };
 
 #endif
@@ -1,5 +1,15 @@
 #include "web.h"
 #include "disk_mgr.h"
+#include "disk.h"
+#include "render_cache.h"
+#include "disk_pb.h"
+#include "metrics.h"
+#include "monoclock.h"
+#include "sse.h"
+#include "startup_trace.h"
+#include "self_stats.h"
+#include "ctl.h"
+#include "timer_bus.h"
 #include "util.h"
 
 #include "wire.h"
@@ -10,7 +20,7 @@
 #include "wire_fd.h"
 #include "wire_pool.h"
 #include "wire_stack.h"
-#include "wire_log.h"
+#include "logger.h"
 #include "macros.h"
 #include "http_parser.h"
 #include "wire_io.h"
@@ -25,26 +35,75 @@
 #include <fcntl.h>
 #include <memory.h>
 #include <errno.h>
+#include <inttypes.h>
+#include <time.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
 
 
 #define CONNECTION_BUF_SIZE 8192
+#define STREAM_BUF_SIZE 2048
+#define METRICS_CACHE_SECS 5
+#define RESPONSE_BODY_PARTS 2
+#define DISK_URL_PREFIX "/api/disks/"
+#define PROTOBUF_CTYPE "application/x-protobuf"
+
+#define WEB_MAX_CONNECTIONS 1024
+#define WEB_TIMER_MSEC 100
+#define WEB_IDLE_TIMEOUT_MSEC (30*1000) /* between requests on a kept alive connection */
+#define WEB_READ_TIMEOUT_MSEC (10*1000) /* for the rest of a request once it started */
+#define WEB_WRITE_TIMEOUT_MSEC (10*1000) /* for the client to take in more of the response */
+
+struct web_listener {
+	const char *name;
+	unsigned short port;
+	const char *path; /* of a unix socket, used instead of the port when set */
+	wire_t wire;
+	wire_wait_t close_wait;
+};
 
 struct web {
 	wire_pool_t web_pool;
-	wire_t accept_wire;
-	wire_wait_t close_wait;
+	struct web_listener tcp;
+	struct web_listener local;
+	timer_bus_t timer_bus;
+	unsigned num_connections;
+	time_t start_time;
+	render_cache_t disk_list_cache;
+	render_cache_t metrics_state_cache;
+	render_cache_t metrics_counters_cache;
 };
 static struct web web;
 
 struct web_data {
 	int fd;
+	bool local; /* on the unix socket, may speak the binary control protocol */
 	wire_fd_state_t fd_state;
+	timer_bus_deadline_t deadline;
+	wire_wait_list_t wait_list;
+	bool in_message; /* part of a request was received */
+	double request_start;
+	self_cpu_t cpu;
 	int method;
 	char path[256];
 	char query_string[256];
+	bool close;
+	bool handoff; /* the connection is passed on to the event stream */
+
+	// Request headers of interest, header names and values may arrive in pieces
+	char header_field[32];
+	unsigned header_field_len;
+	bool in_header_value;
+	char *header_value;
+	unsigned header_value_size;
+	char if_none_match[64];
+	char accept_encoding[128];
+	char accept[128];
 };
 
 struct url {
@@ -52,67 +111,771 @@ struct url {
 	int (*cb)(http_parser *parser);
 };
 
-static int buf_write(wire_fd_state_t *fd_state, const char *buf, int len)
+struct disk_url {
+	const char *resource;
+	disk_json_cb_t json;
+	disk_stream_cb_t pb; /* NULL when there is no protobuf representation */
+	int (*query)(http_parser *parser, const char *serial); /* serves the requests that have a query string */
+};
+
+/* Wait for the socket to become ready, returns false when the time ran out first */
+static bool web_wait(struct web_data *d, unsigned timeout_msec)
+{
+	timer_bus_deadline_set(&web.timer_bus, &d->deadline, timeout_msec / WEB_TIMER_MSEC);
+	self_cpu_stop(&d->cpu, SELF_TASK_WEB);
+	wire_list_wait(&d->wait_list);
+	self_cpu_start(&d->cpu);
+
+	bool ready = d->fd_state.wait.triggered;
+	wire_wait_reset(&d->fd_state.wait);
+	timer_bus_deadline_clear(&d->deadline);
+	return ready;
+}
+
+/* A client that doesn't take the response in time loses the connection */
+static int buf_write_wait(struct web_data *d)
+{
+	wire_fd_mode_write(&d->fd_state);
+	if (!web_wait(d, WEB_WRITE_TIMEOUT_MSEC)) {
+		wire_log(WLOG_DEBUG, "Write timed out on fd %d", d->fd);
+		d->close = true;
+		return -1;
+	}
+	return 0;
+}
+
+static int buf_write(struct web_data *d, const char *buf, int len)
 {
 	int sent = 0;
 	do {
-		int ret = write(fd_state->fd, buf + sent, len - sent);
-		if (ret == 0)
+		int ret = write(d->fd, buf + sent, len - sent);
+		if (ret == 0) {
+			d->close = true;
 			return -1;
+		}
 		else if (ret > 0) {
 			sent += ret;
 			if (sent == len)
 				return 0;
 		} else {
 			// Error
-			if (errno != EINTR && errno != EAGAIN)
+			if (errno != EINTR && errno != EAGAIN) {
+				d->close = true;
 				return -1;
+			}
 		}
 
-		wire_fd_mode_write(fd_state);
-		wire_fd_wait(fd_state);
-		// TODO: Need to handle timeouts here as well
+		if (buf_write_wait(d) < 0)
+			return -1;
 	} while (1);
 }
 
-static int response_write(http_parser *parser, int code, const char *title, const char *content_type, const char *body, unsigned body_len)
+/* Write a full set of buffers, the header and body go out together in one packet where possible */
+static int buf_writev(struct web_data *d, struct iovec *iov, int iovcnt)
 {
+	do {
+		ssize_t ret = writev(d->fd, iov, iovcnt);
+		if (ret == 0) {
+			d->close = true;
+			return -1;
+		}
+		else if (ret > 0) {
+			// Skip past what was sent
+			while (iovcnt > 0 && (size_t)ret >= iov->iov_len) {
+				ret -= iov->iov_len;
+				iov++;
+				iovcnt--;
+			}
+			if (iovcnt == 0)
+				return 0;
+			iov->iov_base = (char *)iov->iov_base + ret;
+			iov->iov_len -= ret;
+		} else {
+			// Error
+			if (errno != EINTR && errno != EAGAIN) {
+				d->close = true;
+				return -1;
+			}
+		}
+
+		if (buf_write_wait(d) < 0)
+			return -1;
+	} while (1);
+}
+
+/* The connection header of a response, HTTP/1.0 clients need to be told a connection stays open */
+static const char *connection_hdr(http_parser *parser)
+{
+	if (!http_should_keep_alive(parser))
+		return "Connection: close\r\n";
+	if (parser->http_major == 1 && parser->http_minor == 0)
+		return "Connection: keep-alive\r\n";
+	return "";
+}
+
+/* A body in up to RESPONSE_BODY_PARTS parts that are sent one after the other */
+static int response_write_parts(http_parser *parser, int code, const char *title, const char *content_type, const char *extra_hdrs,
+		const struct iovec *body, int num_parts)
+{
+	struct iovec iov[1 + RESPONSE_BODY_PARTS];
 	char hdr[512];
-	int hdr_len;
-	hdr_len = snprintf(hdr, sizeof(hdr), "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %u\r\n%s\r\n",
+	unsigned body_len = 0;
+	int i, num_iov = 1;
+
+	for (i = 0; i < num_parts; i++) {
+		body_len += body[i].iov_len;
+		if (body[i].iov_len > 0)
+			iov[num_iov++] = body[i];
+	}
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = snprintf(hdr, sizeof(hdr), "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %u\r\n%s%s\r\n",
 			code, title,
 			content_type,
 			body_len,
-			!http_should_keep_alive(parser) ? "Connection: close\r\n" : "");
+			extra_hdrs,
+			connection_hdr(parser));
+
+	struct web_data *d = parser->data;
+	return buf_writev(d, iov, num_iov);
+}
+
+static int response_write_hdrs(http_parser *parser, int code, const char *title, const char *content_type, const char *extra_hdrs, const char *body, unsigned body_len)
+{
+	struct iovec part = { .iov_base = (void *)body, .iov_len = body_len };
+	return response_write_parts(parser, code, title, content_type, extra_hdrs, &part, 1);
+}
 
+static int response_write(http_parser *parser, int code, const char *title, const char *content_type, const char *body, unsigned body_len)
+{
+	return response_write_hdrs(parser, code, title, content_type, "", body, body_len);
+}
+
+/* Each flush of the response stream goes out as a single chunk */
+static int chunk_flush(stream_t *stream, const char *buf, unsigned len)
+{
+	http_parser *parser = stream->priv;
 	struct web_data *d = parser->data;
-	buf_write(&d->fd_state, hdr, hdr_len);
-	buf_write(&d->fd_state, body, body_len);
+
+	// HTTP/1.0 has no chunked encoding, the body ends when the connection closes
+	if (parser->http_major == 1 && parser->http_minor == 0)
+		return buf_write(d, buf, len);
+
+	char chunk_hdr[16];
+	int chunk_hdr_len = snprintf(chunk_hdr, sizeof(chunk_hdr), "%x\r\n", len);
+	if (buf_write(d, chunk_hdr, chunk_hdr_len) < 0 ||
+	    buf_write(d, buf, len) < 0 ||
+	    buf_write(d, "\r\n", 2) < 0)
+		return -1;
 
 	return 0;
 }
 
-#define SERVE_VAR(name, content_type) static int serve_##name(http_parser *parser) \
+static int response_stream_start(http_parser *parser, stream_t *stream, char *buf, unsigned size, const char *content_type)
+{
+	char hdr[512];
+	int hdr_len;
+	bool http10 = parser->http_major == 1 && parser->http_minor == 0;
+
+	hdr_len = snprintf(hdr, sizeof(hdr), "HTTP/1.1 200 OK\r\nContent-Type: %s\r\n%s\r\n",
+			content_type,
+			http10 ? "Connection: close\r\n" :
+			!http_should_keep_alive(parser) ? "Transfer-Encoding: chunked\r\nConnection: close\r\n" : "Transfer-Encoding: chunked\r\n");
+
+	struct web_data *d = parser->data;
+	stream_init(stream, buf, size, chunk_flush, parser);
+	return buf_write(d, hdr, hdr_len);
+}
+
+static int response_stream_end(http_parser *parser, stream_t *stream)
+{
+	struct web_data *d = parser->data;
+
+	if (stream_flush(stream) < 0)
+		return -1;
+
+	if (parser->http_major == 1 && parser->http_minor == 0) {
+		// Nothing else marks the end of the body
+		d->close = true;
+		return 0;
+	}
+
+	return buf_write(d, "0\r\n\r\n", 5);
+}
+
+
+/* A 200 response with whatever render() writes to the JSON writer as the body */
+static int response_stream_json(http_parser *parser, int (*render)(json_t *json, void *arg), void *arg)
+{
+	char buf[STREAM_BUF_SIZE];
+	stream_t stream;
+	json_t json;
+
+	if (response_stream_start(parser, &stream, buf, sizeof(buf), "application/json") < 0)
+		return -1;
+
+	json_init(&json, &stream);
+	render(&json, arg);
+
+	// The headers are out already, all we can do on failure is to drop the connection
+	if (response_stream_end(parser, &stream) < 0) {
+		struct web_data *d = parser->data;
+		d->close = true;
+		return -1;
+	}
+	return 0;
+}
+
+static int render_disk_list_json(json_t *json, void *arg)
+{
+	return disk_manager_disk_list_json(json);
+}
+
+static int api_disk_list_stream(http_parser *parser)
+{
+	return response_stream_json(parser, render_disk_list_json, NULL);
+}
+
+static bool etag_matches(const char *if_none_match, const char *etag)
+{
+	if (strcmp(if_none_match, "*") == 0)
+		return true;
+
+	// A list of tags, a weak tag matches as well
+	const char *p = if_none_match;
+	size_t etag_len = strlen(etag);
+	while ((p = strstr(p, etag)) != NULL) {
+		if (p[etag_len] == 0 || p[etag_len] == ',' || p[etag_len] == ' ')
+			return true;
+		p += etag_len;
+	}
+	return false;
+}
+
+/* Whether a list header such as Accept or Accept-Encoding accepts the token */
+static bool header_accepts(const char *list, const char *token)
+{
+	size_t token_len = strlen(token);
+	const char *p = list;
+
+	while (*p) {
+		p += strspn(p, " \t,");
+		size_t len = strcspn(p, " \t;,");
+
+		if (len == token_len && strncasecmp(p, token, token_len) == 0) {
+			// An explicit zero quality refuses it
+			const char *q = p + len;
+			q += strspn(q, " \t");
+			if (*q == ';') {
+				q++;
+				q += strspn(q, " \t");
+				if (strncasecmp(q, "q=", 2) == 0)
+					return strtod(q + 2, NULL) > 0;
+			}
+			return true;
+		}
+
+		p += strcspn(p, ",");
+	}
+
+	return false;
+}
+
+/* Only an explicit request gets protobuf, browsers and curl send wildcards and keep getting JSON */
+static bool wants_protobuf(struct web_data *d)
+{
+	return header_accepts(d->accept, PROTOBUF_CTYPE);
+}
+
+static int hex_value(char ch)
+{
+	if (ch >= '0' && ch <= '9')
+		return ch - '0';
+	if (ch >= 'a' && ch <= 'f')
+		return ch - 'a' + 10;
+	if (ch >= 'A' && ch <= 'F')
+		return ch - 'A' + 10;
+	return -1;
+}
+
+/* Decode a percent-encoded path component or query value in place */
+static void url_decode(char *str)
+{
+	char *out = str;
+
+	while (*str) {
+		if (str[0] == '%' && hex_value(str[1]) >= 0 && hex_value(str[2]) >= 0) {
+			*out++ = hex_value(str[1]) << 4 | hex_value(str[2]);
+			str += 3;
+		} else {
+			*out++ = *str++;
+		}
+	}
+	*out = 0;
+}
+
+/* Find a parameter in the query string, the value is copied undecoded */
+static bool query_param(const char *query, const char *name, char *value, size_t value_size)
+{
+	size_t name_len = strlen(name);
+
+	while (*query) {
+		const char *end = strchr(query, '&');
+		if (!end)
+			end = query + strlen(query);
+
+		if (strncmp(query, name, name_len) == 0 && query[name_len] == '=') {
+			const char *val = query + name_len + 1;
+			size_t len = MIN((size_t)(end - val), value_size - 1);
+			memcpy(value, val, len);
+			value[len] = 0;
+			return true;
+		}
+
+		query = *end ? end + 1 : end;
+	}
+
+	return false;
+}
+
+/* Returns 0 when the parameter is missing, -1 when it isn't a number */
+static int query_int(const char *query, const char *name, int64_t *value)
+{
+	char str[24];
+	char *end;
+
+	if (!query_param(query, name, str, sizeof(str)))
+		return 0;
+
+	*value = strtoll(str, &end, 10);
+	return str[0] == 0 || *end != 0 ? -1 : 1;
+}
+
+static int serve_asset(http_parser *parser, const struct static_asset *asset, const char *content_type)
+{
+	struct web_data *d = parser->data;
+	char etag[32];
+	char hdrs[256];
+	char version[32];
+
+	snprintf(etag, sizeof(etag), "\"%s\"", asset->hash);
+	if (d->if_none_match[0] && etag_matches(d->if_none_match, etag)) {
+		snprintf(hdrs, sizeof(hdrs), "ETag: %s\r\n", etag);
+		return response_write_hdrs(parser, 304, "Not Modified", content_type, hdrs, NULL, 0);
+	}
+
+	// A request for the exact version can be cached for good, anything else has to be revalidated
+	bool immutable = query_param(d->query_string, "v", version, sizeof(version)) && strcmp(version, asset->hash) == 0;
+
+	const char *encoding = NULL;
+	const unsigned char *body = asset->data;
+	unsigned body_len = asset->len;
+	if (asset->br_data && header_accepts(d->accept_encoding, "br")) {
+		encoding = "br";
+		body = asset->br_data;
+		body_len = asset->br_len;
+	} else if (asset->gz_data && header_accepts(d->accept_encoding, "gzip")) {
+		encoding = "gzip";
+		body = asset->gz_data;
+		body_len = asset->gz_len;
+	}
+
+	int len = snprintf(hdrs, sizeof(hdrs), "ETag: %s\r\nCache-Control: %s\r\nVary: Accept-Encoding\r\n",
+			etag, immutable ? "public, max-age=31536000, immutable" : "no-cache");
+	if (encoding)
+		snprintf(hdrs + len, sizeof(hdrs) - len, "Content-Encoding: %s\r\n", encoding);
+
+	return response_write_hdrs(parser, 200, "OK", content_type, hdrs, (const char *)body, body_len);
+}
+
+#define SERVE_ASSET(name, content_type) static int serve_##name(http_parser *parser) \
 { \
-	return response_write(parser, 200, "OK", content_type, name, strlen(name)); \
+	return serve_asset(parser, &name, content_type); \
+}
+
+SERVE_ASSET(app_js, "text/javascript")
+SERVE_ASSET(app_css, "text/css")
+SERVE_ASSET(index_html, "text/html; charset=utf-8")
+
+static int render_disk_changes(json_t *json, void *arg)
+{
+	uint64_t *since = arg;
+	return disk_manager_disk_changes_json(json, *since);
+}
+
+static int api_disk_changes(http_parser *parser, uint64_t since)
+{
+	return response_stream_json(parser, render_disk_changes, &since);
+}
+
+static int render_startup_trace(json_t *json, void *arg)
+{
+	return startup_trace_json(json);
+}
+
+static int api_self_startup(http_parser *parser)
+{
+	return response_stream_json(parser, render_startup_trace, NULL);
+}
+
+static int render_self_stats(json_t *json, void *arg)
+{
+	return self_stats_json(json, disk_manager_num_disks());
+}
+
+static int api_self(http_parser *parser)
+{
+	return response_stream_json(parser, render_self_stats, NULL);
+}
+
+static int disk_list_pb_visit(disk_t *disk, void *arg)
+{
+	return disk_status_pb(disk, arg);
+}
+
+static int render_disk_query(json_t *json, void *arg)
+{
+	return disk_manager_disk_query_json(json, arg);
+}
+
+/* Filter, sort and page the disk list:
+ *   vendor, model, fw_rev: case insensitive substrings
+ *   smart_ok: true or false
+ *   state: alive (default), dead or all
+ *   sort: a key from disk_manager_sort_key(), prefixed with - for descending order
+ *   limit, page: page size and the 1 based page number
+ */
+static int api_disk_query(http_parser *parser)
+{
+	struct web_data *d = parser->data;
+	char vendor[64], model[64], fw_rev[64], smart_ok[8], state[8], sort[32];
+	disk_query_t query;
+	int64_t limit = 0, page = 1;
+
+	memset(&query, 0, sizeof(query));
+	query.smart_ok = -1;
+	query.state = DISK_STATE_ALIVE;
+	query.sort = DISK_SORT_SERIAL;
+
+	if (query_param(d->query_string, "vendor", vendor, sizeof(vendor))) {
+		url_decode(vendor);
+		query.vendor = vendor;
+	}
+	if (query_param(d->query_string, "model", model, sizeof(model))) {
+		url_decode(model);
+		query.model = model;
+	}
+	if (query_param(d->query_string, "fw_rev", fw_rev, sizeof(fw_rev))) {
+		url_decode(fw_rev);
+		query.fw_rev = fw_rev;
+	}
+
+	if (query_param(d->query_string, "smart_ok", smart_ok, sizeof(smart_ok))) {
+		if (strcmp(smart_ok, "true") == 0)
+			query.smart_ok = 1;
+		else if (strcmp(smart_ok, "false") == 0)
+			query.smart_ok = 0;
+		else
+			goto bad_request;
+	}
+
+	if (query_param(d->query_string, "state", state, sizeof(state))) {
+		if (strcmp(state, "dead") == 0)
+			query.state = DISK_STATE_DEAD;
+		else if (strcmp(state, "all") == 0)
+			query.state = DISK_STATE_ALL;
+		else if (strcmp(state, "alive") != 0)
+			goto bad_request;
+	}
+
+	if (query_param(d->query_string, "sort", sort, sizeof(sort))) {
+		query.descending = sort[0] == '-';
+		int key = disk_manager_sort_key(sort + query.descending);
+		if (key < 0)
+			goto bad_request;
+		query.sort = key;
+	}
+
+	if (query_int(d->query_string, "limit", &limit) < 0 || query_int(d->query_string, "page", &page) < 0 ||
+	    limit < 0 || limit > UINT32_MAX || page < 1 || (page - 1) * limit > UINT32_MAX)
+		goto bad_request;
+	query.limit = limit;
+	query.offset = (page - 1) * limit;
+
+	return response_stream_json(parser, render_disk_query, &query);
+
+bad_request:
+	{
+		static const char *msg = "Bad disk query";
+		return response_write(parser, 400, "Bad Request", "text/plain", msg, strlen(msg));
+	}
+}
+
+/* The parameters of api_disk_query(), any other one (e.g. a cache buster) still gets the plain list */
+static const char *disk_query_params[] = { "vendor", "model", "fw_rev", "smart_ok", "state", "sort", "limit", "page" };
+
+static bool is_disk_query(const char *query)
+{
+	char value[2];
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(disk_query_params); i++) {
+		if (query_param(query, disk_query_params[i], value, sizeof(value)))
+			return true;
+	}
+	return false;
+}
+
+/* A DiskStatus message per disk, encoded straight into the response chunks */
+static int api_disk_list_pb(http_parser *parser)
+{
+	char buf[STREAM_BUF_SIZE];
+	stream_t stream;
+
+	if (response_stream_start(parser, &stream, buf, sizeof(buf), PROTOBUF_CTYPE) < 0)
+		return -1;
+
+	disk_manager_for_each_disk(disk_list_pb_visit, &stream);
+
+	if (response_stream_end(parser, &stream) < 0) {
+		struct web_data *d = parser->data;
+		d->close = true;
+		return -1;
+	}
+	return 0;
 }
 
-SERVE_VAR(app_js, "text/javascript")
-SERVE_VAR(app_css, "text/css")
-SERVE_VAR(index_html, "text/html")
+/* The disk list only changes on a tick or when disks come and go, polling clients are served from a shared rendering */
+static int render_disk_list(stream_t *stream)
+{
+	json_t json;
+
+	json_init(&json, stream);
+	return disk_manager_disk_list_json(&json);
+}
 
 static int api_disk_list(http_parser *parser)
 {
-	char buf[CONNECTION_BUF_SIZE];
-	int written = disk_manager_disk_list_json(buf, CONNECTION_BUF_SIZE);
-	if (written >= 0) {
-		return response_write(parser, 200, "OK", "application/json", buf, written-1);
+	struct web_data *d = parser->data;
+	uint64_t version = disk_manager_list_version();
+	char etag[48];
+	char hdrs[160];
+	char since[24];
+
+	if (query_param(d->query_string, "since", since, sizeof(since))) {
+		char *end;
+		uint64_t since_version = strtoull(since, &end, 10);
+		if (since[0] == 0 || *end != 0) {
+			static const char *msg = "Bad since version";
+			return response_write(parser, 400, "Bad Request", "text/plain", msg, strlen(msg));
+		}
+		return api_disk_changes(parser, since_version);
+	}
+
+	// The plain list is the one everyone polls and is cached
+	if (is_disk_query(d->query_string))
+		return api_disk_query(parser);
+
+	if (wants_protobuf(d))
+		return api_disk_list_pb(parser);
+
+	// The start time keeps the tags unique across restarts as the version starts afresh
+	snprintf(etag, sizeof(etag), "\"%lx-%"PRIx64"\"", (long)web.start_time, version);
+
+	if (d->if_none_match[0] && etag_matches(d->if_none_match, etag)) {
+		snprintf(hdrs, sizeof(hdrs), "ETag: %s\r\n", etag);
+		return response_write_hdrs(parser, 304, "Not Modified", "application/json", hdrs, NULL, 0);
+	}
+
+	render_buf_t *rendered = render_cache_get(&web.disk_list_cache, version, render_disk_list);
+	if (!rendered)
+		return api_disk_list_stream(parser);
+
+	bool gzip = rendered->gz_data && header_accepts(d->accept_encoding, "gzip");
+	snprintf(hdrs, sizeof(hdrs), "ETag: %s\r\nCache-Control: no-cache\r\nVary: Accept, Accept-Encoding\r\n%s",
+			etag, gzip ? "Content-Encoding: gzip\r\n" : "");
+
+	int ret;
+	if (gzip)
+		ret = response_write_hdrs(parser, 200, "OK", "application/json", hdrs, rendered->gz_data, rendered->gz_len);
+	else
+		ret = response_write_hdrs(parser, 200, "OK", "application/json", hdrs, rendered->data, rendered->len);
+
+	render_buf_put(rendered);
+	return ret;
+}
+
+/* Disk resources are rendered in memory as a missing disk must still get its 404, this sends the result */
+static int api_disk_rendered(http_parser *parser, int written, stream_t *stream, stream_mem_t *mem, const char *content_type)
+{
+	int ret;
+
+	if (written == DISK_MGR_NOT_FOUND) {
+		static const char *msg = "Not Found";
+		ret = response_write(parser, 404, msg, "text/plain", msg, strlen(msg));
+	} else if (written < 0 || stream_flush(stream) < 0) {
+		static const char *msg = "Out of memory";
+		ret = response_write(parser, 500, msg, "text/plain", msg, strlen(msg));
 	} else {
-		wire_log(WLOG_CRITICAL, "ERROR: space insufficient");
-		static const char *msg = "Insufficient buffer space";
-		response_write(parser, 500, msg, "text/plain", msg, strlen(msg));
+		ret = response_write(parser, 200, "OK", content_type, mem->data, mem->len);
+	}
+
+	free(mem->data);
+	return ret;
+}
+
+static int api_disk_resource_pb(http_parser *parser, const char *serial, disk_stream_cb_t pb)
+{
+	char buf[STREAM_BUF_SIZE];
+	stream_mem_t mem = { NULL, 0, 0 };
+	stream_t stream;
+
+	stream_init(&stream, buf, sizeof(buf), stream_mem_flush, &mem);
+	int written = disk_manager_disk_stream(serial, pb, &stream);
+	return api_disk_rendered(parser, written, &stream, &mem, PROTOBUF_CTYPE);
+}
+
+struct latency_history_query {
+	json_t json;
+	time_t from;
+	time_t to;
+	unsigned step;
+};
+
+static int latency_history_visit(disk_t *disk, void *arg)
+{
+	struct latency_history_query *query = arg;
+	return disk_latency_history_json(disk, &query->json, query->from, query->to, query->step);
+}
+
+/* /api/disks/<serial>/latency?from=&to=&step= with wall clock seconds, the last day by default */
+static int api_disk_latency_history(http_parser *parser, const char *serial)
+{
+	struct web_data *d = parser->data;
+	struct latency_history_query query;
+	char buf[STREAM_BUF_SIZE];
+	stream_mem_t mem = { NULL, 0, 0 };
+	stream_t stream;
+	int64_t now = time(NULL);
+	int64_t from = 0, to = now, step = 0;
+	int has_from;
+
+	if ((has_from = query_int(d->query_string, "from", &from)) < 0 ||
+	    query_int(d->query_string, "to", &to) < 0 ||
+	    query_int(d->query_string, "step", &step) < 0 ||
+	    (has_from && from > to) || step < 0) {
+		static const char *msg = "Bad latency query";
+		return response_write(parser, 400, "Bad Request", "text/plain", msg, strlen(msg));
+	}
+
+	// Nothing is kept from before the epoch or after now, clamped the arithmetic below can't overflow
+	to = MAX(MIN(to, now), 0);
+	from = MAX(MIN(from, to), 0);
+	query.from = has_from ? from : to - 24*3600;
+	query.to = to;
+	query.step = MIN(step, UINT32_MAX);
+
+	stream_init(&stream, buf, sizeof(buf), stream_mem_flush, &mem);
+	json_init(&query.json, &stream);
+	int written = disk_manager_disk_visit(serial, latency_history_visit, &query);
+	return api_disk_rendered(parser, written, &stream, &mem, "application/json");
+}
+
+struct disk_resource_stream {
+	http_parser *parser;
+	disk_json_cb_t json;
+	disk_t *disk;
+};
+
+static int render_disk_resource(json_t *json, void *arg)
+{
+	struct disk_resource_stream *res = arg;
+	return res->json(res->disk, json);
+}
+
+/* Only called once the disk is found, so the response can start right away */
+static int disk_resource_visit(disk_t *disk, void *arg)
+{
+	struct disk_resource_stream *res = arg;
+
+	res->disk = disk;
+	return response_stream_json(res->parser, render_disk_resource, res);
+}
+
+static int api_disk_resource(http_parser *parser, const char *serial, const struct disk_url *url)
+{
+	struct web_data *d = parser->data;
+	struct disk_resource_stream res = { parser, url->json, NULL };
+
+	if (url->query && d->query_string[0])
+		return url->query(parser, serial);
+	if (url->pb && wants_protobuf(d))
+		return api_disk_resource_pb(parser, serial, url->pb);
+
+	int ret = disk_manager_disk_visit(serial, disk_resource_visit, &res);
+	if (ret == DISK_MGR_NOT_FOUND) {
+		static const char *msg = "Not Found";
+		return response_write(parser, 404, msg, "text/plain", msg, strlen(msg));
+	}
+	if (ret < 0) {
+		d->close = true;
 		return -1;
 	}
+	return 0;
+}
+
+static int api_stream(http_parser *parser)
+{
+	struct web_data *d = parser->data;
+	static const char hdr[] = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n";
+	char hello[96];
+
+	// The client syncs up to the version in the hello, the events carry on from there
+	int hello_len = snprintf(hello, sizeof(hello), "retry: 5000\nevent: hello\ndata: {\"version\":%"PRIu64"}\n\n", disk_manager_data_version());
+
+	if (buf_write(d, hdr, sizeof(hdr) - 1) < 0 || buf_write(d, hello, hello_len) < 0) {
+		d->close = true;
+		return -1;
+	}
+
+	d->handoff = true;
+	return 0;
+}
+
+static int api_metrics(http_parser *parser)
+{
+	struct web_data *d = parser->data;
+	static const char *ctype = "text/plain; version=0.0.4; charset=utf-8";
+	char hdrs[96];
+
+	// The disk state is rendered again only when a disk changed, the counters move all the time and
+	// scrapes within the same interval share a rendering of them
+	uint64_t interval = monoclock_get_seconds() / METRICS_CACHE_SECS;
+	render_buf_t *state = render_cache_get(&web.metrics_state_cache, disk_manager_data_version(), metrics_render_state);
+	render_buf_t *counters = render_cache_get(&web.metrics_counters_cache, interval, metrics_render_counters);
+	if (!state || !counters) {
+		static const char *msg = "Failed to render metrics";
+		if (state)
+			render_buf_put(state);
+		if (counters)
+			render_buf_put(counters);
+		return response_write(parser, 500, "Internal Server Error", "text/plain", msg, strlen(msg));
+	}
+
+	// Two gzip members one after the other are a valid gzip body
+	bool gzip = state->gz_data && counters->gz_data && header_accepts(d->accept_encoding, "gzip");
+	snprintf(hdrs, sizeof(hdrs), "Cache-Control: no-cache\r\nVary: Accept-Encoding\r\n%s",
+			gzip ? "Content-Encoding: gzip\r\n" : "");
+
+	struct iovec body[RESPONSE_BODY_PARTS] = {
+		{ .iov_base = gzip ? state->gz_data : state->data, .iov_len = gzip ? state->gz_len : state->len },
+		{ .iov_base = gzip ? counters->gz_data : counters->data, .iov_len = gzip ? counters->gz_len : counters->len },
+	};
+	int ret = response_write_parts(parser, 200, "OK", ctype, hdrs, body, RESPONSE_BODY_PARTS);
+
+	render_buf_put(state);
+	render_buf_put(counters);
+	return ret;
 }
 
 static int rescan_disks(http_parser *parser)
@@ -129,6 +892,18 @@ static struct url urls[] = {
 	{"/app.css", serve_app_css},
 	{"/rescan", rescan_disks},
 	{"/api/disks", api_disk_list},
+	{"/api/stream", api_stream},
+	{"/metrics", api_metrics},
+	{"/api/self", api_self},
+	{"/api/self/startup", api_self_startup},
+};
+
+/* Served under /api/disks/<serial>/<resource> */
+static struct disk_url disk_urls[] = {
+	{"counters", disk_counters_json, NULL, NULL},
+	{"latency", disk_latency_classes_json, disk_latency_classes_pb, api_disk_latency_history},
+	{"sense", disk_sense_stats_json, NULL, NULL},
+	{"trace", disk_command_trace_json, NULL, NULL},
 };
 
 static void set_nonblock(int fd)
@@ -179,16 +954,115 @@ static int socket_setup(unsigned short port)
 	return fd;
 }
 
+/* Access to the control socket is by the file permissions, the owner and the group */
+static int unix_socket_setup(const char *path)
+{
+	struct sockaddr_un addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		wire_log(WLOG_FATAL, "Socket path too long: %s", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		wire_log(WLOG_FATAL, "Failed to create unix socket: %m");
+		return -1;
+	}
+
+	set_nonblock(fd);
+
+	// A socket left behind by an earlier run would fail the bind
+	unlink(path);
+
+	mode_t old_mask = umask(S_IRWXO);
+	int ret = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+	umask(old_mask);
+	if (ret < 0) {
+		wire_log(WLOG_FATAL, "Failed to bind to %s: %m", path);
+		wio_close(fd);
+		return -1;
+	}
+
+	ret = listen(fd, 100);
+	if (ret < 0) {
+		wire_log(WLOG_FATAL, "failed to listen on %s: %m", path);
+		wio_close(fd);
+		unlink(path);
+		return -1;
+	}
+
+	return fd;
+}
+
 static int on_message_begin(http_parser *parser)
 {
 	struct web_data *d = parser->data;
 
 	d->path[0] = 0;
 	d->query_string[0] = 0;
+	d->header_field_len = 0;
+	d->in_header_value = false;
+	d->header_value = NULL;
+	d->if_none_match[0] = 0;
+	d->accept_encoding[0] = 0;
+	d->accept[0] = 0;
+	d->in_message = true;
+	d->request_start = monoclock_get();
 
 	return 0;
 }
 
+static int on_header_field(http_parser *parser, const char *at, size_t length)
+{
+	struct web_data *d = parser->data;
+
+	if (d->in_header_value) {
+		d->in_header_value = false;
+		d->header_field_len = 0;
+	}
+
+	// Longer names are of no interest, they just won't match
+	size_t copy = MIN(length, sizeof(d->header_field) - 1 - d->header_field_len);
+	memcpy(d->header_field + d->header_field_len, at, copy);
+	d->header_field_len += copy;
+	return 0;
+}
+
+static int on_header_value(http_parser *parser, const char *at, size_t length)
+{
+	struct web_data *d = parser->data;
+
+	if (!d->in_header_value) {
+		d->in_header_value = true;
+		d->header_field[d->header_field_len] = 0;
+
+		if (strcasecmp(d->header_field, "If-None-Match") == 0) {
+			d->header_value = d->if_none_match;
+			d->header_value_size = sizeof(d->if_none_match);
+		} else if (strcasecmp(d->header_field, "Accept-Encoding") == 0) {
+			d->header_value = d->accept_encoding;
+			d->header_value_size = sizeof(d->accept_encoding);
+		} else if (strcasecmp(d->header_field, "Accept") == 0) {
+			d->header_value = d->accept;
+			d->header_value_size = sizeof(d->accept);
+		} else {
+			d->header_value = NULL;
+		}
+	}
+
+	if (d->header_value) {
+		size_t cur_len = strlen(d->header_value);
+		size_t copy = MIN(length, d->header_value_size - 1 - cur_len);
+		memcpy(d->header_value + cur_len, at, copy);
+		d->header_value[cur_len + copy] = 0;
+	}
+	return 0;
+}
+
 static int on_headers_complete(http_parser *parser)
 {
 	struct web_data *d = parser->data;
@@ -196,7 +1070,26 @@ static int on_headers_complete(http_parser *parser)
 	return 0;
 }
 
-static int on_message_complete(http_parser *parser)
+static bool disk_url_dispatch(http_parser *parser, char *path)
+{
+	char *resource = strchr(path, '/');
+	if (!resource)
+		return false;
+	*resource++ = 0;
+
+	int i;
+	for (i = 0; i < ARRAY_SIZE(disk_urls); i++) {
+		if (strcasecmp(disk_urls[i].resource, resource) == 0) {
+			url_decode(path);
+			api_disk_resource(parser, path, &disk_urls[i]);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void web_dispatch(http_parser *parser)
 {
 	struct web_data *d = parser->data;
 
@@ -205,12 +1098,32 @@ static int on_message_complete(http_parser *parser)
 	for (i = 0; i < ARRAY_SIZE(urls); i++) {
 		if (strcasecmp(urls[i].path, d->path) == 0) {
 			urls[i].cb(parser);
-			return 0;
+			return;
 		}
 	}
 
+	if (strncasecmp(d->path, DISK_URL_PREFIX, strlen(DISK_URL_PREFIX)) == 0) {
+		if (disk_url_dispatch(parser, d->path + strlen(DISK_URL_PREFIX)))
+			return;
+	}
+
 	static const char *msg = "Not Found";
-	return response_write(parser, 404, msg, "text/plain", msg, strlen(msg));
+	response_write(parser, 404, msg, "text/plain", msg, strlen(msg));
+}
+
+static int on_message_complete(http_parser *parser)
+{
+	struct web_data *d = parser->data;
+
+	d->in_message = false;
+	web_dispatch(parser);
+	self_stats_web_request((monoclock_get() - d->request_start) * 1000.0);
+
+	if (!http_should_keep_alive(parser))
+		d->close = true;
+
+	// Stop at the end of the response, pipelined requests after it would have nowhere to go
+	return d->close || d->handoff ? -1 : 0;
 }
 
 static int on_url(http_parser *parser, const char *at, size_t length)
@@ -223,6 +1136,8 @@ static int on_url(http_parser *parser, const char *at, size_t length)
 	}
 
 	if (url.field_set & (1<<UF_PATH)) {
+		if (url.field_data[UF_PATH].len >= sizeof(d->path))
+			return -1;
 		memcpy(d->path, at + url.field_data[UF_PATH].off, url.field_data[UF_PATH].len);
 		d->path[url.field_data[UF_PATH].len] = 0;
 	} else {
@@ -230,6 +1145,8 @@ static int on_url(http_parser *parser, const char *at, size_t length)
 	}
 
 	if (url.field_set & (1<<UF_QUERY)) {
+		if (url.field_data[UF_QUERY].len >= sizeof(d->query_string))
+			return -1;
 		memcpy(d->query_string, at + url.field_data[UF_QUERY].off, url.field_data[UF_QUERY].len);
 		d->query_string[url.field_data[UF_QUERY].len] = 0;
 	}
@@ -239,21 +1156,95 @@ static int on_url(http_parser *parser, const char *at, size_t length)
 
 static const struct http_parser_settings parser_settings = {
 	.on_message_begin = on_message_begin,
+	.on_header_field = on_header_field,
+	.on_header_value = on_header_value,
 	.on_headers_complete = on_headers_complete,
 	.on_message_complete = on_message_complete,
 
 	.on_url = on_url,
 };
 
+/* The binary control protocol, see ctl.h. The buffer holds what was read so far. */
+static void web_ctl_run(struct web_data *d, char *buf, unsigned len, unsigned size)
+{
+	char stream_buf[STREAM_BUF_SIZE];
+	stream_mem_t mem = { NULL, 0, 0 };
+	stream_t stream;
+
+	while (1) {
+		// Serve the complete commands at the front of the buffer
+		while (len >= CTL_HDR_SIZE) {
+			unsigned char *hdr = (unsigned char *)buf;
+			uint32_t payload_len = ctl_hdr_len(hdr);
+			if (hdr[0] != CTL_MAGIC || payload_len > CTL_MAX_PAYLOAD) {
+				wire_log(WLOG_INFO, "Invalid control frame on fd %d", d->fd);
+				goto out;
+			}
+			if (len < CTL_HDR_SIZE + payload_len)
+				break;
+
+			mem.len = 0;
+			stream_init(&stream, stream_buf, sizeof(stream_buf), stream_mem_flush, &mem);
+			int status = ctl_execute(hdr[1], hdr + CTL_HDR_SIZE, payload_len, &stream);
+			if (stream_flush(&stream) < 0) {
+				status = CTL_ERR_INTERNAL;
+				mem.len = 0;
+			}
+
+			unsigned char resp_hdr[CTL_HDR_SIZE];
+			ctl_hdr_pack(resp_hdr, status, mem.len);
+			struct iovec iov[2] = {
+				{ .iov_base = resp_hdr, .iov_len = sizeof(resp_hdr) },
+				{ .iov_base = mem.data, .iov_len = mem.len },
+			};
+			if (buf_writev(d, iov, mem.len > 0 ? 2 : 1) < 0)
+				goto out;
+
+			len -= CTL_HDR_SIZE + payload_len;
+			memmove(buf, buf + CTL_HDR_SIZE + payload_len, len);
+		}
+
+		int received = read(d->fd, buf + len, size - len);
+		if (received == 0) {
+			break;
+		} else if (received < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				break;
+
+			wire_fd_mode_read(&d->fd_state);
+			if (!web_wait(d, len > 0 ? WEB_READ_TIMEOUT_MSEC : WEB_IDLE_TIMEOUT_MSEC))
+				break;
+			continue;
+		}
+		len += received;
+	}
+
+out:
+	free(mem.data);
+}
+
 static void web_run(void *arg)
 {
 	struct web_data d = {
 		.fd = (long int)arg,
 	};
 	http_parser parser;
+	struct sockaddr_storage local_addr;
+	socklen_t local_addr_len = sizeof(local_addr);
+
+	web.num_connections++;
+	self_cpu_start(&d.cpu);
+
+	if (getsockname(d.fd, (struct sockaddr *)&local_addr, &local_addr_len) == 0)
+		d.local = local_addr.ss_family == AF_UNIX;
 
 	wire_fd_mode_init(&d.fd_state, d.fd);
-	wire_fd_mode_read(&d.fd_state);
+	wire_wait_list_init(&d.wait_list);
+	wire_fd_wait_list_chain(&d.wait_list, &d.fd_state);
+	timer_bus_deadline_init(&d.deadline);
+	wire_wait_chain(&d.wait_list, &d.deadline.wait);
 
 	set_nonblock(d.fd);
 
@@ -261,16 +1252,31 @@ static void web_run(void *arg)
 	parser.data = &d;
 
 	char buf[4096];
+	bool first = true;
 	do {
 		buf[0] = 0;
 		int received = read(d.fd, buf, sizeof(buf));
+		if (received > 0 && first) {
+			first = false;
+			if (d.local && (unsigned char)buf[0] == CTL_MAGIC) {
+				web_ctl_run(&d, buf, received, sizeof(buf));
+				break;
+			}
+		}
+
 		if (received == 0) {
 			/* Fall-through, tell parser about EOF */
 		} else if (received < 0) {
-			if (errno == EINTR || errno == EAGAIN) {
-				/* Nothing received yet, wait for it */
-				// TODO: employ a timeout here to exit if no input is received
-				wire_fd_wait(&d.fd_state);
+			if (errno == EINTR) {
+				continue;
+			} else if (errno == EAGAIN) {
+				/* Nothing received yet, wait for it. Pipelined requests are only read once the
+				 * responses before them were written, a client that doesn't read is not served more. */
+				wire_fd_mode_read(&d.fd_state);
+				if (!web_wait(&d, d.in_message ? WEB_READ_TIMEOUT_MSEC : WEB_IDLE_TIMEOUT_MSEC)) {
+					wire_log(WLOG_DEBUG, "Connection on fd %d timed out", d.fd);
+					break;
+				}
 				continue;
 			} else {
 				break;
@@ -284,23 +1290,43 @@ static void web_run(void *arg)
 		} else if (received == 0) {
 			// At EOF, exit now
 			break;
+		} else if (d.close || d.handoff) {
+			// The response can only be terminated by closing the connection, or it is no longer ours
+			break;
 		} else if (processed != (size_t)received) {
 			// Error in parsing
-			wire_log(WLOG_DEBUG, "Not everything was parsed, error is likely, bailing out. (processed %d received %d)", processed, received);
+			wire_log(WLOG_DEBUG, "Not everything was parsed, error is likely, bailing out. (processed %zu received %d)", processed, received);
 			break;
 		}
 	} while (1);
 
+	timer_bus_deadline_clear(&d.deadline);
+	wire_wait_unchain(&d.deadline.wait);
 	wire_fd_mode_none(&d.fd_state);
-	wio_close(d.fd);
+	wire_wait_unchain(&d.fd_state.wait);
+	self_cpu_stop(&d.cpu, SELF_TASK_WEB);
+	web.num_connections--;
+	if (!d.handoff || !sse_subscribe(d.fd))
+		wio_close(d.fd);
 }
 
 // ---
 
+/* Turn a connection away without tying up a wire, the client may come back shortly */
+static void web_busy(int fd)
+{
+	static const char resp[] = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\nContent-Type: text/plain\r\nContent-Length: 5\r\nConnection: close\r\n\r\nBusy\n";
+
+	// A fresh socket has all the room for it, there is nothing to wait for
+	if (send(fd, resp, sizeof(resp) - 1, MSG_DONTWAIT|MSG_NOSIGNAL) < 0)
+		wire_log(WLOG_DEBUG, "Failed to send busy response: %m");
+	wio_close(fd);
+}
+
 static void web_accept(void *arg)
 {
-        int port = (long int)arg;
-        int fd = socket_setup(port);
+        struct web_listener *l = arg;
+        int fd = l->path ? unix_socket_setup(l->path) : socket_setup(l->port);
         if (fd < 0)
                 return;
 
@@ -310,30 +1336,32 @@ static void web_accept(void *arg)
 
 		wire_wait_list_t wait_list;
 		wire_wait_list_init(&wait_list);
-		wire_wait_init(&web.close_wait);
-		wire_wait_chain(&wait_list, &web.close_wait);
+		wire_wait_init(&l->close_wait);
+		wire_wait_chain(&wait_list, &l->close_wait);
 		wire_fd_wait_list_chain(&wait_list, &fd_state);
 
-		wire_log(WLOG_INFO, "listening on port %d", port);
+		if (l->path)
+			wire_log(WLOG_INFO, "listening on %s", l->path);
+		else
+			wire_log(WLOG_INFO, "listening on port %d", l->port);
 
         while (1) {
 			    wire_fd_mode_read(&fd_state);
 				wire_wait_reset(&fd_state.wait);
                 wire_list_wait(&wait_list);
 
-				if (web.close_wait.triggered) {
+				if (l->close_wait.triggered) {
 					break;
 				}
 
                 int new_fd = accept(fd, NULL, NULL);
                 if (new_fd >= 0) {
                         char name[32];
-                        snprintf(name, sizeof(name), "web %u %d", web_id++, new_fd);
+                        snprintf(name, sizeof(name), "%s %u %d", l->name, web_id++, new_fd);
                         wire_t *task = wire_pool_alloc(&web.web_pool, name, web_run, (void*)(long int)new_fd);
                         if (!task) {
                                 wire_log(WLOG_NOTICE, "Web server is busy, sorry");
-								// TODO: Send something into the connection
-                                wio_close(new_fd);
+                                web_busy(new_fd);
                         }
                 } else {
                         if (errno != EINTR && errno != EAGAIN) {
@@ -345,19 +1373,60 @@ static void web_accept(void *arg)
 
 		wire_fd_mode_none(&fd_state);
 		wio_close(fd);
+		if (l->path)
+			unlink(l->path);
 		wire_log(WLOG_INFO, "Web interface shutdown");
 }
 
+static size_t render_cache_size(render_cache_t *cache)
+{
+	return cache->cur ? cache->cur->len + cache->cur->gz_len : 0;
+}
+
+/* The stacks of the connection wires hold their buffers */
+static void web_memory(self_mem_t *mem)
+{
+	size_t cached = render_cache_size(&web.disk_list_cache) + render_cache_size(&web.metrics_state_cache) +
+		render_cache_size(&web.metrics_counters_cache);
+
+	mem->reserved = (size_t)WEB_MAX_CONNECTIONS * CONNECTION_BUF_SIZE*2 + cached;
+	mem->resident = (size_t)web.num_connections * CONNECTION_BUF_SIZE*2 + cached;
+}
+
 void web_init(int port)
 {
 	memset(&web, 0, sizeof(web));
+	web.start_time = time(NULL);
+	sse_init();
+
+	// Every connection holds a file descriptor, the default soft limit would run out before the pool
+	struct rlimit rlim;
+	if (getrlimit(RLIMIT_NOFILE, &rlim) == 0 && rlim.rlim_cur < rlim.rlim_max && rlim.rlim_cur < WEB_MAX_CONNECTIONS + 256) {
+		rlim.rlim_cur = rlim.rlim_max;
+		if (setrlimit(RLIMIT_NOFILE, &rlim) < 0)
+			wire_log(WLOG_WARNING, "Failed to raise the open files limit: %m");
+	}
+
+	timer_bus_init(&web.timer_bus, WEB_TIMER_MSEC);
+	self_stats_timer_bus("web", &web.timer_bus);
+	self_stats_memory("web_buffers", web_memory);
+	wire_pool_init(&web.web_pool, NULL, WEB_MAX_CONNECTIONS, CONNECTION_BUF_SIZE*2);
+
+	web.tcp.name = "web";
+	web.tcp.port = port;
+	wire_init(&web.tcp.wire, "web accept", web_accept, &web.tcp, WIRE_STACK_ALLOC(4096));
 
-	wire_pool_init(&web.web_pool, NULL, 16, CONNECTION_BUF_SIZE*2);
-	wire_init(&web.accept_wire, "web accept", web_accept, (void*)(long int)port, WIRE_STACK_ALLOC(4096));
+	// The same service for local agents and disksurvey-ctl, without the network exposure
+	web.local.name = "local";
+	web.local.path = CTL_SOCKET_PATH;
+	wire_init(&web.local.wire, "local accept", web_accept, &web.local, WIRE_STACK_ALLOC(4096));
 }
 
 void web_stop(void)
 {
 	wire_log(WLOG_INFO, "Shutting down the web interface");
-	wire_wait_resume(&web.close_wait);
+	sse_stop();
+	timer_bus_stop(&web.timer_bus);
+	wire_wait_resume(&web.tcp.close_wait);
+	wire_wait_resume(&web.local.close_wait);
 }
@@ -5,24 +5,19 @@
 
 #define MARSHALL_FILENAME "test_marshall_file"
 
-void disk_init(disk_t *disk, disk_info_t *disk_info, const char *dev) {}
-void disk_cleanup(disk_t *disk) {}
+bool disk_init(disk_t *disk, disk_info_t *disk_info, const char *dev, wire_pool_t *pool) { return true; }
 void disk_tick(disk_t *disk) {}
 void disk_tur(disk_t *disk) {}
-void disk_inquiry(disk_t *disk) {}
 void disk_stop(disk_t *disk) {}
-int disk_json(disk_t *disk, char *buf, int len) {return 0;}
-bool disk_scanner_active(disk_scanner_t *disk_scanner) { return false; }
-void disk_scanner_inquiry(disk_scanner_t *disk, const char *sg_dev, scanner_done_cb done_cb) {}
+int disk_json(disk_t *disk, json_t *json) {return 0;}
+int disk_json_fields(disk_t *disk, json_t *json) {return 0;}
+bool disk_smart_ok(disk_t *disk) { return true; }
+void disk_record_latency(disk_t *disk, latency_class_e latency_class, double msecs) {}
+void disk_record_outcome(disk_t *disk, const sense_outcome_t *outcome) {}
+void disk_command_trace_log(disk_t *disk) {}
+bool disk_scanner_inquiry(disk_scanner_t *disk, const char *sg_dev) { return false; }
 bool system_identifier_read(system_identifier_t *system_id) { memset(system_id, 0, sizeof(*system_id)); return true; }
 
-EV_API_DECL void ev_async_send     (EV_P_ ev_async *w) {}
-EV_API_DECL void ev_timer_start    (EV_P_ ev_timer *w) {}
-EV_API_DECL void ev_async_start    (EV_P_ ev_async *w) {}
-EV_API_DECL void ev_timer_stop     (EV_P_ ev_timer *w) {}
-EV_API_DECL void ev_break (EV_P_ int how EV_CPP (= EVBREAK_ONE)) {}
-EV_API_DECL void ev_signal_start   (EV_P_ ev_signal *w) {}
-
 static void setup(void)
 {
     disk_manager_init_mgr();
@@ -131,7 +126,7 @@ START_TEST(test_marshall_save)
     int fd = creat("test_disk_marshall", 0600);
     fail_unless(fd > 0);
 
-    disk_t disk;
+    static disk_t disk;
     bool save_success = disk_manager_save_disk_state(&disk, fd);
     close(fd);
     fail_unless(save_success == true);
@@ -204,8 +199,12 @@ START_TEST(test_marshall_latency)
     int fd = creat("test_disk_marshall", 0600);
     fail_unless(fd > 0);
 
-    latency_t latency;
-    bool save_success = disk_manager_save_disk_latency(&latency, fd);
+    static latency_t latency;
+    latency.cur_entry = 3;
+    latency.entries[2].hist[1] = 7;
+    latency.entries[2].top_latencies[0] = 12.5;
+    latency_reindex(&latency);
+    bool save_success = disk_manager_save_disk_latency(&latency, 1500000000, fd);
     close(fd);
     fail_unless(save_success == true);
 
@@ -222,16 +221,95 @@ START_TEST(test_marshall_latency)
     fail_unless(ret == statbuf.st_size);
 
     uint32_t offset = 0;
-    latency_t latency_load;
-    memset(&latency_load, 0, sizeof(latency_load));
+    static latency_t latency_load;
+    time_t tick_ts;
 
-    bool success = disk_manager_load_latency(&latency_load, buf, &offset, statbuf.st_size);
+    bool success = disk_manager_load_latency(&latency_load, &tick_ts, buf, &offset, statbuf.st_size);
     fail_unless(success == true);
     fail_unless(offset == statbuf.st_size);
+    fail_unless(tick_ts == 1500000000);
     fail_unless(memcmp(&latency, &latency_load, sizeof(latency)) == 0);
 }
 END_TEST
 
+START_TEST(test_marshall_latency_no_alloc)
+{
+    static latency_t latency;
+    alloc_count_t before, after;
+
+    fail_unless(ALLOC_TRACK_ENABLED, "The allocations must be counted, build with -DALLOC_TRACK");
+
+    int fd = creat("test_disk_marshall", 0600);
+    fail_unless(fd > 0);
+
+    // Saving runs in the child for every disk, the history must be packed without the heap
+    alloc_track_get(&before);
+    bool save_success = disk_manager_save_disk_latency(&latency, 0, fd);
+    alloc_track_get(&after);
+    close(fd);
+
+    fail_unless(save_success == true);
+    fail_unless(after.allocs == before.allocs, "Saving the latency allocated %llu times",
+                (unsigned long long)(after.allocs - before.allocs));
+}
+END_TEST
+
+START_TEST(test_marshall_counters)
+{
+    int fd = creat("test_disk_marshall", 0600);
+    fail_unless(fd > 0);
+
+    disk_t disk;
+    memset(&disk, 0, sizeof(disk));
+    disk.num_smart_attrs = 2;
+    disk.smart_attrs[0] = (smart_attr_t){ .id = 5, .flags = 0x33, .value = 100, .worst = 100, .threshold = 10, .raw = 8 };
+    disk.smart_attrs[1] = (smart_attr_t){ .id = 9, .flags = 0x32, .value = 90, .worst = 90, .threshold = 0, .raw = 1000 };
+
+    int i;
+    for (i = 0; i < 1000; i++) {
+        series_set_add(&disk.series, 9, 1000000 + i*60, 1000 + i);
+        series_set_add(&disk.series, 194, 1000000 + i*60, 30 + (i % 7));
+    }
+
+    bool save_success = disk_manager_save_disk_counters(&disk, fd);
+    close(fd);
+    fail_unless(save_success == true);
+
+    unsigned char *buf;
+
+    fd = open("test_disk_marshall", O_RDONLY);
+    fail_unless(fd >= 0);
+    struct stat statbuf;
+    int ret = fstat(fd, &statbuf);
+    fail_unless(ret >= 0);
+    buf = malloc(statbuf.st_size);
+    ret = read(fd, buf, statbuf.st_size);
+    close(fd);
+    fail_unless(ret == statbuf.st_size);
+
+    uint32_t offset = 0;
+    disk_t disk_load;
+    memset(&disk_load, 0, sizeof(disk_load));
+
+    bool success = disk_manager_load_counters(&disk_load, buf, &offset, statbuf.st_size);
+    fail_unless(success == true);
+    fail_unless(offset == statbuf.st_size);
+    fail_unless(memcmp(disk.smart_attrs, disk_load.smart_attrs, sizeof(disk.smart_attrs)) == 0);
+    fail_unless(memcmp(&disk.series, &disk_load.series, sizeof(disk.series)) == 0);
+
+    // Power on hours grow steadily and must collapse into a single run
+    series_t *series = series_set_find(&disk_load.series, 9);
+    fail_unless(series != NULL);
+    series_run_t run;
+    unsigned run_offset = 0;
+    fail_unless(series_next_run(series, &run_offset, &run) == true);
+    ck_assert_int_eq(run.count, 999);
+    ck_assert_int_eq(run.dt, 60);
+    ck_assert_int_eq(run.dv, 1);
+    fail_unless(series_next_run(series, &run_offset, &run) == false);
+}
+END_TEST
+
 Suite *disk_mgr_suite(void)
 {
   Suite *s = suite_create("Disk Manager");
@@ -253,6 +331,8 @@ Suite *disk_mgr_suite(void)
   tcase_add_test(tc_marshall, test_marshall_save);
   tcase_add_test(tc_marshall, test_marshall_disk_info);
   tcase_add_test(tc_marshall, test_marshall_latency);
+  tcase_add_test(tc_marshall, test_marshall_latency_no_alloc);
+  tcase_add_test(tc_marshall, test_marshall_counters);
   suite_add_tcase(s, tc_marshall);
 
   return s;
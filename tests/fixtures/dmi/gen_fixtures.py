@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+#
+# Generate the DMI table fixtures of tests/smbios.c. The tables follow the
+# structure layouts and the string quirks seen in the firmware of each vendor
+# (padded serials, placeholder strings, missing structures, short structures)
+# with the serials replaced by made up ones.
+#
+# usage: gen_fixtures.py [outdir]
+
+import os
+import struct
+import sys
+
+def structure(stype, handle, fields, strings):
+    """fields are the bytes of the formatted area after the 4 byte header"""
+    body = struct.pack('<BBH', stype, 4 + len(fields), handle) + bytes(fields)
+    if strings:
+        tail = b''.join(s.encode('latin-1') + b'\0' for s in strings) + b'\0'
+    else:
+        tail = b'\0\0'
+    return body + tail
+
+def bios(handle, vendor, version):
+    # vendor=1, version=2, start segment, release date=3, rom size, characteristics
+    return structure(0, handle, [1, 2, 0x00, 0xf0, 3, 0xff] + [0] * 8 + [0x80, 0x01], [vendor, version, '01/01/2020'])
+
+def system(handle, manufacturer, product, serial):
+    # manufacturer=1, product=2, version=3, serial=4, uuid, wake-up type, sku=5, family=6
+    if serial is None:
+        return structure(1, handle, [1, 2, 3, 0] + list(range(16)) + [6, 4, 5],
+                         [manufacturer, product, 'Not Specified', 'SKU', 'Family'])
+    return structure(1, handle, [1, 2, 3, 4] + list(range(16)) + [6, 5, 6],
+                     [manufacturer, product, 'Not Specified', serial, 'SKU', 'Family'])
+
+def baseboard(handle, manufacturer, serial, short=False):
+    # manufacturer=1, product=2, version=3, serial=4, asset tag=5
+    fields = [1, 2, 3, 4, 5, 0x09, 6, 0x00, 0x00, 0x0a, 0]
+    return structure(2, handle, fields[:2] if short else fields, [manufacturer, 'Board', 'A00', serial, 'Asset', 'Location'])
+
+def chassis(handle, manufacturer, serial, short=False):
+    # manufacturer=1, type, version=2, serial=3, asset tag=4
+    idx = 3 if serial is not None else 0
+    fields = [1, 0x17, 2, idx, 4, 3, 3, 3, 3, 0, 0, 0, 0, 2, 0, 0]
+    strings = [manufacturer, 'Not Specified', serial if serial is not None else 'x', 'Asset']
+    return structure(3, handle, fields[:1] if short else fields, strings)
+
+def processor(handle):
+    return structure(4, handle, [1, 3, 0xb3, 2] + [0] * 36, ['CPU1', 'Intel'])
+
+def end(handle):
+    return structure(127, handle, [], [])
+
+fixtures = {
+    # Dell PowerEdge, the baseboard serial is the slashed service tag form
+    'dell-poweredge.bin': [
+        bios(0x0000, 'Dell Inc.', '2.12.2'),
+        system(0x0100, 'Dell Inc.', 'PowerEdge R740xd', 'FX2K9Q3'),
+        baseboard(0x0200, 'Dell Inc.', '/FX2K9Q3/CNFCW0097E00AT/'),
+        chassis(0x0300, 'Dell Inc.', 'FX2K9Q3'),
+        processor(0x0400),
+        end(0x7f00),
+    ],
+    # HPE ProLiant, serials padded with spaces
+    'hpe-proliant.bin': [
+        bios(0x0000, 'HPE', 'U32'),
+        system(0x0001, 'HPE', 'ProLiant DL380 Gen10', 'CZJ8270F0P  '),
+        chassis(0x0003, 'HPE', 'CZJ8270F0P  '),
+        baseboard(0x0002, 'HPE', 'PWZVP0ARHBW1MN'),
+        end(0x7f00),
+    ],
+    # Supermicro, the chassis serial is left as a placeholder
+    'supermicro.bin': [
+        bios(0x0000, 'American Megatrends Inc.', '3.4'),
+        system(0x0001, 'Supermicro', 'SYS-6029P-TRT', 'A263420X9718042'),
+        baseboard(0x0002, 'Supermicro', 'ZM197S003456'),
+        chassis(0x0003, 'Supermicro', 'To be filled by O.E.M.'),
+        end(0x0004),
+    ],
+    # QEMU, no serials given and no baseboard structure at all
+    'qemu.bin': [
+        bios(0x0000, 'SeaBIOS', '1.13.0'),
+        system(0x0100, 'QEMU', 'Standard PC (Q35 + ICH9, 2009)', None),
+        chassis(0x0300, 'QEMU', None),
+        processor(0x0400),
+        end(0x7f00),
+    ],
+    # Lenovo ThinkSystem, two baseboards and a chassis too short to hold a serial
+    'lenovo-thinksystem.bin': [
+        bios(0x0000, 'Lenovo', 'TEE156L'),
+        system(0x0001, 'Lenovo', 'ThinkSystem SR650', 'J30018KD'),
+        chassis(0x0003, 'Lenovo', 'J30018KD', short=True),
+        baseboard(0x0002, 'Lenovo', 'L1HF89F00CV'),
+        baseboard(0x0005, 'Lenovo', 'L1HF89F00XX'),
+        end(0x7f00),
+    ],
+    # Cut off in the middle of the baseboard, with a control character in the system serial
+    'truncated.bin': [
+        system(0x0001, 'Vendor', 'Product', 'AB\tCD'),
+        chassis(0x0003, 'Vendor', 'CH-1'),
+        baseboard(0x0002, 'Vendor', 'BB-1')[:9],
+    ],
+}
+
+outdir = sys.argv[1] if len(sys.argv) > 1 else os.path.dirname(os.path.abspath(__file__))
+for name, structs in fixtures.items():
+    with open(os.path.join(outdir, name), 'wb') as f:
+        f.write(b''.join(structs))
@@ -0,0 +1,154 @@
+/* The range index of the latency history against a plain scan of the entries */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+
+#include "../src/latency.h"
+#include "../src/util.h"
+
+#define NUM_ENTRIES ARRAY_SIZE(((latency_t *)0)->entries)
+#define BLOCK_ENTRIES (NUM_ENTRIES / ARRAY_SIZE(((latency_t *)0)->block_start))
+#define RANDOM_RANGES 2000
+
+static latency_t latency;
+
+static void setup(void)
+{
+    latency_init(&latency);
+    srand(1);
+}
+
+static void teardown(void)
+{
+}
+
+/* A few samples per entry, some entries stay empty */
+static void fill(latency_t *lat, int ticks)
+{
+    int i;
+
+    for (i = 0; i < ticks; i++) {
+        int samples = rand() % 4;
+        while (samples--)
+            latency_add_sample(lat, (rand() % 20000) / 1000.0);
+        latency_tick(lat);
+    }
+}
+
+static void check_range(latency_t *lat, int oldest_age, int newest_age)
+{
+    uint32_t hist[LATENCY_RANGE_COUNT] = { 0 };
+    uint64_t count = 0;
+    double max = 0;
+    latency_range_t range;
+    int age, j;
+
+    for (age = oldest_age; age >= newest_age; age--) {
+        latency_summary_t *entry = &lat->entries[(lat->cur_entry - age + NUM_ENTRIES) % NUM_ENTRIES];
+        for (j = 0; j < LATENCY_RANGE_COUNT; j++) {
+            hist[j] += entry->hist[j];
+            count += entry->hist[j];
+        }
+        if (entry->top_latencies[NUM_TOP_LATENCIES-1] > max)
+            max = entry->top_latencies[NUM_TOP_LATENCIES-1];
+    }
+
+    latency_range(lat, oldest_age, newest_age, &range);
+    fail_unless(memcmp(hist, range.hist, sizeof(hist)) == 0, "Histogram of ages %d to %d at entry %d", oldest_age, newest_age, lat->cur_entry);
+    fail_unless(range.count == count, "Count of ages %d to %d at entry %d", oldest_age, newest_age, lat->cur_entry);
+    fail_unless(range.max == max, "Maximum of ages %d to %d at entry %d", oldest_age, newest_age, lat->cur_entry);
+}
+
+static void check_random_ranges(latency_t *lat)
+{
+    int i;
+
+    for (i = 0; i < RANDOM_RANGES; i++) {
+        int a = rand() % NUM_ENTRIES;
+        int b = rand() % NUM_ENTRIES;
+        check_range(lat, a > b ? a : b, a > b ? b : a);
+    }
+}
+
+START_TEST(test_range_in_block)
+{
+    int oldest, newest;
+
+    fill(&latency, 3 * BLOCK_ENTRIES + 5);
+    for (newest = 0; newest < 3 * BLOCK_ENTRIES; newest++) {
+        for (oldest = newest; oldest < newest + BLOCK_ENTRIES; oldest++)
+            check_range(&latency, oldest, newest);
+    }
+}
+END_TEST
+
+START_TEST(test_range_across_blocks)
+{
+    fill(&latency, NUM_ENTRIES / 2 + 7);
+    check_range(&latency, NUM_ENTRIES - 1, 0);
+    check_range(&latency, NUM_ENTRIES / 2, 1);
+    check_random_ranges(&latency);
+}
+END_TEST
+
+START_TEST(test_range_ring_wrap)
+{
+    int lap;
+
+    // Each lap ends at another place in a block, the oldest entries share the block of the current one
+    for (lap = 0; lap < 3; lap++) {
+        fill(&latency, NUM_ENTRIES + BLOCK_ENTRIES / 3 + lap);
+        check_range(&latency, NUM_ENTRIES - 1, 0);
+        check_range(&latency, NUM_ENTRIES - 1, NUM_ENTRIES - BLOCK_ENTRIES);
+        check_random_ranges(&latency);
+    }
+}
+END_TEST
+
+START_TEST(test_range_reindex)
+{
+    static latency_t loaded;
+
+    fill(&latency, 2 * NUM_ENTRIES + 5);
+
+    // Only the entries and the current one are saved, the rest is rebuilt
+    memset(&loaded, 0, sizeof(loaded));
+    loaded.cur_entry = latency.cur_entry;
+    memcpy(loaded.entries, latency.entries, sizeof(loaded.entries));
+    latency_reindex(&loaded);
+    check_range(&loaded, NUM_ENTRIES - 1, 0);
+    check_random_ranges(&loaded);
+
+    // And it keeps up with new samples and ticks from there
+    fill(&loaded, NUM_ENTRIES / 3);
+    check_random_ranges(&loaded);
+}
+END_TEST
+
+Suite *latency_suite(void)
+{
+  Suite *s = suite_create("Latency");
+
+  TCase *tc_range = tcase_create("Range");
+  tcase_add_checked_fixture(tc_range, setup, teardown);
+  tcase_add_test(tc_range, test_range_in_block);
+  tcase_add_test(tc_range, test_range_across_blocks);
+  tcase_add_test(tc_range, test_range_ring_wrap);
+  tcase_add_test(tc_range, test_range_reindex);
+  suite_add_tcase(s, tc_range);
+
+  return s;
+}
+
+int main(void)
+{
+    int number_failed;
+
+    Suite *s = latency_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,129 @@
+/* Benchmark the streaming disk list encoders, JSON against the length
+ * delimited protobuf messages. The output goes nowhere but is pushed through
+ * the same 2KB buffer and chunk sized flushes as the web server.
+ *
+ *   ./list_bench [num_disks] [iterations]
+ */
+#include "../src/disk.h"
+#include "../src/stream.h"
+#include "../src/json.h"
+#include "../src/disk_pb.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_BUF_SIZE 2048
+
+static unsigned long long bytes_out;
+static unsigned long long flushes;
+
+static int null_flush(stream_t *stream, const char *buf, unsigned len)
+{
+	bytes_out += len;
+	flushes++;
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+static double cpu_now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+	return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+static int encode_json(disk_t *disk, stream_t *stream, int num_disks)
+{
+	json_t json;
+	int i;
+
+	json_init(&json, stream);
+	json_array_start(&json, NULL);
+	for (i = 0; i < num_disks; i++) {
+		snprintf(disk->disk_info.serial, sizeof(disk->disk_info.serial), "SN%08d", i);
+		disk_json(disk, &json);
+	}
+	return json_array_end(&json);
+}
+
+static int encode_pb(disk_t *disk, stream_t *stream, int num_disks)
+{
+	int i;
+
+	for (i = 0; i < num_disks; i++) {
+		snprintf(disk->disk_info.serial, sizeof(disk->disk_info.serial), "SN%08d", i);
+		disk_status_pb(disk, stream);
+	}
+	return stream->failed ? -1 : 0;
+}
+
+static int bench(const char *name, int (*encode)(disk_t *, stream_t *, int), disk_t *disk, int num_disks, int iterations)
+{
+	char buf[BENCH_BUF_SIZE];
+	int j;
+
+	bytes_out = 0;
+	flushes = 0;
+
+	double start = now();
+	double cpu_start = cpu_now();
+	for (j = 0; j < iterations; j++) {
+		stream_t stream;
+
+		stream_init(&stream, buf, sizeof(buf), null_flush, NULL);
+		encode(disk, &stream, num_disks);
+		if (stream_flush(&stream) < 0) {
+			fprintf(stderr, "Stream failed\n");
+			return -1;
+		}
+	}
+	double elapsed = now() - start;
+	double cpu = cpu_now() - cpu_start;
+
+	printf("%-8s %d disks x %d iterations: %.3f ms (%.3f ms cpu) per list, %.1f MB/s, %llu bytes per list in %llu flushes\n",
+			name, num_disks, iterations,
+			elapsed * 1000.0 / iterations,
+			cpu * 1000.0 / iterations,
+			bytes_out / elapsed / (1024*1024),
+			bytes_out / iterations, flushes / iterations);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int num_disks = argc > 1 ? atoi(argv[1]) : 5000;
+	int iterations = argc > 2 ? atoi(argv[2]) : 20;
+	int i;
+
+	// A single disk is rendered over and over, the latency history makes disk_t too large to keep thousands
+	disk_t *disk = calloc(1, sizeof(*disk));
+	if (!disk) {
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+	strcpy(disk->sg_path, "/dev/sg0");
+	strcpy(disk->disk_info.vendor, "ATA     ");
+	strcpy(disk->disk_info.model, "Some \"quoted\" model\\");
+	strcpy(disk->disk_info.fw_rev, "FW01");
+	disk->disk_info.disk_type = DISK_TYPE_ATA;
+	disk->latency.cur_entry = 0; // the current entry is the one that gets listed
+	for (i = 0; i < 5; i++)
+		disk->latency.entries[0].top_latencies[i] = 1.5 * (5 - i);
+	for (i = 0; i < 7; i++)
+		disk->latency.entries[0].hist[i] = 1000 >> i;
+
+	if (bench("json", encode_json, disk, num_disks, iterations) < 0 ||
+	    bench("protobuf", encode_pb, disk, num_disks, iterations) < 0)
+		return 1;
+
+	free(disk);
+	return 0;
+}
@@ -0,0 +1,169 @@
+/* Consistency stress test of the shared memory seqlocks. A writer thread
+ * keeps rewriting a few records with fields that are all derived from one
+ * counter while reader threads check every copy they get through the reader
+ * library. A torn copy fails the test.
+ *
+ *   ./shm_stress [readers] [seconds]
+ */
+#include "../src/shm_layout.h"
+#include "../src/shm_reader.h"
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define NUM_RECORDS 4
+#define MAX_READERS 64
+
+static char shm_name[64];
+static volatile int done;
+
+struct reader_stats {
+	pthread_t thread;
+	unsigned long reads;
+	unsigned long unused;
+	unsigned long busy;
+	unsigned long torn;
+};
+
+static void record_fill(shm_disk_record_t *record, uint64_t n)
+{
+	int i;
+
+	record->flags = SHM_DISK_USED | (n & 1 ? SHM_DISK_ALIVE : 0);
+	record->last_probe_ns = n;
+	record->window_start = n * 3;
+	record->window_max_msecs = n;
+	for (i = 0; i < SHM_LATENCY_BUCKETS; i++)
+		record->window_hist[i] = n + i;
+	snprintf(record->serial, sizeof(record->serial), "serial-%"PRIu64, n);
+	snprintf(record->dev, sizeof(record->dev), "/dev/sg%"PRIu64, n % 1000);
+}
+
+static bool record_consistent(const shm_disk_record_t *record)
+{
+	shm_disk_record_t expected;
+
+	memset(&expected, 0, sizeof(expected));
+	record_fill(&expected, record->last_probe_ns);
+	expected.seq = record->seq;
+	return memcmp(&expected, record, sizeof(expected)) == 0;
+}
+
+static void *writer_run(void *arg)
+{
+	shm_disk_record_t *records = arg;
+	uint64_t n = 1;
+
+	while (!done) {
+		shm_disk_record_t *record = &records[n % NUM_RECORDS];
+		shm_write_begin(record);
+		// The strings are rewritten in full so a torn copy shows in them too
+		memset(record->serial, 0, sizeof(record->serial));
+		memset(record->dev, 0, sizeof(record->dev));
+		record_fill(record, n);
+		shm_write_end(record);
+		n++;
+	}
+
+	return NULL;
+}
+
+static void *reader_run(void *arg)
+{
+	struct reader_stats *stats = arg;
+	shm_reader_t reader;
+	shm_disk_record_t record;
+	unsigned i = 0;
+
+	if (shm_reader_open(&reader, shm_name) < 0) {
+		perror("shm_reader_open");
+		exit(1);
+	}
+
+	while (!done) {
+		int ret = shm_reader_get(&reader, i++ % NUM_RECORDS, &record);
+		if (ret < 0)
+			stats->busy++;
+		else if (ret == 0)
+			stats->unused++;
+		else if (!record_consistent(&record))
+			stats->torn++;
+		stats->reads++;
+	}
+
+	shm_reader_close(&reader);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	int num_readers = argc > 1 ? atoi(argv[1]) : 4;
+	int seconds = argc > 2 ? atoi(argv[2]) : 5;
+	struct reader_stats stats[MAX_READERS];
+	pthread_t writer;
+	int i;
+
+	if (num_readers < 1 || num_readers > MAX_READERS) {
+		fprintf(stderr, "1 to %d readers\n", MAX_READERS);
+		return 2;
+	}
+
+	snprintf(shm_name, sizeof(shm_name), "/disksurvey-stress-%d", (int)getpid());
+	size_t size = sizeof(shm_header_t) + NUM_RECORDS * sizeof(shm_disk_record_t);
+	int fd = shm_open(shm_name, O_CREAT|O_EXCL|O_RDWR, 0600);
+	if (fd < 0 || ftruncate(fd, size) < 0) {
+		perror("shm_open");
+		return 1;
+	}
+	shm_header_t *hdr = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED) {
+		perror("mmap");
+		shm_unlink(shm_name);
+		return 1;
+	}
+
+	hdr->version = SHM_EXPORT_VERSION;
+	hdr->record_size = sizeof(shm_disk_record_t);
+	hdr->num_records = NUM_RECORDS;
+	hdr->active = 1;
+	__atomic_store_n(&hdr->magic, SHM_EXPORT_MAGIC, __ATOMIC_RELEASE);
+
+	shm_disk_record_t *records = (shm_disk_record_t *)(hdr + 1);
+	memset(stats, 0, sizeof(stats));
+	pthread_create(&writer, NULL, writer_run, records);
+	for (i = 0; i < num_readers; i++)
+		pthread_create(&stats[i].thread, NULL, reader_run, &stats[i]);
+
+	sleep(seconds);
+	done = 1;
+
+	pthread_join(writer, NULL);
+	unsigned long reads = 0, unused = 0, busy = 0, torn = 0;
+	for (i = 0; i < num_readers; i++) {
+		pthread_join(stats[i].thread, NULL);
+		reads += stats[i].reads;
+		unused += stats[i].unused;
+		busy += stats[i].busy;
+		torn += stats[i].torn;
+	}
+
+	munmap(hdr, size);
+	shm_unlink(shm_name);
+
+	printf("readers %d, %d s: reads %lu (%.1f M/s), unused %lu, out of retries %lu, torn %lu\n",
+			num_readers, seconds, reads, reads / (seconds * 1e6), unused, busy, torn);
+	if (torn > 0) {
+		printf("FAILED: inconsistent copies\n");
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
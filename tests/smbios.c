@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <check.h>
+
+#include "../src/smbios.h"
+
+/* The fixtures are generated by fixtures/dmi/gen_fixtures.py */
+#ifndef DMI_FIXTURE_DIR
+#define DMI_FIXTURE_DIR "tests/fixtures/dmi/"
+#endif
+
+struct fixture {
+    const char *file;
+    bool parsed;
+    const char *system;
+    const char *chassis;
+    const char *baseboard;
+};
+
+static const struct fixture fixtures[] = {
+    { "dell-poweredge.bin", true, "FX2K9Q3", "FX2K9Q3", "/FX2K9Q3/CNFCW0097E00AT/" },
+    { "hpe-proliant.bin", true, "CZJ8270F0P  ", "CZJ8270F0P  ", "PWZVP0ARHBW1MN" },
+    { "supermicro.bin", true, "A263420X9718042", "To be filled by O.E.M.", "ZM197S003456" },
+    { "qemu.bin", true, "Not Specified", "Not Specified", "" },
+    { "lenovo-thinksystem.bin", true, "J30018KD", "", "L1HF89F00CV" },
+    { "truncated.bin", true, "AB.CD", "CH-1", "" },
+};
+
+static size_t fixture_read(const char *name, unsigned char *buf, size_t size)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s%s", DMI_FIXTURE_DIR, name);
+
+    FILE *f = fopen(path, "rb");
+    fail_unless(f != NULL, "Missing fixture %s", path);
+    size_t len = fread(buf, 1, size, f);
+    fclose(f);
+    return len;
+}
+
+START_TEST(test_smbios_fixtures)
+{
+    const struct fixture *fx = &fixtures[_i];
+    unsigned char table[4096];
+    smbios_serials_t serials;
+
+    size_t len = fixture_read(fx->file, table, sizeof(table));
+    fail_unless(smbios_parse(table, len, &serials) == fx->parsed, "%s: parse result", fx->file);
+    ck_assert_str_eq(serials.system, fx->system);
+    ck_assert_str_eq(serials.chassis, fx->chassis);
+    ck_assert_str_eq(serials.baseboard, fx->baseboard);
+}
+END_TEST
+
+START_TEST(test_smbios_bad_index)
+{
+    // A system structure whose serial refers past its only string
+    static const unsigned char table[] = {
+        1, 8, 0x00, 0x01, 1, 0, 0, 2,
+        'V', 0, 0,
+        127, 4, 0xff, 0xff, 0, 0,
+    };
+    smbios_serials_t serials;
+
+    fail_unless(smbios_parse(table, sizeof(table), &serials), "Table must parse");
+    ck_assert_str_eq(serials.system, "<BAD INDEX>");
+}
+END_TEST
+
+START_TEST(test_smbios_garbage)
+{
+    static const unsigned char table[] = { 1, 2, 0, 0, 0, 0 };
+    smbios_serials_t serials;
+
+    fail_unless(!smbios_parse(table, sizeof(table), &serials), "A header length below 4 is invalid");
+    fail_unless(!smbios_parse(table, 0, &serials), "An empty table is invalid");
+    ck_assert_str_eq(serials.system, "");
+}
+END_TEST
+
+Suite *smbios_suite(void)
+{
+  Suite *s = suite_create("SMBIOS");
+
+  TCase *tc_parse = tcase_create("Parse");
+  tcase_add_loop_test(tc_parse, test_smbios_fixtures, 0, sizeof(fixtures)/sizeof(fixtures[0]));
+  tcase_add_test(tc_parse, test_smbios_bad_index);
+  tcase_add_test(tc_parse, test_smbios_garbage);
+  suite_add_tcase(s, tc_parse);
+
+  return s;
+}
+
+int main(void)
+{
+    int number_failed;
+    Suite *s = smbios_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
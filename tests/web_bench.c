@@ -0,0 +1,228 @@
+/* Load the web server with many kept alive connections, each one sends a
+ * request as soon as the previous response is in. Reports the request rate,
+ * the latency percentiles and how many requests were turned away with a 503.
+ * Only responses with a Content-Length are understood, the cached endpoints
+ * such as /api/disks and /metrics answer that way.
+ *
+ *   ./web_bench [port] [connections] [seconds] [path]
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_BUF_SIZE 16384
+#define MAX_SAMPLES (4*1024*1024)
+
+struct conn {
+	int fd;
+	double sent_at;
+	unsigned len; /* bytes of the current response held in buf */
+	char buf[BENCH_BUF_SIZE];
+};
+
+static struct sockaddr_in addr;
+static char request[512];
+static int request_len;
+static int epfd;
+
+static double *samples;
+static unsigned long num_samples;
+static unsigned long num_busy;
+static unsigned long num_errors;
+static unsigned long num_reconnects;
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1000000000.0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+static int conn_send(struct conn *c)
+{
+	c->sent_at = now();
+	c->len = 0;
+	// The request is small enough for any fresh socket buffer
+	return send(c->fd, request, request_len, MSG_NOSIGNAL) == request_len ? 0 : -1;
+}
+
+static int conn_open(struct conn *c)
+{
+	c->fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (c->fd < 0) {
+		perror("socket");
+		return -1;
+	}
+
+	int one = 1;
+	setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("connect");
+		close(c->fd);
+		return -1;
+	}
+	fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+	epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+	return conn_send(c);
+}
+
+static void conn_reopen(struct conn *c)
+{
+	close(c->fd);
+	num_reconnects++;
+	if (conn_open(c) < 0)
+		c->fd = -1;
+}
+
+/* Returns the length of the complete response in the buffer, 0 when more is needed */
+static unsigned response_len(struct conn *c, int *status)
+{
+	char *end = memmem(c->buf, c->len, "\r\n\r\n", 4);
+	if (!end)
+		return 0;
+
+	unsigned hdr_len = end + 4 - c->buf;
+	unsigned body_len = 0;
+	char *p = c->buf;
+
+	*end = 0;
+	if (sscanf(p, "HTTP/1.%*d %d", status) != 1)
+		*status = -1;
+	while ((p = strstr(p, "\r\n")) != NULL) {
+		p += 2;
+		if (strncasecmp(p, "Content-Length:", 15) == 0)
+			body_len = strtoul(p + 15, NULL, 10);
+	}
+	*end = '\r';
+
+	if (c->len < hdr_len + body_len)
+		return 0;
+	return hdr_len + body_len;
+}
+
+static void conn_read(struct conn *c)
+{
+	int status;
+
+	if (c->len == sizeof(c->buf)) {
+		fprintf(stderr, "Response too large for the benchmark\n");
+		exit(1);
+	}
+
+	ssize_t ret = read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len);
+	if (ret < 0 && errno == EAGAIN)
+		return;
+	if (ret <= 0) {
+		num_errors++;
+		conn_reopen(c);
+		return;
+	}
+	c->len += ret;
+
+	unsigned len = response_len(c, &status);
+	if (len == 0)
+		return;
+
+	if (status == 503) {
+		// Turned away, the server closes the connection
+		num_busy++;
+		conn_reopen(c);
+		return;
+	}
+
+	if (status != 200 && status != 304)
+		num_errors++;
+	else if (num_samples < MAX_SAMPLES)
+		samples[num_samples++] = now() - c->sent_at;
+
+	if (conn_send(c) < 0) {
+		num_errors++;
+		conn_reopen(c);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int port = argc > 1 ? atoi(argv[1]) : 5001;
+	int num_conns = argc > 2 ? atoi(argv[2]) : 1000;
+	double duration = argc > 3 ? atof(argv[3]) : 10;
+	const char *path = argc > 4 ? argv[4] : "/api/disks";
+	int i;
+
+	struct rlimit rlim;
+	if (getrlimit(RLIMIT_NOFILE, &rlim) == 0) {
+		rlim.rlim_cur = rlim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rlim);
+	}
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	request_len = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", path);
+
+	samples = malloc(MAX_SAMPLES * sizeof(*samples));
+	struct conn *conns = calloc(num_conns, sizeof(*conns));
+	epfd = epoll_create1(0);
+	if (!samples || !conns || epfd < 0) {
+		perror("setup");
+		return 1;
+	}
+
+	for (i = 0; i < num_conns; i++) {
+		if (conn_open(&conns[i]) < 0)
+			return 1;
+	}
+
+	double start = now();
+	double end = start + duration;
+	struct epoll_event events[256];
+
+	while (now() < end) {
+		int n = epoll_wait(epfd, events, 256, 100);
+		for (i = 0; i < n; i++) {
+			struct conn *c = events[i].data.ptr;
+			if (c->fd >= 0)
+				conn_read(c);
+		}
+	}
+	double elapsed = now() - start;
+
+	for (i = 0; i < num_conns; i++) {
+		if (conns[i].fd >= 0)
+			close(conns[i].fd);
+	}
+
+	printf("connections %d, %.1f s, %s\n", num_conns, elapsed, path);
+	printf("requests %lu, %.0f req/s\n", num_samples, num_samples / elapsed);
+	printf("busy (503) %lu, errors %lu, reconnects %lu\n", num_busy, num_errors, num_reconnects);
+
+	if (num_samples > 0) {
+		qsort(samples, num_samples, sizeof(*samples), cmp_double);
+		printf("latency p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+				samples[num_samples / 2] * 1000,
+				samples[(unsigned long)(num_samples * 0.99)] * 1000,
+				samples[num_samples - 1] * 1000);
+	}
+
+	return 0;
+}
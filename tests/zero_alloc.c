@@ -0,0 +1,186 @@
+/* The paths that run for every probe, every tick and every cached API
+ * request must not touch the heap. They run here against a simulated device
+ * backend in place of sg.c, counted by the allocation tracking that this test
+ * is always built with.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <check.h>
+
+#include "../src/disk.c"
+#include "../src/render_cache.h"
+#include "../src/alloc_track.h"
+
+#define PROBE_CYCLES 10000
+#define PROBES_PER_TICK 12
+#define CACHE_HITS 10000
+
+static disk_t disk;
+
+/* The simulated device backend, every command completes at once with a good status */
+bool sg_init(sg_t *sg, const char *sg_path)
+{
+    memset(sg, 0, sizeof(*sg));
+    sg->sg_fd = -1;
+    return true;
+}
+
+void sg_close(sg_t *sg) {}
+
+int sg_request_submit(sg_t *sg, sg_request_t *req, unsigned char *cdb,
+                      char cdb_len, int dxfer_dir, void *buf, unsigned int buf_len,
+                      unsigned int timeout)
+{
+    memset(&req->hdr, 0, sizeof(req->hdr));
+    req->hdr.interface_id = 'S';
+    req->hdr.dxfer_direction = dxfer_dir;
+    req->hdr.cmd_len = cdb_len;
+    req->hdr.cmdp = cdb;
+    req->hdr.dxferp = buf;
+    req->hdr.dxfer_len = buf_len;
+    req->hdr.mx_sb_len = sizeof(req->sense);
+    req->hdr.sbp = req->sense;
+    req->hdr.timeout = timeout;
+    if (buf)
+        memset(buf, 0, buf_len);
+
+    req->readable = 0;
+    req->syscalls = 1;
+    req->start = monoclock_get();
+    return 0;
+}
+
+int sg_request_wait_response(sg_t *sg, sg_request_t *req)
+{
+    req->end = req->readable = monoclock_get();
+    req->syscalls++;
+    return 0;
+}
+
+static void on_change(disk_t *d) {}
+
+static void setup(void)
+{
+    memset(&disk, 0, sizeof(disk));
+    strcpy(disk.sg_path, "/dev/sg0");
+    strcpy(disk.disk_info.serial, "SIM00001");
+    disk.disk_info.disk_type = DISK_TYPE_SAS;
+    disk.on_change = on_change;
+}
+
+static void teardown(void)
+{
+}
+
+static void probe(void)
+{
+    disk.tur_due = monoclock_get();
+    fail_unless(disk_do_tur(&disk), "The simulated disk must answer");
+}
+
+START_TEST(test_probe_no_alloc)
+{
+    alloc_count_t before, after;
+    int i;
+
+    // The first probe marks the startup trace
+    probe();
+
+    alloc_track_get(&before);
+    for (i = 0; i < PROBE_CYCLES; i++)
+        probe();
+    alloc_track_get(&after);
+
+    fail_unless(disk.commands == PROBE_CYCLES + 1, "Every probe must be a command");
+    fail_unless(after.allocs == before.allocs, "%"PRIu64" allocations in %d probes", after.allocs - before.allocs, PROBE_CYCLES);
+}
+END_TEST
+
+START_TEST(test_tick_no_alloc)
+{
+    alloc_count_t before, after;
+    int i;
+
+    // The first tick monitors the disk, the monitoring is not covered
+    probe();
+    fail_unless(disk_do_tick(&disk), "The first tick must monitor the disk");
+
+    alloc_track_get(&before);
+    for (i = 0; i < PROBE_CYCLES; i++) {
+        probe();
+        if (i % PROBES_PER_TICK == 0)
+            fail_unless(disk_do_tick(&disk), NULL);
+    }
+    alloc_track_get(&after);
+
+    fail_unless(disk.ticks > LATENCY_CLASS_TICKS, "The latency classes must have ticked too");
+    fail_unless(after.allocs == before.allocs, "%"PRIu64" allocations in %d probes and ticks", after.allocs - before.allocs, PROBE_CYCLES);
+}
+END_TEST
+
+static int render_disk(stream_t *stream)
+{
+    json_t json;
+
+    json_init(&json, stream);
+    json_array_start(&json, NULL);
+    disk_json(&disk, &json);
+    return json_array_end(&json);
+}
+
+START_TEST(test_render_cache_hit_no_alloc)
+{
+    render_cache_t cache = { NULL };
+    alloc_count_t before, after;
+    render_buf_t *buf;
+    int i;
+
+    // Rendering a new version allocates its buffers, serving it again must not
+    buf = render_cache_get(&cache, 1, render_disk);
+    fail_unless(buf != NULL, "The rendering must succeed");
+    render_buf_put(buf);
+
+    alloc_track_get(&before);
+    for (i = 0; i < CACHE_HITS; i++) {
+        buf = render_cache_get(&cache, 1, render_disk);
+        fail_unless(buf == cache.cur, "The cached rendering must be served");
+        render_buf_put(buf);
+    }
+    alloc_track_get(&after);
+
+    fail_unless(after.allocs == before.allocs, "%"PRIu64" allocations in %d cache hits", after.allocs - before.allocs, CACHE_HITS);
+}
+END_TEST
+
+Suite *zero_alloc_suite(void)
+{
+  Suite *s = suite_create("Zero Allocation");
+
+  TCase *tc_paths = tcase_create("Hot Paths");
+  tcase_add_checked_fixture(tc_paths, setup, teardown);
+  tcase_add_test(tc_paths, test_probe_no_alloc);
+  tcase_add_test(tc_paths, test_tick_no_alloc);
+  tcase_add_test(tc_paths, test_render_cache_hit_no_alloc);
+  suite_add_tcase(s, tc_paths);
+
+  return s;
+}
+
+int main(void)
+{
+    int number_failed;
+
+    // Without the counting every check here would pass
+    if (!ALLOC_TRACK_ENABLED) {
+        printf("Allocation tracking is not built in, build with -DALLOC_TRACK\n");
+        return EXIT_FAILURE;
+    }
+
+    Suite *s = zero_alloc_suite();
+    SRunner *sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+    return number_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
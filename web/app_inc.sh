@@ -1,5 +1,61 @@
 #!/bin/bash
+#
+# Embed the web assets as byte arrays along with gzip and brotli compressed
+# variants and a content hash, see src/static_asset.h
+#
+# usage: app_inc.sh app.css app.js index.html > app.inc
 
-sed -e '1istatic char app_css[] = ' -e '$a;' -e 's/\\/\\\\/g;s/"/\\"/g;s/  /\\t/g;s/^/"/;s/$/\\n"/' "$1"
-sed -e '1istatic char app_js[] = ' -e '$a;' -e 's/\\/\\\\/g;s/"/\\"/g;s/  /\\t/g;s/^/"/;s/$/\\n"/' "$2"
-sed -e '1istatic char index_html[] = ' -e '$a;' -e 's/\\/\\\\/g;s/"/\\"/g;s/  /\\t/g;s/^/"/;s/$/\\n"/' "$3"
+set -e
+
+TMPDIR=$(mktemp -d)
+trap 'rm -rf "$TMPDIR"' EXIT
+
+hash_of() {
+	sha256sum "$1" | cut -c1-16
+}
+
+# Emit a byte array, the length is taken with sizeof() by the users
+emit_array() {
+	echo "static const unsigned char $1[] = {"
+	od -An -v -tx1 "$2" | sed -e 's/ *$//' -e 's/ \([0-9a-f][0-9a-f]\)/0x\1,/g'
+	echo "};"
+}
+
+emit_asset() {
+	local name=$1 file=$2
+	local gz=none br=none
+
+	emit_array "${name}_data" "$file"
+
+	gzip -9 -n -c "$file" > "$TMPDIR/$name.gz"
+	if [ $(stat -c %s "$TMPDIR/$name.gz") -lt $(stat -c %s "$file") ]; then
+		emit_array "${name}_gz" "$TMPDIR/$name.gz"
+		gz=yes
+	fi
+
+	if command -v brotli > /dev/null && brotli -q 11 -c "$file" > "$TMPDIR/$name.br" && \
+	   [ $(stat -c %s "$TMPDIR/$name.br") -lt $(stat -c %s "$file") ]; then
+		emit_array "${name}_br" "$TMPDIR/$name.br"
+		br=yes
+	fi
+
+	echo "static const struct static_asset $name = {"
+	echo "	${name}_data, sizeof(${name}_data),"
+	if [ $gz = yes ]; then echo "	${name}_gz, sizeof(${name}_gz),"; else echo "	NULL, 0,"; fi
+	if [ $br = yes ]; then echo "	${name}_br, sizeof(${name}_br),"; else echo "	NULL, 0,"; fi
+	echo "	\"$(hash_of "$file")\""
+	echo "};"
+}
+
+CSS_HASH=$(hash_of "$1")
+JS_HASH=$(hash_of "$2")
+
+# The page refers to the exact versions of the assets so they can be cached forever
+sed -e "s|href=\"app.css\"|href=\"app.css?v=$CSS_HASH\"|" \
+    -e "s|src=\"app.js\"|src=\"app.js?v=$JS_HASH\"|" "$3" > "$TMPDIR/index.html"
+
+echo "#include \"static_asset.h\""
+echo "#include <stddef.h>"
+emit_asset app_css "$1"
+emit_asset app_js "$2"
+emit_asset index_html "$TMPDIR/index.html"